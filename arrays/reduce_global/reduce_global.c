@@ -0,0 +1,331 @@
+/* Whole-array reductions: count, sum, mean, variance, min/argmin and max/argmax in one pass.
+ *
+ * The array is cut into fixed-size blocks. Threads reduce blocks independently (pairwise
+ * summation for the sum, a second in-cache pass for the block's sum of squared deviations)
+ * and the per-block partials are then merged in a fixed binary tree. Because the block
+ * boundaries and the merge order do not depend on the thread count, the result is bit for
+ * bit identical however many threads are used.
+ *
+ * NaNs either propagate (any NaN makes every statistic NaN and arg-reductions return the
+ * first NaN) or are omitted from the reduction entirely. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <err.h>
+#include <time.h>
+
+#define BLOCK_SIZE 4096 //Elements per block, 32KiB of doubles.
+#define PAIRWISE_BASE 64 //Below this, sum with plain unrolled accumulators.
+#define LANES 8
+
+enum nan_policy { NAN_PROPAGATE, NAN_OMIT };
+
+//Statistics for a contiguous range of the array. Indices are global.
+struct partial {
+    size_t count;
+    double sum;
+    double m2; //Sum of squared deviations from the mean.
+    double min;
+    double max;
+    size_t argmin;
+    size_t argmax;
+    size_t nans;
+    size_t firstnan;
+};
+
+struct reduction_result {
+    size_t count;
+    double sum;
+    double mean;
+    double variance; //Population variance.
+    double min;
+    double max;
+    size_t argmin;
+    size_t argmax;
+};
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    const double *array;
+    size_t length;
+    struct partial *partials;
+    size_t nblocks;
+    int thread_index;
+    int threads;
+    enum nan_policy policy;
+};
+
+//Pairwise summation. Error grows as O(log n) rather than O(n) for a naive loop.
+static double pairwise_sum(const double *x, size_t n){
+
+    if(n <= PAIRWISE_BASE){
+        double acc[LANES] = {0};
+        size_t i;
+        int k;
+        for(i=0;i+LANES<=n;i+=LANES){
+            for(k=0;k<LANES;k++) acc[k] += x[i+k];
+        }
+        double s = ((acc[0]+acc[1])+(acc[2]+acc[3]))+((acc[4]+acc[5])+(acc[6]+acc[7]));
+        for(;i<n;i++) s += x[i];
+        return s;
+    }
+    size_t half = (n/2) & ~(size_t)(LANES-1);
+    return pairwise_sum(x,half) + pairwise_sum(x+half,n-half);
+}
+
+static double pairwise_sqdev(const double *x, size_t n, double mean){
+
+    if(n <= PAIRWISE_BASE){
+        double acc[LANES] = {0};
+        size_t i;
+        int k;
+        for(i=0;i+LANES<=n;i+=LANES){
+            for(k=0;k<LANES;k++) acc[k] += (x[i+k]-mean)*(x[i+k]-mean);
+        }
+        double s = ((acc[0]+acc[1])+(acc[2]+acc[3]))+((acc[4]+acc[5])+(acc[6]+acc[7]));
+        for(;i<n;i++) s += (x[i]-mean)*(x[i]-mean);
+        return s;
+    }
+    size_t half = (n/2) & ~(size_t)(LANES-1);
+    return pairwise_sqdev(x,half,mean) + pairwise_sqdev(x+half,n-half,mean);
+}
+
+//Value-only extrema in LANES independent lanes so the loop vectorises. The index of the
+//winner is found afterwards with a cheap scan of the (cache resident) block.
+static void lane_minmax(const double *x, size_t n, double *minout, double *maxout){
+
+    double mn[LANES], mx[LANES];
+    size_t i;
+    int k;
+    for(k=0;k<LANES;k++) mn[k] = mx[k] = x[0];
+    for(i=0;i+LANES<=n;i+=LANES){
+        for(k=0;k<LANES;k++){
+            mn[k] = x[i+k] < mn[k] ? x[i+k] : mn[k];
+            mx[k] = x[i+k] > mx[k] ? x[i+k] : mx[k];
+        }
+    }
+    for(;i<n;i++){
+        mn[0] = x[i] < mn[0] ? x[i] : mn[0];
+        mx[0] = x[i] > mx[0] ? x[i] : mx[0];
+    }
+    for(k=1;k<LANES;k++){
+        mn[0] = mn[k] < mn[0] ? mn[k] : mn[0];
+        mx[0] = mx[k] > mx[0] ? mx[k] : mx[0];
+    }
+    *minout = mn[0];
+    *maxout = mx[0];
+}
+
+static size_t count_nans(const double *x, size_t n){
+
+    size_t nans = 0, i;
+    for(i=0;i<n;i++) nans += (x[i] != x[i]);
+    return nans;
+}
+
+//Slow path for a block containing NaNs under NAN_OMIT: only finite-comparable values count.
+static void reduce_block_omit(const double *x, size_t n, size_t base, struct partial *p){
+
+    size_t i;
+    double sum = 0.0, c = 0.0; //Kahan compensation, NaN blocks are rare enough not to bother pairing.
+    p->count = 0;
+    for(i=0;i<n;i++){
+        if(x[i] != x[i]) continue;
+        if(p->count == 0 || x[i] < p->min){ p->min = x[i]; p->argmin = base+i; }
+        if(p->count == 0 || x[i] > p->max){ p->max = x[i]; p->argmax = base+i; }
+        double y = x[i] - c;
+        double t = sum + y;
+        c = (t - sum) - y;
+        sum = t;
+        p->count++;
+    }
+    p->sum = sum;
+    p->m2 = 0.0;
+    if(p->count){
+        double mean = sum/p->count;
+        for(i=0;i<n;i++) if(x[i] == x[i]) p->m2 += (x[i]-mean)*(x[i]-mean);
+    }
+}
+
+static void reduce_block(const double *x, size_t n, size_t base, enum nan_policy policy, struct partial *p){
+
+    size_t i;
+    memset(p,0,sizeof(*p));
+    p->nans = count_nans(x,n);
+    if(p->nans){
+        for(i=0;x[i]==x[i];i++);
+        p->firstnan = base+i;
+        if(policy == NAN_OMIT) reduce_block_omit(x,n,base,p);
+        return; //Under NAN_PROPAGATE the other fields are never read.
+    }
+
+    p->count = n;
+    p->sum = pairwise_sum(x,n);
+    p->m2 = pairwise_sqdev(x,n,p->sum/n);
+    lane_minmax(x,n,&p->min,&p->max);
+    for(i=0;x[i]!=p->min;i++);
+    p->argmin = base+i;
+    for(i=0;x[i]!=p->max;i++);
+    p->argmax = base+i;
+}
+
+//Merges b into a. b must cover indices after a, so ties keep a's (earlier) index.
+static void combine(struct partial *a, const struct partial *b){
+
+    if(b->nans){
+        if(!a->nans) a->firstnan = b->firstnan;
+        a->nans += b->nans;
+    }
+    if(b->count == 0) return;
+    if(a->count == 0){
+        size_t nans = a->nans, firstnan = a->firstnan;
+        *a = *b;
+        a->nans = nans;
+        a->firstnan = firstnan;
+        return;
+    }
+
+    //Chan et al. parallel variance update.
+    double na = a->count, nb = b->count;
+    double delta = b->sum/nb - a->sum/na;
+    a->m2 += b->m2 + delta*delta*na*nb/(na+nb);
+    a->sum += b->sum;
+    a->count += b->count;
+    if(b->min < a->min){ a->min = b->min; a->argmin = b->argmin; }
+    if(b->max > a->max){ a->max = b->max; a->argmax = b->argmax; }
+}
+
+void *reduce_worker(void *threadArg){
+
+    struct thread_data *inst_thread_data = (struct thread_data *) threadArg;
+    size_t b;
+
+    for(b=inst_thread_data->thread_index;b<inst_thread_data->nblocks;b+=inst_thread_data->threads){
+        size_t start = b*BLOCK_SIZE;
+        size_t n = inst_thread_data->length - start < BLOCK_SIZE ? inst_thread_data->length - start : BLOCK_SIZE;
+        reduce_block(inst_thread_data->array+start,n,start,inst_thread_data->policy,&inst_thread_data->partials[b]);
+    }
+    return NULL;
+}
+
+struct reduction_result reduce_global(const double *array, size_t length, int threads, enum nan_policy policy){
+
+    struct reduction_result result;
+    size_t nblocks = (length + BLOCK_SIZE - 1)/BLOCK_SIZE;
+    size_t stride, b;
+    int i;
+
+    if(length == 0) errx(1,"Cannot reduce an empty array.");
+
+    struct partial *partials = malloc(nblocks*sizeof(struct partial));
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+
+    for(i=0;i<threads;i++){
+        thread_desc[i].array = array;
+        thread_desc[i].length = length;
+        thread_desc[i].partials = partials;
+        thread_desc[i].nblocks = nblocks;
+        thread_desc[i].thread_index = i;
+        thread_desc[i].threads = threads;
+        thread_desc[i].policy = policy;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, reduce_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+
+    //Fixed-shape tree merge, independent of how blocks were shared between threads.
+    for(stride=1;stride<nblocks;stride*=2){
+        for(b=0;b+stride<nblocks;b+=2*stride){
+            combine(&partials[b],&partials[b+stride]);
+        }
+    }
+
+    struct partial *p = &partials[0];
+    if(p->nans && policy == NAN_PROPAGATE){
+        result.count = length;
+        result.sum = result.mean = result.variance = result.min = result.max = NAN;
+        result.argmin = result.argmax = p->firstnan;
+    }
+    else if(p->count == 0){
+        result.count = 0;
+        result.sum = 0.0;
+        result.mean = result.variance = result.min = result.max = NAN;
+        result.argmin = result.argmax = 0;
+    }
+    else {
+        result.count = p->count;
+        result.sum = p->sum;
+        result.mean = p->sum/p->count;
+        result.variance = p->m2/p->count;
+        result.min = p->min;
+        result.max = p->max;
+        result.argmin = p->argmin;
+        result.argmax = p->argmax;
+    }
+
+    free(partials);
+    free(thread_desc);
+    return result;
+}
+
+void printresult(const char *label, struct reduction_result r){
+
+    printf("%s: count %zu sum %.17g mean %.17g variance %.17g min %.9g @ %zu max %.9g @ %zu\n",
+           label,r.count,r.sum,r.mean,r.variance,r.min,r.argmin,r.max,r.argmax);
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+int main(int argc, char *argv[]){
+
+    if(argc < 3){
+        fprintf(stderr,"Usage: %s <length> <threads>\n",argv[0]);
+        return -1;
+    }
+
+    size_t length = strtoull(argv[1],NULL,10);
+    int threads = strtol(argv[2],NULL,10);
+    if(!length || threads < 1){
+        return 0;
+    }
+
+    double *array = malloc(length*sizeof(double));
+    size_t i;
+    for(i=0;i<length;i++) array[i] = 1e6 + (double)rand()/RAND_MAX; //Large offset stresses the variance.
+
+    //Naive long double reference.
+    long double lsum = 0.0L, lsq = 0.0L;
+    for(i=0;i<length;i++) lsum += array[i];
+    long double lmean = lsum/length;
+    for(i=0;i<length;i++) lsq += (array[i]-lmean)*(array[i]-lmean);
+    printf("reference: sum %.17Lg mean %.17Lg variance %.17Lg\n",lsum,lmean,lsq/length);
+
+    double t0 = seconds();
+    struct reduction_result one = reduce_global(array,length,1,NAN_PROPAGATE);
+    double t1 = seconds();
+    struct reduction_result many = reduce_global(array,length,threads,NAN_PROPAGATE);
+    double t2 = seconds();
+    printresult("1 thread",one);
+    printresult("N threads",many);
+    if(memcmp(&one,&many,sizeof(one))) errx(1,"Result depends on thread count!");
+    printf("1 thread: %f s, %d threads: %f s\n",t1-t0,threads,t2-t1);
+
+    //NaN handling.
+    array[length/2] = NAN;
+    printresult("propagate",reduce_global(array,length,threads,NAN_PROPAGATE));
+    printresult("omit",reduce_global(array,length,threads,NAN_OMIT));
+
+    free(array);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/* Out-of-core non-overlapping max/mean reduction over memory-mapped raw arrays.
+ * Input and output are binary files with a small header (magic, dtype, rows, cols)
+ * followed by row-major data. The input is walked in bands of rows: while one band
+ * is being reduced a helper thread faults in the next one, and finished bands are
+ * dropped from both mappings so peak RSS stays at a few bands whatever the file size. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define RAW_MAGIC "RAWARR1"
+#define DEFAULT_BAND_BYTES (64 << 20) //Roughly how much input each band covers.
+
+enum raw_dtype { DTYPE_FLOAT32 = 1, DTYPE_FLOAT64 = 2 };
+enum reduce_mode { REDUCE_MAX, REDUCE_MEAN };
+
+struct rawheader {
+    char magic[8];
+    int32_t dtype;
+    int32_t reserved;
+    int64_t rows;
+    int64_t cols;
+};
+
+//A raw array file mapped into memory.
+struct rawfile {
+    int fd;
+    struct rawheader *header;
+    size_t length;
+    char *data; //First element after the header.
+};
+
+//Work handed to the prefetch thread: a byte range in the input mapping.
+struct prefetch_data {
+    pthread_t thread_id;
+    char *start;
+    size_t length;
+};
+
+static size_t pagesize;
+
+static size_t dtypesize(int32_t dtype){
+
+    switch(dtype){
+    case DTYPE_FLOAT32: return sizeof(float);
+    case DTYPE_FLOAT64: return sizeof(double);
+    default: errx(1,"Unknown dtype %d",dtype);
+    }
+}
+
+//Widens a page-unaligned range to whole pages so it can be passed to madvise().
+static void pagealign(char *start, size_t length, char **alignedstart, size_t *alignedlength){
+
+    uintptr_t s = (uintptr_t)start & ~(uintptr_t)(pagesize-1);
+    uintptr_t e = ((uintptr_t)start + length + pagesize - 1) & ~(uintptr_t)(pagesize-1);
+    *alignedstart = (char *)s;
+    *alignedlength = e - s;
+}
+
+//Only whole pages lying inside the range may be dropped, or we would discard a neighbour's data.
+static void dropband(char *start, size_t length){
+
+    uintptr_t s = ((uintptr_t)start + pagesize - 1) & ~(uintptr_t)(pagesize-1);
+    uintptr_t e = ((uintptr_t)start + length) & ~(uintptr_t)(pagesize-1);
+    if(e > s) madvise((void *)s, e - s, MADV_DONTNEED);
+}
+
+struct rawfile openrawfile(const char *path){
+
+    struct rawfile f;
+    struct stat st;
+
+    f.fd = open(path, O_RDONLY);
+    if(f.fd < 0) err(1,"%s",path);
+    if(fstat(f.fd,&st)) err(1,"%s",path);
+    if((size_t)st.st_size < sizeof(struct rawheader)) errx(1,"%s: too short for a header",path);
+    f.length = st.st_size;
+    f.header = mmap(NULL, f.length, PROT_READ, MAP_SHARED, f.fd, 0);
+    if(f.header == MAP_FAILED) err(1,"mmap %s",path);
+    if(memcmp(f.header->magic,RAW_MAGIC,sizeof(RAW_MAGIC))) errx(1,"%s: bad magic",path);
+    if(f.header->rows < 1 || f.header->cols < 1) errx(1,"%s: empty array",path);
+    if(f.length < sizeof(struct rawheader) + (size_t)(f.header->rows*f.header->cols)*dtypesize(f.header->dtype))
+        errx(1,"%s: truncated data",path);
+    f.data = (char *)(f.header + 1);
+    madvise(f.header, f.length, MADV_SEQUENTIAL);
+    return f;
+}
+
+struct rawfile createrawfile(const char *path, int32_t dtype, int64_t rows, int64_t cols){
+
+    struct rawfile f;
+
+    f.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(f.fd < 0) err(1,"%s",path);
+    f.length = sizeof(struct rawheader) + (size_t)(rows*cols)*dtypesize(dtype);
+    if(ftruncate(f.fd, f.length)) err(1,"ftruncate %s",path);
+    f.header = mmap(NULL, f.length, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, 0);
+    if(f.header == MAP_FAILED) err(1,"mmap %s",path);
+    memcpy(f.header->magic,RAW_MAGIC,sizeof(RAW_MAGIC));
+    f.header->dtype = dtype;
+    f.header->reserved = 0;
+    f.header->rows = rows;
+    f.header->cols = cols;
+    f.data = (char *)(f.header + 1);
+    return f;
+}
+
+void closerawfile(struct rawfile *f){
+
+    munmap(f->header, f->length);
+    close(f->fd);
+}
+
+//Asks the kernel for the range, then touches a byte per page so the reads really happen
+//in this thread rather than as page faults in the compute thread.
+void *prefetch_worker(void *threadArg){
+
+    struct prefetch_data *inst = (struct prefetch_data *) threadArg;
+    char *start;
+    size_t length, off;
+    volatile char sink = 0;
+
+    pagealign(inst->start,inst->length,&start,&length);
+    madvise(start, length, MADV_WILLNEED);
+    for(off=0;off<length;off+=pagesize){
+        sink ^= start[off];
+    }
+    (void)sink;
+    return NULL;
+}
+
+//Reduces one band of input rows into its output rows. The input may be float32 or float64;
+//the output always matches the input dtype.
+#define DEFINE_REDUCEBAND(NAME, TYPE)                                                      \
+static void NAME(const TYPE *in, TYPE *out, int64_t outrows, int64_t cols,                 \
+                 int reduction, enum reduce_mode mode){                                    \
+    int64_t outcols = cols/reduction;                                                      \
+    int64_t i,j;                                                                           \
+    int l,m;                                                                               \
+    for(i=0;i<outrows;i++){                                                                \
+        for(j=0;j<outcols;j++){                                                            \
+            double acc = (mode == REDUCE_MAX) ? in[(i*reduction)*cols + j*reduction] : 0.0; \
+            for(l=0;l<reduction;l++){                                                      \
+                const TYPE *row = in + (i*reduction+l)*cols + j*reduction;                 \
+                for(m=0;m<reduction;m++){                                                  \
+                    if(mode == REDUCE_MAX) acc = MAX(acc,row[m]);                          \
+                    else acc += row[m];                                                    \
+                }                                                                          \
+            }                                                                              \
+            if(mode == REDUCE_MEAN) acc /= (double)(reduction*reduction);                  \
+            out[i*outcols+j] = (TYPE)acc;                                                  \
+        }                                                                                  \
+    }                                                                                      \
+}
+
+DEFINE_REDUCEBAND(reduceband_f32, float)
+DEFINE_REDUCEBAND(reduceband_f64, double)
+
+void reducemapped(struct rawfile *in, struct rawfile *out, int reduction, int64_t bandrows, enum reduce_mode mode){
+
+    int64_t rows = in->header->rows;
+    int64_t cols = in->header->cols;
+    size_t esize = dtypesize(in->header->dtype);
+    size_t inrowbytes = (size_t)cols*esize;
+    size_t outrowbytes = (size_t)(cols/reduction)*esize;
+
+    if(rows%reduction || cols%reduction) errx(1,"dimension/window size mismatch!");
+    bandrows -= bandrows%reduction;
+    if(bandrows < reduction) bandrows = reduction;
+
+    struct prefetch_data prefetch;
+    int prefetching = 0;
+    int64_t band;
+
+    for(band=0;band<rows;band+=bandrows){
+
+        int64_t nrows = MIN(bandrows,rows-band);
+        char *inband = in->data + band*inrowbytes;
+        char *outband = out->data + (band/reduction)*outrowbytes;
+
+        //Wait for this band to arrive, then start on the next one while we compute.
+        if(prefetching) pthread_join(prefetch.thread_id,NULL);
+        prefetching = 0;
+        if(band + bandrows < rows){
+            prefetch.start = inband + nrows*inrowbytes;
+            prefetch.length = MIN(bandrows,rows-band-bandrows)*inrowbytes;
+            if(pthread_create(&prefetch.thread_id, NULL, prefetch_worker, &prefetch)) errx(1,"Thread creation failed.");
+            prefetching = 1;
+        }
+
+        if(in->header->dtype == DTYPE_FLOAT32)
+            reduceband_f32((const float *)inband,(float *)outband,nrows/reduction,cols,reduction,mode);
+        else
+            reduceband_f64((const double *)inband,(double *)outband,nrows/reduction,cols,reduction,mode);
+
+        //Hand finished output to writeback and drop both bands from our resident set.
+        char *syncstart;
+        size_t synclength;
+        pagealign(outband,(nrows/reduction)*outrowbytes,&syncstart,&synclength);
+        msync(syncstart, synclength, MS_ASYNC);
+        dropband(inband, nrows*inrowbytes);
+        dropband(outband, (nrows/reduction)*outrowbytes);
+    }
+
+    if(prefetching) pthread_join(prefetch.thread_id,NULL);
+    msync(out->header, out->length, MS_SYNC);
+}
+
+//Writes a test input file, a band at a time so it can be larger than memory.
+void generaterawfile(const char *path, int32_t dtype, int64_t rows, int64_t cols){
+
+    struct rawfile f = createrawfile(path,dtype,rows,cols);
+    size_t esize = dtypesize(dtype);
+    int64_t i,j;
+
+    for(i=0;i<rows;i++){
+        char *row = f.data + (size_t)i*cols*esize;
+        for(j=0;j<cols;j++){
+            if(dtype == DTYPE_FLOAT32) ((float *)row)[j] = rand()%100;
+            else ((double *)row)[j] = rand()%100;
+        }
+        if((i+1)%1024 == 0) dropband(f.data + (size_t)(i-1023)*cols*esize, 1024*cols*esize);
+    }
+    closerawfile(&f);
+}
+
+
+static void usage(const char *prog){
+
+    fprintf(stderr,"Usage: %s generate <file> <f32|f64> <rows> <cols>\n"
+                   "       %s <max|mean> <input> <output> <reduction> [band rows]\n",prog,prog);
+    exit(-1);
+}
+
+int main(int argc, char *argv[]){
+
+    pagesize = sysconf(_SC_PAGESIZE);
+
+    if(argc == 6 && !strcmp(argv[1],"generate")){
+        if(strcmp(argv[3],"f32") && strcmp(argv[3],"f64")) usage(argv[0]);
+        int32_t dtype = strcmp(argv[3],"f32") ? DTYPE_FLOAT64 : DTYPE_FLOAT32;
+        int64_t rows = strtoll(argv[4],NULL,10), cols = strtoll(argv[5],NULL,10);
+        if(rows < 1 || cols < 1) usage(argv[0]);
+        generaterawfile(argv[2],dtype,rows,cols);
+        return 0;
+    }
+
+    if(argc < 5 || argc > 6) usage(argv[0]);
+
+    enum reduce_mode mode = REDUCE_MAX;
+    if(!strcmp(argv[1],"mean")) mode = REDUCE_MEAN;
+    else if(strcmp(argv[1],"max")) usage(argv[0]);
+    int reduction = strtol(argv[4],NULL,10);
+    if(reduction < 1) errx(1,"Reduction must be positive.");
+
+    struct rawfile in = openrawfile(argv[2]);
+    struct rawfile out = createrawfile(argv[3],in.header->dtype,in.header->rows/reduction,in.header->cols/reduction);
+
+    int64_t bandrows = (argc > 5) ? strtoll(argv[5],NULL,10)
+                                  : DEFAULT_BAND_BYTES/(in.header->cols*(int64_t)dtypesize(in.header->dtype));
+    reducemapped(&in,&out,reduction,bandrows,mode);
+
+    printf("Reduced %lldx%lld -> %lldx%lld\n",(long long)in.header->rows,(long long)in.header->cols,
+           (long long)out.header->rows,(long long)out.header->cols);
+
+    closerawfile(&in);
+    closerawfile(&out);
+    return 0;
+}
@@ -0,0 +1,258 @@
+/* Max pooling forward and backward passes.
+ * The forward pass works as in reduce_max_threaded.c, but also records which element of
+ * each window won as a one byte offset (l*reduction + m) into the window. The backward pass
+ * routes each upstream gradient to that element. For the sliding window, neighbouring windows
+ * overlap and can pick the same input, so gradients are accumulated; each thread owns a band
+ * of input rows and only writes inside it, so no locking is needed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <err.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+//Data structure passed to each threaded routine to bound where it works on the array.
+//Bounds are inclusive.
+struct arrayindex {
+
+    int imin;
+    int imax;
+};
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    double *inputmatrix;
+    double *outputmatrix;
+    uint8_t *argmax;
+    double *gradoutput;
+    double *gradinput;
+    int dimensions;
+    int reduction;
+    int stride; //reduction for non-overlapping windows, 1 for the sliding window.
+    struct arrayindex bounds;
+};
+
+static inline int outputsize(int dimensions, int reduction, int stride){
+
+    return (dimensions - reduction)/stride + 1;
+}
+
+//Forward pass over output rows imin..imax. Ties go to the first element in the window.
+void *maxpool_forward_worker(void *threadArg){
+
+    struct thread_data *inst_thread_data = (struct thread_data *) threadArg;
+    int dimensions = inst_thread_data->dimensions;
+    int reduction = inst_thread_data->reduction;
+    int stride = inst_thread_data->stride;
+    int outputdimensions = outputsize(dimensions,reduction,stride);
+
+    int i,j,l,m;
+    for(i=inst_thread_data->bounds.imin;i<=inst_thread_data->bounds.imax;i++){
+        for(j=0;j<outputdimensions;j++){
+            const double *window = inst_thread_data->inputmatrix + (size_t)(i*stride)*dimensions + j*stride;
+            double best = window[0];
+            uint8_t bestoffset = 0;
+            for(l=0;l<reduction;l++){
+                for(m=0;m<reduction;m++){
+                    if(window[l*dimensions+m] > best){
+                        best = window[l*dimensions+m];
+                        bestoffset = l*reduction+m;
+                    }
+                }
+            }
+            inst_thread_data->outputmatrix[(size_t)i*outputdimensions+j] = best;
+            inst_thread_data->argmax[(size_t)i*outputdimensions+j] = bestoffset;
+        }
+    }
+    return NULL;
+}
+
+//Backward pass for input rows imin..imax. Visits every output row whose window touches
+//the band and keeps only the contributions that land inside it.
+void *maxpool_backward_worker(void *threadArg){
+
+    struct thread_data *inst_thread_data = (struct thread_data *) threadArg;
+    int dimensions = inst_thread_data->dimensions;
+    int reduction = inst_thread_data->reduction;
+    int stride = inst_thread_data->stride;
+    int outputdimensions = outputsize(dimensions,reduction,stride);
+    int rowmin = inst_thread_data->bounds.imin;
+    int rowmax = inst_thread_data->bounds.imax;
+
+    memset(inst_thread_data->gradinput + (size_t)rowmin*dimensions, 0,
+           (size_t)(rowmax-rowmin+1)*dimensions*sizeof(double));
+
+    //First and last output rows whose windows overlap input rows rowmin..rowmax.
+    int omin = MAX(0,(rowmin - reduction + stride)/stride);
+    int omax = MIN(outputdimensions-1,rowmax/stride);
+
+    int i,j;
+    for(i=omin;i<=omax;i++){
+        for(j=0;j<outputdimensions;j++){
+            uint8_t offset = inst_thread_data->argmax[(size_t)i*outputdimensions+j];
+            int row = i*stride + offset/reduction;
+            int col = j*stride + offset%reduction;
+            if(row < rowmin || row > rowmax) continue;
+            inst_thread_data->gradinput[(size_t)row*dimensions+col] += inst_thread_data->gradoutput[(size_t)i*outputdimensions+j];
+        }
+    }
+    return NULL;
+}
+
+//Splits `rows` rows into contiguous bands, runs `worker` on each and waits for them.
+void runthreaded(void *(*worker)(void *), struct thread_data *proto, int rows, int threads){
+
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+    int i;
+
+    for(i=0;i<threads;i++){
+        thread_desc[i] = *proto;
+        thread_desc[i].bounds.imin = (int)((long)rows*i/threads);
+        thread_desc[i].bounds.imax = (int)((long)rows*(i+1)/threads) - 1;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+    free(thread_desc);
+}
+
+void maxpool_forward(double *inputmatrix, double *outputmatrix, uint8_t *argmax, int dimensions,
+                     int reduction, int stride, int threads){
+
+    if(reduction*reduction > 256) errx(1,"Window too large for a uint8 argmax map!");
+    if(stride == reduction && dimensions%reduction) errx(1,"dimension/window size mismatch!");
+
+    struct thread_data proto = {0};
+    proto.inputmatrix = inputmatrix;
+    proto.outputmatrix = outputmatrix;
+    proto.argmax = argmax;
+    proto.dimensions = dimensions;
+    proto.reduction = reduction;
+    proto.stride = stride;
+    runthreaded(maxpool_forward_worker,&proto,outputsize(dimensions,reduction,stride),threads);
+}
+
+void maxpool_backward(double *gradoutput, uint8_t *argmax, double *gradinput, int dimensions,
+                      int reduction, int stride, int threads){
+
+    struct thread_data proto = {0};
+    proto.argmax = argmax;
+    proto.gradoutput = gradoutput;
+    proto.gradinput = gradinput;
+    proto.dimensions = dimensions;
+    proto.reduction = reduction;
+    proto.stride = stride;
+    runthreaded(maxpool_backward_worker,&proto,dimensions,threads);
+}
+
+//Sequential scatter used to check the threaded version.
+void maxpool_backward_reference(double *gradoutput, uint8_t *argmax, double *gradinput, int dimensions,
+                                int reduction, int stride){
+
+    int outputdimensions = outputsize(dimensions,reduction,stride);
+    int i,j;
+    memset(gradinput,0,(size_t)dimensions*dimensions*sizeof(double));
+    for(i=0;i<outputdimensions;i++){
+        for(j=0;j<outputdimensions;j++){
+            uint8_t offset = argmax[(size_t)i*outputdimensions+j];
+            gradinput[(size_t)(i*stride + offset/reduction)*dimensions + j*stride + offset%reduction] += gradoutput[(size_t)i*outputdimensions+j];
+        }
+    }
+}
+
+void initializematrix(double *matrix,int dimensions){
+
+    int i,j;
+
+    for(j=0;j<dimensions;j++){
+        for(i=0;i<dimensions;i++){
+            matrix[i*dimensions+j] = rand()%100;
+        }
+    }
+
+}
+
+void printmatrix(double *matrix,int dimensions){
+
+    int i,j;
+
+    for(i=0;i<dimensions;i++){
+        for(j=0;j<dimensions;j++){
+            printf("%f ",matrix[i*dimensions+j]);
+        }
+        printf("\n");
+    }
+}
+
+//Runs forward and backward for one stride and checks the gradient against the reference.
+void testpool(double *matrix, int dimensions, int reduction, int stride, int threads, const char *label){
+
+    int outputdimensions = outputsize(dimensions,reduction,stride);
+    size_t nout = (size_t)outputdimensions*outputdimensions;
+    double *pooled = malloc(nout*sizeof(double));
+    uint8_t *argmax = malloc(nout);
+    double *gradoutput = malloc(nout*sizeof(double));
+    double *gradinput = malloc((size_t)dimensions*dimensions*sizeof(double));
+    double *gradreference = malloc((size_t)dimensions*dimensions*sizeof(double));
+    size_t k;
+
+    maxpool_forward(matrix,pooled,argmax,dimensions,reduction,stride,threads);
+    for(k=0;k<nout;k++) gradoutput[k] = 1.0;
+    maxpool_backward(gradoutput,argmax,gradinput,dimensions,reduction,stride,threads);
+    maxpool_backward_reference(gradoutput,argmax,gradreference,dimensions,reduction,stride);
+
+    if(memcmp(gradinput,gradreference,(size_t)dimensions*dimensions*sizeof(double)))
+        errx(1,"%s gradient does not match reference!",label);
+
+    if(dimensions <= 16){
+        printf("\n %s pooled matrix: \n",label);
+        printmatrix(pooled,outputdimensions);
+        printf("\n %s input gradient: \n",label);
+        printmatrix(gradinput,dimensions);
+    }
+    else {
+        printf("%s: gradients match reference.\n",label);
+    }
+
+    free(pooled);
+    free(argmax);
+    free(gradoutput);
+    free(gradinput);
+    free(gradreference);
+}
+
+
+int main(int argc, char *argv[]){
+
+    if(argc < 4){
+        fprintf(stderr,"Usage: %s <dimensions> <reduction> <threads>\n",argv[0]);
+        return -1;
+    }
+
+    int dimensionmatrix = strtol(argv[1],NULL,10);
+    int reduction = strtol(argv[2],NULL,10);
+    int threads = strtol(argv[3],NULL,10);
+    if(!dimensionmatrix || reduction < 1 || threads < 1){
+        return 0;
+    }
+
+    double *matrix = malloc((size_t)dimensionmatrix * dimensionmatrix * sizeof(double));
+    initializematrix(matrix,dimensionmatrix);
+    if(dimensionmatrix <= 16){
+        printf("Initial matrix: \n");
+        printmatrix(matrix,dimensionmatrix);
+    }
+
+    testpool(matrix,dimensionmatrix,reduction,reduction,threads,"No overlap");
+    testpool(matrix,dimensionmatrix,reduction,1,threads,"Sliding window");
+
+    free(matrix);
+    return 0;
+}
@@ -0,0 +1,264 @@
+/* Builds a multi-level max or mean image pyramid in a single pass over the input.
+ * Rather than running reduce_max/reduce_mean once per level (which re-reads the
+ * previous level from main memory each time), the input is cut into tiles and every
+ * pyramid level for a tile is produced while that tile is still in cache.
+ * All levels live in one contiguous allocation, indexed through an offset table. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <err.h>
+#include <time.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MAX_LEVELS 16
+#define TILE_SIZE 64 //Edge length of an input tile. Fits comfortably in L1/L2 as doubles.
+
+enum reduce_mode { REDUCE_MAX, REDUCE_MEAN };
+
+//Every level of the pyramid, stored back to back. Level 0 is the first reduced level.
+struct pyramid {
+    double *data;
+    size_t offsets[MAX_LEVELS];
+    int dimensions[MAX_LEVELS];
+    int levels;
+};
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    double *inputmatrix;
+    struct pyramid *pyramid;
+    int dimensions;
+    int tile;
+    int thread_index;
+    int threads;
+    enum reduce_mode mode;
+};
+
+//Sets up offsets for a pyramid of the given depth and allocates it as one block.
+void initpyramid(struct pyramid *pyr, int dimensions, int levels){
+
+    if(levels < 1 || levels > MAX_LEVELS) errx(1,"Unsupported number of levels: %d",levels);
+    if(dimensions % (1 << levels)) errx(1,"dimension/level mismatch!");
+
+    size_t total = 0;
+    int l;
+    for(l=0;l<levels;l++){
+        pyr->dimensions[l] = dimensions >> (l+1);
+        pyr->offsets[l] = total;
+        total += (size_t)pyr->dimensions[l] * pyr->dimensions[l];
+    }
+    pyr->levels = levels;
+    pyr->data = malloc(total * sizeof(double));
+    if(pyr->data == NULL) errx(1,"Could not allocate pyramid.");
+}
+
+void freepyramid(struct pyramid *pyr){
+
+    free(pyr->data);
+    pyr->data = NULL;
+}
+
+static inline double *pyramidlevel(struct pyramid *pyr, int level){
+
+    return pyr->data + pyr->offsets[level];
+}
+
+//Reduces one 2x2 window at a time from a source region into a destination region.
+//Regions are given as pointers to their top-left element plus the row stride of their parent array.
+static inline void reducetile(const double *src, int srcstride, double *dst, int dststride,
+                              int outsize, enum reduce_mode mode){
+
+    int i,j;
+    if(mode == REDUCE_MAX){
+        for(i=0;i<outsize;i++){
+            const double *r0 = src + (size_t)(2*i)*srcstride;
+            const double *r1 = r0 + srcstride;
+            double *o = dst + (size_t)i*dststride;
+            for(j=0;j<outsize;j++){
+                o[j] = MAX(MAX(r0[2*j],r0[2*j+1]),MAX(r1[2*j],r1[2*j+1]));
+            }
+        }
+    }
+    else {
+        for(i=0;i<outsize;i++){
+            const double *r0 = src + (size_t)(2*i)*srcstride;
+            const double *r1 = r0 + srcstride;
+            double *o = dst + (size_t)i*dststride;
+            for(j=0;j<outsize;j++){
+                o[j] = 0.25 * ((r0[2*j] + r0[2*j+1]) + (r1[2*j] + r1[2*j+1]));
+            }
+        }
+    }
+}
+
+//Produces every pyramid level for one input tile. Each level is read back from the
+//pyramid while it is still cache resident to produce the next.
+static void pyramidtile(const double *inputmatrix, int dimensions, struct pyramid *pyr,
+                        int tile, int ti, int tj, enum reduce_mode mode){
+
+    const double *src = inputmatrix + (size_t)(ti*tile)*dimensions + tj*tile;
+    int srcstride = dimensions;
+    int size = tile;
+    int l;
+
+    for(l=0;l<pyr->levels && size > 1;l++){
+        int outsize = size/2;
+        int dststride = pyr->dimensions[l];
+        double *dst = pyramidlevel(pyr,l) + (size_t)(ti*outsize)*dststride + tj*outsize;
+        reducetile(src,srcstride,dst,dststride,outsize,mode);
+        src = dst;
+        srcstride = dststride;
+        size = outsize;
+    }
+}
+
+//Levels coarser than one output element per tile need a second, tiny pass over the finest
+//level the tiles could produce.
+static void pyramidtail(struct pyramid *pyr, int firstlevel, enum reduce_mode mode){
+
+    int l;
+    for(l=firstlevel;l<pyr->levels;l++){
+        reducetile(pyramidlevel(pyr,l-1),pyr->dimensions[l-1],pyramidlevel(pyr,l),
+                   pyr->dimensions[l],pyr->dimensions[l],mode);
+    }
+}
+
+//Tiles are dealt out round-robin so every thread sees a similar mix of rows.
+void *pyramid_worker(void *threadArg){
+
+    struct thread_data *inst_thread_data = (struct thread_data *) threadArg;
+    int tilesperrow = inst_thread_data->dimensions/inst_thread_data->tile;
+    int ntiles = tilesperrow*tilesperrow;
+    int t;
+
+    for(t=inst_thread_data->thread_index;t<ntiles;t+=inst_thread_data->threads){
+        pyramidtile(inst_thread_data->inputmatrix,inst_thread_data->dimensions,inst_thread_data->pyramid,
+                    inst_thread_data->tile,t/tilesperrow,t%tilesperrow,inst_thread_data->mode);
+    }
+    return NULL;
+}
+
+//Builds every level of the pyramid with the given number of threads.
+void buildpyramid(double *inputmatrix, int dimensions, struct pyramid *pyr, int threads, enum reduce_mode mode){
+
+    int tile = TILE_SIZE;
+    while(dimensions % tile) tile /= 2;
+    if(tile < 2) errx(1,"dimension/tile mismatch!");
+
+    //Number of levels each tile can produce on its own.
+    int tilelevels = 0;
+    while((tile >> tilelevels) > 1 && tilelevels < pyr->levels) tilelevels++;
+
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+    int i;
+    for(i=0;i<threads;i++){
+        thread_desc[i].inputmatrix = inputmatrix;
+        thread_desc[i].pyramid = pyr;
+        thread_desc[i].dimensions = dimensions;
+        thread_desc[i].tile = tile;
+        thread_desc[i].thread_index = i;
+        thread_desc[i].threads = threads;
+        thread_desc[i].mode = mode;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, pyramid_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+    free(thread_desc);
+
+    pyramidtail(pyr,tilelevels,mode);
+}
+
+//Reference: one full pass over the previous level per output level.
+void buildpyramid_levelwise(double *inputmatrix, int dimensions, struct pyramid *pyr, enum reduce_mode mode){
+
+    int l;
+    reducetile(inputmatrix,dimensions,pyramidlevel(pyr,0),pyr->dimensions[0],pyr->dimensions[0],mode);
+    for(l=1;l<pyr->levels;l++){
+        reducetile(pyramidlevel(pyr,l-1),pyr->dimensions[l-1],pyramidlevel(pyr,l),pyr->dimensions[l],pyr->dimensions[l],mode);
+    }
+}
+
+void initializematrix(double *matrix,int dimensions){
+
+    size_t i;
+
+    for(i=0;i<(size_t)dimensions*dimensions;i++){
+        matrix[i] = rand()%100;
+    }
+
+}
+
+void printmatrix(double *matrix,int dimensions){
+
+    int i,j;
+
+    for(i=0;i<dimensions;i++){
+        for(j=0;j<dimensions;j++){
+            printf("%f ",matrix[i*dimensions+j]);
+        }
+        printf("\n");
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+int main(int argc, char *argv[]){
+
+    if(argc < 5){
+        fprintf(stderr,"Usage: %s <dimensions> <levels> <threads> <max|mean>\n",argv[0]);
+        return -1;
+    }
+
+    int dimensionmatrix = strtol(argv[1],NULL,10);
+    int levels = strtol(argv[2],NULL,10);
+    int threads = strtol(argv[3],NULL,10);
+    enum reduce_mode mode = REDUCE_MAX;
+    if(!strcmp(argv[4],"mean")) mode = REDUCE_MEAN;
+    else if(strcmp(argv[4],"max")) errx(1,"Mode must be max or mean, not %s.",argv[4]);
+    if(!dimensionmatrix || threads < 1){
+        return 0;
+    }
+
+    double *matrix = malloc((size_t)dimensionmatrix * dimensionmatrix * sizeof(double));
+    initializematrix(matrix,dimensionmatrix);
+
+    struct pyramid fused, levelwise;
+    initpyramid(&fused,dimensionmatrix,levels);
+    initpyramid(&levelwise,dimensionmatrix,levels);
+
+    double t0 = seconds();
+    buildpyramid(matrix,dimensionmatrix,&fused,threads,mode);
+    double t1 = seconds();
+    buildpyramid_levelwise(matrix,dimensionmatrix,&levelwise,mode);
+    double t2 = seconds();
+
+    int l;
+    for(l=0;l<levels;l++){
+        size_t n = (size_t)fused.dimensions[l]*fused.dimensions[l];
+        if(memcmp(pyramidlevel(&fused,l),pyramidlevel(&levelwise,l),n*sizeof(double)))
+            errx(1,"Level %d does not match level-by-level reduction!",l);
+        if(fused.dimensions[l] <= 8){
+            printf("\n Level %d (%dx%d): \n",l+1,fused.dimensions[l],fused.dimensions[l]);
+            printmatrix(pyramidlevel(&fused,l),fused.dimensions[l]);
+        }
+    }
+
+    printf("\nFused pyramid: %f s\nLevel-by-level pyramid: %f s\n",t1-t0,t2-t1);
+
+    freepyramid(&fused);
+    freepyramid(&levelwise);
+    free(matrix);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+/* Type-specialised non-overlapping max/mean pooling for uint8, uint16, int32, float32
+ * and float64 matrices. Each variant is stamped out from one macro template so that
+ * 8-bit camera frames are reduced as 8-bit data rather than being widened to double.
+ *
+ * The window is processed in two steps. First the rows of a window are combined
+ * vertically into a row buffer (contiguous, so the compiler can fill SIMD lanes), then
+ * each group of `reduction` columns in that buffer is combined horizontally. Mean
+ * accumulators are only as wide as the window needs: the row buffer of a uint8 mean is
+ * uint16, and only the horizontal sum is widened to uint32. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+#include <time.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+//Rounds an accumulated sum to the nearest element value.
+#define ROUND_UNSIGNED(sum, n) (((sum) + (n)/2)/(n))
+#define ROUND_SIGNED(sum, n) (((sum) >= 0) ? ((sum) + (n)/2)/(n) : ((sum) - (n)/2)/(n))
+#define ROUND_FLOAT(sum, n) ((sum)/(n))
+
+/* Generates matrixreduce_max_SUFFIX and matrixreduce_mean_SUFFIX.
+ *   TYPE     element type
+ *   ROWACC   type of the vertical (row buffer) mean accumulator
+ *   WIDEACC  type of the final per-window mean accumulator
+ *   ROWLIMIT largest window height the row accumulator can hold without overflow
+ *   ROUND    one of the ROUND_ macros above */
+#define DEFINE_REDUCE(SUFFIX, TYPE, ROWACC, WIDEACC, ROWLIMIT, ROUND)                         \
+void matrixreduce_max_##SUFFIX(const TYPE *restrict inputmatrix, TYPE *restrict outputmatrix,  \
+                               int dimensions, int reduction){                                \
+                                                                                              \
+    if(dimensions%reduction) errx(1,"dimension/window size mismatch!");                       \
+                                                                                              \
+    int outputdimensions = dimensions/reduction;                                              \
+    TYPE *rowbuf = malloc(dimensions*sizeof(TYPE));                                           \
+    int i,j,l,m;                                                                              \
+    for(i=0;i<outputdimensions;i++){                                                          \
+        const TYPE *row = inputmatrix + (size_t)(i*reduction)*dimensions;                     \
+        memcpy(rowbuf,row,dimensions*sizeof(TYPE));                                           \
+        for(l=1;l<reduction;l++){                                                             \
+            row += dimensions;                                                                \
+            for(j=0;j<dimensions;j++) rowbuf[j] = MAX(rowbuf[j],row[j]);                      \
+        }                                                                                     \
+        TYPE *out = outputmatrix + (size_t)i*outputdimensions;                                \
+        for(j=0;j<outputdimensions;j++){                                                      \
+            TYPE v = rowbuf[j*reduction];                                                     \
+            for(m=1;m<reduction;m++) v = MAX(v,rowbuf[j*reduction+m]);                        \
+            out[j] = v;                                                                       \
+        }                                                                                     \
+    }                                                                                         \
+    free(rowbuf);                                                                             \
+}                                                                                             \
+                                                                                              \
+void matrixreduce_mean_##SUFFIX(const TYPE *restrict inputmatrix, TYPE *restrict outputmatrix, \
+                                int dimensions, int reduction){                               \
+                                                                                              \
+    if(dimensions%reduction) errx(1,"dimension/window size mismatch!");                       \
+    if(reduction > (int)(ROWLIMIT)) errx(1,"window too tall for %s accumulator!",#ROWACC);    \
+                                                                                              \
+    int outputdimensions = dimensions/reduction;                                              \
+    WIDEACC n = (WIDEACC)reduction*reduction;                                                 \
+    ROWACC *rowbuf = malloc(dimensions*sizeof(ROWACC));                                       \
+    int i,j,l,m;                                                                              \
+    for(i=0;i<outputdimensions;i++){                                                          \
+        const TYPE *row = inputmatrix + (size_t)(i*reduction)*dimensions;                     \
+        for(j=0;j<dimensions;j++) rowbuf[j] = row[j];                                         \
+        for(l=1;l<reduction;l++){                                                             \
+            row += dimensions;                                                                \
+            for(j=0;j<dimensions;j++) rowbuf[j] += row[j];                                    \
+        }                                                                                     \
+        TYPE *out = outputmatrix + (size_t)i*outputdimensions;                                \
+        for(j=0;j<outputdimensions;j++){                                                      \
+            WIDEACC sum = 0;                                                                  \
+            for(m=0;m<reduction;m++) sum += rowbuf[j*reduction+m];                            \
+            out[j] = (TYPE)ROUND(sum,n);                                                      \
+        }                                                                                     \
+    }                                                                                         \
+    free(rowbuf);                                                                             \
+}
+
+DEFINE_REDUCE(u8,  uint8_t,  uint16_t, uint32_t, UINT16_MAX/UINT8_MAX,  ROUND_UNSIGNED)
+DEFINE_REDUCE(u16, uint16_t, uint32_t, uint64_t, UINT32_MAX/UINT16_MAX, ROUND_UNSIGNED)
+DEFINE_REDUCE(i32, int32_t,  int64_t,  int64_t,  INT32_MAX,             ROUND_SIGNED)
+DEFINE_REDUCE(f32, float,    float,    float,    INT32_MAX,             ROUND_FLOAT)
+DEFINE_REDUCE(f64, double,   double,   double,   INT32_MAX,             ROUND_FLOAT)
+
+//Reference implementation in double, matching reduce_max.c/reduce_mean.c.
+void matrixreduce_reference(const double *inputmatrix, double *outputmatrix, int dimensions, int reduction, int mean){
+
+    int outputdimensions = dimensions/reduction;
+    int i,j,l,m;
+    for(i=0;i<outputdimensions;i++){
+        for(j=0;j<outputdimensions;j++){
+            double acc = mean ? 0.0 : inputmatrix[(size_t)(i*reduction)*dimensions+j*reduction];
+            for(l=0;l<reduction;l++){
+                for(m=0;m<reduction;m++){
+                    double v = inputmatrix[(size_t)(i*reduction+l)*dimensions+(j*reduction+m)];
+                    acc = mean ? acc + v : MAX(acc,v);
+                }
+            }
+            outputmatrix[(size_t)i*outputdimensions+j] = mean ? acc/(reduction*reduction) : acc;
+        }
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//Runs max and mean for one type, timing each and checking it against the double reference.
+#define BENCH_TYPE(SUFFIX, TYPE, TOLERANCE)                                                   \
+static void bench_##SUFFIX(const double *source, const double *refmax, const double *refmean, \
+                           int dimensions, int reduction){                                   \
+    size_t n = (size_t)dimensions*dimensions;                                                 \
+    size_t nout = n/((size_t)reduction*reduction);                                            \
+    TYPE *in = malloc(n*sizeof(TYPE));                                                        \
+    TYPE *outmax = malloc(nout*sizeof(TYPE));                                                 \
+    TYPE *outmean = malloc(nout*sizeof(TYPE));                                                \
+    size_t k;                                                                                 \
+    for(k=0;k<n;k++) in[k] = (TYPE)source[k];                                                 \
+    /* Untimed first pass faults in the output pages. */                                      \
+    matrixreduce_max_##SUFFIX(in,outmax,dimensions,reduction);                                \
+    matrixreduce_mean_##SUFFIX(in,outmean,dimensions,reduction);                              \
+                                                                                              \
+    double t0 = seconds();                                                                    \
+    matrixreduce_max_##SUFFIX(in,outmax,dimensions,reduction);                                \
+    double t1 = seconds();                                                                    \
+    matrixreduce_mean_##SUFFIX(in,outmean,dimensions,reduction);                              \
+    double t2 = seconds();                                                                    \
+                                                                                              \
+    for(k=0;k<nout;k++){                                                                      \
+        if(outmax[k] != (TYPE)refmax[k]) errx(1,"%s max mismatch at %zu",#SUFFIX,k);          \
+        if(fabs((double)outmean[k]-refmean[k]) > (TOLERANCE)) errx(1,"%s mean mismatch at %zu",#SUFFIX,k); \
+    }                                                                                         \
+    printf("%-4s max: %f s  mean: %f s\n",#SUFFIX,t1-t0,t2-t1);                               \
+    free(in);                                                                                 \
+    free(outmax);                                                                             \
+    free(outmean);                                                                            \
+}
+
+BENCH_TYPE(u8,  uint8_t,  0.5)
+BENCH_TYPE(u16, uint16_t, 0.5)
+BENCH_TYPE(i32, int32_t,  0.5)
+BENCH_TYPE(f32, float,    1e-3)
+BENCH_TYPE(f64, double,   1e-9)
+
+
+int main(int argc, char *argv[]){
+
+    if(argc < 3){
+        fprintf(stderr,"Usage: %s <dimensions> <reduction>\n",argv[0]);
+        return -1;
+    }
+
+    int dimensionmatrix = strtol(argv[1],NULL,10);
+    int reduction = strtol(argv[2],NULL,10);
+    if(!dimensionmatrix || reduction < 1){
+        return 0;
+    }
+
+    size_t n = (size_t)dimensionmatrix*dimensionmatrix;
+    size_t nout = n/((size_t)reduction*reduction);
+    double *source = malloc(n*sizeof(double));
+    double *refmax = malloc(nout*sizeof(double));
+    double *refmean = malloc(nout*sizeof(double));
+    size_t k;
+    for(k=0;k<n;k++) source[k] = rand()%256; //Representable exactly in every type.
+
+    double t0 = seconds();
+    matrixreduce_reference(source,refmax,dimensionmatrix,reduction,0);
+    double t1 = seconds();
+    matrixreduce_reference(source,refmean,dimensionmatrix,reduction,1);
+    double t2 = seconds();
+    printf("ref  max: %f s  mean: %f s\n",t1-t0,t2-t1);
+
+    bench_u8(source,refmax,refmean,dimensionmatrix,reduction);
+    bench_u16(source,refmax,refmean,dimensionmatrix,reduction);
+    bench_i32(source,refmax,refmean,dimensionmatrix,reduction);
+    bench_f32(source,refmax,refmean,dimensionmatrix,reduction);
+    bench_f64(source,refmax,refmean,dimensionmatrix,reduction);
+
+    free(source);
+    free(refmax);
+    free(refmean);
+    return 0;
+}
@@ -0,0 +1,260 @@
+/* Batched multi-channel 2D convolution (NCHW) lowered to matrix multiplication.
+ *
+ * For one image, convolution with K filters of C x R x S is a GEMM:
+ *     output[K][OH*OW] = filters[K][C*R*S] x columns[C*R*S][OH*OW]
+ * where each column holds the input patch under one output pixel (im2col). The full column
+ * matrix is R*S times larger than the image, so it is never built: output pixels are
+ * processed in blocks of PIXEL_BLOCK, and only that block's columns are expanded, into a
+ * buffer small enough to stay in cache while the blocked multiply consumes it.
+ *
+ * The multiply is the cache-blocked kernel from maths/matrix_multiply/matrix_mul_blocked.c,
+ * extended with leading dimensions and remainder handling so it can work on sub-blocks.
+ * Work is split across threads by (image, output channel block). As in CNN layers, this is
+ * a cross-correlation with zero padding and unit stride. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <err.h>
+#include <time.h>
+
+#define BLOCK_SIZE 16
+#define PIXEL_BLOCK 256 //Output pixels expanded per im2col block.
+#define CHANNEL_BLOCK 16 //Output channels per thread task.
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+//Shape of a convolution layer.
+struct conv_shape {
+    int batch;
+    int channels;
+    int height;
+    int width;
+    int out_channels;
+    int kernel_h;
+    int kernel_w;
+    int pad;
+    int out_h;
+    int out_w;
+};
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    const struct conv_shape *shape;
+    const float *input;
+    const float *filters;
+    float *output;
+    int thread_index;
+    int threads;
+};
+
+/* c[n1 x m2] += a[n1 x m1] * b, as multiply_matrices in matrix_mul_blocked.c:
+ * a is row-major with row stride lda, b is column-major (each of the m2 columns is m1
+ * contiguous values, column stride ldb) and c is row-major with row stride ldc. */
+void multiply_matrices_ld(const float *restrict a, int lda, const float *restrict b, int ldb,
+                          float *restrict c, int ldc, int m1, int n1, int m2){
+
+    int i,j,k;
+    for(j=0;j<n1;j+=BLOCK_SIZE){
+        int jmax = MIN(j+BLOCK_SIZE,n1);
+        for(i=0;i<m2;i+=BLOCK_SIZE){
+            int imax = MIN(i+BLOCK_SIZE,m2);
+            for(k=0;k<m1;k+=BLOCK_SIZE){
+                int kmax = MIN(k+BLOCK_SIZE,m1);
+                for(int jj=j;jj<jmax;jj++){
+                    for(int ii=i;ii<imax;ii++){
+                        float acc = *(c+jj*ldc+ii);
+                        for(int kk=k;kk<kmax;kk++){
+                            acc += *(a+jj*lda+kk) * *(b+ii*ldb+kk);
+                        }
+                        *(c+jj*ldc+ii) = acc;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//Expands output pixels [p0, p0+count) of one image into columns of length C*R*S.
+static void im2col_block(const struct conv_shape *s, const float *image, int p0, int count, float *columns){
+
+    int crs = s->channels*s->kernel_h*s->kernel_w;
+    int p,c,r,q;
+
+    for(p=0;p<count;p++){
+        int oy = (p0+p)/s->out_w, ox = (p0+p)%s->out_w;
+        float *col = columns + (size_t)p*crs;
+        for(c=0;c<s->channels;c++){
+            const float *plane = image + (size_t)c*s->height*s->width;
+            for(r=0;r<s->kernel_h;r++){
+                int y = oy + r - s->pad;
+                for(q=0;q<s->kernel_w;q++){
+                    int x = ox + q - s->pad;
+                    *col++ = (y >= 0 && y < s->height && x >= 0 && x < s->width) ? plane[(size_t)y*s->width+x] : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+//Tasks are (image, block of output channels) pairs handed out round-robin.
+void *conv_worker(void *threadArg){
+
+    struct thread_data *inst = (struct thread_data *) threadArg;
+    const struct conv_shape *s = inst->shape;
+    int crs = s->channels*s->kernel_h*s->kernel_w;
+    int npixels = s->out_h*s->out_w;
+    int kblocks = (s->out_channels + CHANNEL_BLOCK - 1)/CHANNEL_BLOCK;
+    int ntasks = s->batch*kblocks;
+    int task,p0;
+
+    float *columns = malloc((size_t)PIXEL_BLOCK*crs*sizeof(float));
+
+    for(task=inst->thread_index;task<ntasks;task+=inst->threads){
+        int n = task/kblocks;
+        int k0 = (task%kblocks)*CHANNEL_BLOCK;
+        int kcount = MIN(CHANNEL_BLOCK,s->out_channels-k0);
+        const float *image = inst->input + (size_t)n*s->channels*s->height*s->width;
+        float *out = inst->output + ((size_t)n*s->out_channels + k0)*npixels;
+
+        for(p0=0;p0<npixels;p0+=PIXEL_BLOCK){
+            int count = MIN(PIXEL_BLOCK,npixels-p0);
+            int k;
+            im2col_block(s,image,p0,count,columns);
+            for(k=0;k<kcount;k++) memset(out+(size_t)k*npixels+p0,0,count*sizeof(float));
+            multiply_matrices_ld(inst->filters+(size_t)k0*crs,crs,columns,crs,out+p0,npixels,crs,kcount,count);
+        }
+    }
+
+    free(columns);
+    return NULL;
+}
+
+void init_conv_shape(struct conv_shape *s, int batch, int channels, int height, int width,
+                     int out_channels, int kernel_h, int kernel_w, int pad){
+
+    s->batch = batch;
+    s->channels = channels;
+    s->height = height;
+    s->width = width;
+    s->out_channels = out_channels;
+    s->kernel_h = kernel_h;
+    s->kernel_w = kernel_w;
+    s->pad = pad;
+    s->out_h = height + 2*pad - kernel_h + 1;
+    s->out_w = width + 2*pad - kernel_w + 1;
+    if(s->out_h < 1 || s->out_w < 1) errx(1,"Kernel larger than padded input!");
+}
+
+//input: batch x channels x height x width, filters: out_channels x channels x kernel_h x kernel_w,
+//output: batch x out_channels x out_h x out_w.
+void conv2d_im2col(const struct conv_shape *s, const float *input, const float *filters, float *output, int threads){
+
+    if(threads < 1) threads = 1;
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+    int i;
+
+    for(i=0;i<threads;i++){
+        thread_desc[i].shape = s;
+        thread_desc[i].input = input;
+        thread_desc[i].filters = filters;
+        thread_desc[i].output = output;
+        thread_desc[i].thread_index = i;
+        thread_desc[i].threads = threads;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, conv_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+    free(thread_desc);
+}
+
+//Seven nested loops, used to check the GEMM path.
+void conv2d_direct(const struct conv_shape *s, const float *input, const float *filters, float *output){
+
+    int n,k,c,y,x,r,q;
+    for(n=0;n<s->batch;n++){
+        for(k=0;k<s->out_channels;k++){
+            for(y=0;y<s->out_h;y++){
+                for(x=0;x<s->out_w;x++){
+                    double acc = 0.0;
+                    for(c=0;c<s->channels;c++){
+                        for(r=0;r<s->kernel_h;r++){
+                            int iy = y + r - s->pad;
+                            if(iy < 0 || iy >= s->height) continue;
+                            for(q=0;q<s->kernel_w;q++){
+                                int ix = x + q - s->pad;
+                                if(ix < 0 || ix >= s->width) continue;
+                                acc += input[(((size_t)n*s->channels + c)*s->height + iy)*s->width + ix] *
+                                       filters[(((size_t)k*s->channels + c)*s->kernel_h + r)*s->kernel_w + q];
+                            }
+                        }
+                    }
+                    output[(((size_t)n*s->out_channels + k)*s->out_h + y)*s->out_w + x] = acc;
+                }
+            }
+        }
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+int main(int argc, char *argv[]){
+
+    //Defaults are a typical mid-network layer: 8 x 64 x 56 x 56 -> 64 channels, 3x3, pad 1.
+    int batch = argc > 1 ? strtol(argv[1],NULL,10) : 8;
+    int channels = argc > 2 ? strtol(argv[2],NULL,10) : 64;
+    int size = argc > 3 ? strtol(argv[3],NULL,10) : 56;
+    int out_channels = argc > 4 ? strtol(argv[4],NULL,10) : 64;
+    int ksize = argc > 5 ? strtol(argv[5],NULL,10) : 3;
+    int threads = argc > 6 ? strtol(argv[6],NULL,10) : 1;
+
+    struct conv_shape s;
+    init_conv_shape(&s,batch,channels,size,size,out_channels,ksize,ksize,ksize/2);
+
+    size_t nin = (size_t)s.batch*s.channels*s.height*s.width;
+    size_t nfilter = (size_t)s.out_channels*s.channels*s.kernel_h*s.kernel_w;
+    size_t nout = (size_t)s.batch*s.out_channels*s.out_h*s.out_w;
+    float *input = malloc(nin*sizeof(float));
+    float *filters = malloc(nfilter*sizeof(float));
+    float *output = malloc(nout*sizeof(float));
+    float *reference = malloc(nout*sizeof(float));
+    size_t i;
+
+    for(i=0;i<nin;i++) input[i] = (float)rand()/RAND_MAX;
+    for(i=0;i<nfilter;i++) filters[i] = (float)rand()/RAND_MAX - 0.5f;
+
+    double t0 = seconds();
+    conv2d_direct(&s,input,filters,reference);
+    double t1 = seconds();
+    conv2d_im2col(&s,input,filters,output,threads);
+    double t2 = seconds();
+
+    double worst = 0.0;
+    for(i=0;i<nout;i++){
+        double e = fabs(output[i]-reference[i])/(1.0+fabs(reference[i]));
+        if(e > worst) worst = e;
+    }
+    if(worst > 1e-4) errx(1,"im2col result differs from direct convolution: %g",worst);
+
+    double flops = 2.0*nout*s.channels*s.kernel_h*s.kernel_w;
+    printf("%d x %d x %d x %d -> %d channels, %dx%d kernel, %d threads\n",
+           s.batch,s.channels,s.height,s.width,s.out_channels,s.kernel_h,s.kernel_w,threads);
+    printf("Direct: %f s (%.2f GFLOP/s)\n",t1-t0,flops/(t1-t0)/1e9);
+    printf("im2col + GEMM: %f s (%.2f GFLOP/s), max relative error %g\n",t2-t1,flops/(t2-t1)/1e9,worst);
+
+    free(input);
+    free(filters);
+    free(output);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,1195 @@
+/* Applies a 2D convolution kernel (for example one built with convolve2d_kernels.c) to
+ * a full-size image.
+ *
+ * The output is the same size as the image, with the kernel centred on each pixel. Pixels
+ * outside the image are taken from the chosen border mode:
+ *   BORDER_ZERO     0 outside the image
+ *   BORDER_CLAMP    nearest edge pixel                   aaa|abcd|ddd
+ *   BORDER_REFLECT  mirrored about the edge pixel        dcb|abcd|cba
+ *
+ * The image is split into bands of rows which threads take in turn. Each thread copies its
+ * band plus a halo of kernel_y-1 rows and kernel_x-1 columns into a padded tile, resolving
+ * the border there, so the inner loops run with no bounds checks. The inner loop walks
+ * contiguous output pixels for one kernel tap at a time so the compiler can vectorise it.
+ *
+ * Before convolving, the kernel is factored with an SVD. Composite kernels such as
+ * box x box x box are rank one, and most smooth filters are close to low rank, so when
+ * rank*(k_x + k_y) taps (plus the extra passes) beat k_x*k_y the image is filtered as a
+ * sum of separable row-then-column passes instead.
+ *
+ * Large kernels that do not factor are cheaper in the frequency domain. The FFT path
+ * cuts the output into tiles and convolves each tile's halo-padded input with the kernel
+ * spectrum (overlap-save), two real tiles per complex transform. A simple cost model picks
+ * direct, separable or FFT for each kernel and image size.
+ *
+ * Pipelines that apply the same sequence of kernels to many frames can build a filter
+ * chain instead. The chain is composed once, analysed once, and kept in an LRU cache
+ * keyed by a hash of the kernel sizes and contents, so repeated chains cost a hash and
+ * a compare. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <pthread.h>
+#include <err.h>
+#include <time.h>
+
+#define TILE_ROWS 32 //Output rows per tile.
+#define SEPARABLE_TOLERANCE 1e-12 //Relative Frobenius error allowed when truncating the SVD.
+#define SVD_MAX_SWEEPS 64
+#define FFT_MIN_SIZE 32
+#define FFT_MAX_SIZE 1024
+
+//Relative costs used to choose a convolution method, in units of one multiply-add per
+//pixel per tap. Measured at plain -O2 (scalar x86-64, no -march) on 1080p frames, where
+//a tap costs about 0.45 ns; recalibrate if building with wider vectors.
+#define COST_DIRECT_TAP 1.0
+#define COST_PASS 13.0 //Halo copy and output write for one pass over the image.
+#define COST_FFT_BUTTERFLY 10.0
+#define COST_FFT_POINT 20.0 //Tile copy-in, spectrum multiply and copy-out per FFT point.
+#define CHAIN_CACHE_BUCKETS 256
+
+enum border_mode { BORDER_ZERO, BORDER_CLAMP, BORDER_REFLECT };
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    const double *image;
+    double *output;
+    const double *kernel; //Flipped, so the inner loop is a straight correlation.
+    int width;
+    int height;
+    int k_x;
+    int k_y;
+    enum border_mode border;
+    int thread_index;
+    int threads;
+};
+
+//Precomputed tables for an in-place radix-2 FFT of size n.
+struct fft_plan {
+    int n;
+    int *bitreverse;
+    double complex *twiddle; //n/2 forward twiddle factors.
+};
+
+//Work shared by the threads of the FFT image path.
+struct fft_thread_data {
+    pthread_t thread_id;
+    const double *image;
+    double *output;
+    const double complex *spectrum; //Kernel spectrum, n x n, scaled by 1/n^2.
+    const struct fft_plan *plan;
+    int width;
+    int height;
+    int k_x;
+    int k_y;
+    enum border_mode border;
+    int thread_index;
+    int threads;
+};
+
+//A kernel written as a sum of `rank` outer products col[r] x row[r]. The singular values
+//are folded into the column vectors.
+struct separable_kernel {
+    int rank;
+    int k_x;
+    int k_y;
+    double *col; //rank x k_y
+    double *row; //rank x k_x
+};
+
+//A sequence of kernels composed into one, with its separable factors.
+//Owned by a chain_cache; hold a reference while using it.
+struct filter_chain {
+    uint64_t hash;
+    int nkernels;
+    int *sizes; //k_x, k_y for each kernel.
+    double *kernels; //Copy of the source kernels, back to back, for exact comparison.
+    double *composite;
+    int k_x;
+    int k_y;
+    struct separable_kernel sep;
+    int refs;
+    struct filter_chain *bucketnext;
+    struct filter_chain *lrunext; //Towards least recently used.
+    struct filter_chain *lruprev;
+};
+
+//LRU cache of composed filter chains. Safe to share between threads.
+struct chain_cache {
+    pthread_mutex_t lock;
+    int capacity;
+    int count;
+    long hits;
+    long misses;
+    struct filter_chain *buckets[CHAIN_CACHE_BUCKETS];
+    struct filter_chain *lruhead; //Most recently used.
+    struct filter_chain *lrutail;
+};
+
+//Maps a coordinate outside [0,size) back into the image. Returns -1 for BORDER_ZERO.
+static inline int borderindex(int i, int size, enum border_mode border){
+
+    if(i >= 0 && i < size) return i;
+    switch(border){
+    case BORDER_ZERO:
+        return -1;
+    case BORDER_CLAMP:
+        return i < 0 ? 0 : size-1;
+    case BORDER_REFLECT:
+        if(size == 1) return 0;
+        //Kernels wider than the image may need several bounces.
+        while(i < 0 || i >= size){
+            if(i < 0) i = -i;
+            if(i >= size) i = 2*(size-1) - i;
+        }
+        return i;
+    }
+    return -1;
+}
+
+//Copies image row `row` into `dst`, extended by `left` and `right` border pixels.
+static void padrow(const double *image, int width, int height, int row, int left, int right,
+                   enum border_mode border, double *dst){
+
+    int y = borderindex(row,height,border);
+    int x;
+
+    if(y < 0){
+        memset(dst,0,(size_t)(left+width+right)*sizeof(double));
+        return;
+    }
+    const double *src = image + (size_t)y*width;
+    for(x=-left;x<0;x++){
+        int xi = borderindex(x,width,border);
+        dst[x+left] = xi < 0 ? 0.0 : src[xi];
+    }
+    memcpy(dst+left,src,(size_t)width*sizeof(double));
+    for(x=width;x<width+right;x++){
+        int xi = borderindex(x,width,border);
+        dst[x+left] = xi < 0 ? 0.0 : src[xi];
+    }
+}
+
+//Correlates `rows` output rows from a padded tile. Output rows are `width` long and the
+//padded rows `width + k_x - 1` long.
+static void correlatetile(const double *restrict tile, int width, int rows,
+                          const double *restrict kernel, int k_x, int k_y,
+                          double *restrict output, int outstride){
+
+    int pw = width + k_x - 1;
+    int r,kx,ky,x;
+
+    for(r=0;r<rows;r++){
+        double *restrict acc = output + (size_t)r*outstride;
+        memset(acc,0,(size_t)width*sizeof(double));
+        for(ky=0;ky<k_y;ky++){
+            const double *restrict src = tile + (size_t)(r+ky)*pw;
+            for(kx=0;kx<k_x;kx++){
+                double w = kernel[ky*k_x+kx];
+                if(w == 0.0) continue;
+                const double *restrict s = src + kx;
+                for(x=0;x<width;x++){
+                    acc[x] += w * s[x];
+                }
+            }
+        }
+    }
+}
+
+void *convolve_worker(void *threadArg){
+
+    struct thread_data *inst_thread_data = (struct thread_data *) threadArg;
+    int width = inst_thread_data->width;
+    int height = inst_thread_data->height;
+    int k_x = inst_thread_data->k_x;
+    int k_y = inst_thread_data->k_y;
+    //Halo sizes for the flipped kernel: the centre tap ((k_x-1)/2,(k_y-1)/2) moves to (k_x/2,k_y/2).
+    int left = k_x/2, right = k_x-1-left;
+    int top = k_y/2;
+    int pw = width + k_x - 1;
+    int ntiles = (height + TILE_ROWS - 1)/TILE_ROWS;
+    int t,r;
+
+    double *tile = malloc((size_t)(TILE_ROWS + k_y - 1)*pw*sizeof(double));
+    if(tile == NULL) errx(1,"Could not allocate tile.");
+
+    for(t=inst_thread_data->thread_index;t<ntiles;t+=inst_thread_data->threads){
+        int y0 = t*TILE_ROWS;
+        int rows = height - y0 < TILE_ROWS ? height - y0 : TILE_ROWS;
+
+        //Band plus halo, with the border resolved once here.
+        for(r=0;r<rows+k_y-1;r++){
+            padrow(inst_thread_data->image,width,height,y0-top+r,left,right,inst_thread_data->border,tile+(size_t)r*pw);
+        }
+        correlatetile(tile,width,rows,inst_thread_data->kernel,k_x,k_y,
+                      inst_thread_data->output+(size_t)y0*width,width);
+    }
+
+    free(tile);
+    return NULL;
+}
+
+//Direct 2D convolution of a width x height row-major image with a k_x x k_y kernel into
+//`output` (same size as the image). The kernel is centred on tap ((k_x-1)/2,(k_y-1)/2).
+//`output` must not alias `image`.
+void convolve2d_image_direct(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                      double *output, enum border_mode border, int threads){
+
+    if(width < 1 || height < 1 || k_x < 1 || k_y < 1) errx(1,"Bad image or kernel dimensions!");
+    if(threads < 1) threads = 1;
+
+    //Flip the kernel so the tile loop is a correlation.
+    double *flipped = malloc((size_t)k_x*k_y*sizeof(double));
+    int i,j;
+    for(j=0;j<k_y;j++){
+        for(i=0;i<k_x;i++){
+            flipped[j*k_x+i] = kernel[(k_y-1-j)*k_x+(k_x-1-i)];
+        }
+    }
+
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+    for(i=0;i<threads;i++){
+        thread_desc[i].image = image;
+        thread_desc[i].output = output;
+        thread_desc[i].kernel = flipped;
+        thread_desc[i].width = width;
+        thread_desc[i].height = height;
+        thread_desc[i].k_x = k_x;
+        thread_desc[i].k_y = k_y;
+        thread_desc[i].border = border;
+        thread_desc[i].thread_index = i;
+        thread_desc[i].threads = threads;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, convolve_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+
+    free(thread_desc);
+    free(flipped);
+}
+
+//One-sided Jacobi SVD of the k_y x k_x kernel: kernel = U diag(sigma) V^T.
+//u is k_y x k_x, v is k_x x k_x (both row-major), sigma has k_x entries, unsorted.
+static void kernel_svd(const double *kernel, int k_x, int k_y, double *u, double *sigma, double *v){
+
+    int m = k_y, n = k_x;
+    int i,p,q,sweep;
+
+    memcpy(u,kernel,(size_t)m*n*sizeof(double));
+    for(p=0;p<n;p++){
+        for(q=0;q<n;q++){
+            v[p*n+q] = (p == q);
+        }
+    }
+
+    //Rotate column pairs of U until they are all mutually orthogonal.
+    for(sweep=0;sweep<SVD_MAX_SWEEPS;sweep++){
+        int rotated = 0;
+        for(p=0;p<n-1;p++){
+            for(q=p+1;q<n;q++){
+                double alpha = 0.0, beta = 0.0, gamma = 0.0;
+                for(i=0;i<m;i++){
+                    alpha += u[i*n+p]*u[i*n+p];
+                    beta += u[i*n+q]*u[i*n+q];
+                    gamma += u[i*n+p]*u[i*n+q];
+                }
+                if(gamma == 0.0 || fabs(gamma) <= 1e-15*sqrt(alpha*beta)) continue;
+                rotated = 1;
+
+                double zeta = (beta - alpha)/(2.0*gamma);
+                double t = (zeta >= 0 ? 1.0 : -1.0)/(fabs(zeta) + sqrt(1.0 + zeta*zeta));
+                double c = 1.0/sqrt(1.0 + t*t);
+                double sn = c*t;
+                for(i=0;i<m;i++){
+                    double up = u[i*n+p], uq = u[i*n+q];
+                    u[i*n+p] = c*up - sn*uq;
+                    u[i*n+q] = sn*up + c*uq;
+                }
+                for(i=0;i<n;i++){
+                    double vp = v[i*n+p], vq = v[i*n+q];
+                    v[i*n+p] = c*vp - sn*vq;
+                    v[i*n+q] = sn*vp + c*vq;
+                }
+            }
+        }
+        if(!rotated) break;
+    }
+
+    //Column norms are the singular values; normalise to get U.
+    for(p=0;p<n;p++){
+        double norm = 0.0;
+        for(i=0;i<m;i++) norm += u[i*n+p]*u[i*n+p];
+        norm = sqrt(norm);
+        sigma[p] = norm;
+        if(norm > 0.0){
+            for(i=0;i<m;i++) u[i*n+p] /= norm;
+        }
+    }
+}
+
+//Factors a kernel into the fewest separable terms that reproduce it to within `tolerance`
+//(relative Frobenius norm). Fills `sep` and returns its rank.
+int analyse_kernel(const double *kernel, int k_x, int k_y, double tolerance, struct separable_kernel *sep){
+
+    int n = k_x;
+    double *u = malloc((size_t)k_y*n*sizeof(double));
+    double *v = malloc((size_t)n*n*sizeof(double));
+    double *sigma = malloc(n*sizeof(double));
+    int *order = malloc(n*sizeof(int));
+    int i,j,r;
+
+    kernel_svd(kernel,k_x,k_y,u,sigma,v);
+
+    //Sort singular values, largest first.
+    for(i=0;i<n;i++) order[i] = i;
+    for(i=1;i<n;i++){
+        int o = order[i];
+        for(j=i;j>0 && sigma[order[j-1]] < sigma[o];j--) order[j] = order[j-1];
+        order[j] = o;
+    }
+
+    //Smallest rank whose discarded tail stays inside the tolerance. The tail is summed from
+    //the smallest value up to avoid cancellation.
+    double total = 0.0, tail = 0.0;
+    for(i=0;i<n;i++) total += sigma[i]*sigma[i];
+    for(r=n;r>0;r--){
+        double s2 = sigma[order[r-1]]*sigma[order[r-1]];
+        if(tail + s2 > tolerance*tolerance*total) break;
+        tail += s2;
+    }
+
+    sep->rank = r;
+    sep->k_x = k_x;
+    sep->k_y = k_y;
+    sep->col = malloc((size_t)(r ? r : 1)*k_y*sizeof(double));
+    sep->row = malloc((size_t)(r ? r : 1)*k_x*sizeof(double));
+    for(i=0;i<r;i++){
+        int o = order[i];
+        for(j=0;j<k_y;j++) sep->col[i*k_y+j] = sigma[o]*u[j*n+o];
+        for(j=0;j<k_x;j++) sep->row[i*k_x+j] = v[j*n+o];
+    }
+
+    free(u);
+    free(v);
+    free(sigma);
+    free(order);
+    return r;
+}
+
+void free_separable_kernel(struct separable_kernel *sep){
+
+    free(sep->col);
+    free(sep->row);
+    sep->col = sep->row = NULL;
+}
+
+//Runs each separable term as a row pass followed by a column pass and sums the results.
+//Borders are resolved independently per axis, so this matches the 2D direct path exactly
+//(up to rounding) for every border mode.
+void convolve2d_image_separable(const double *image, int width, int height, const struct separable_kernel *sep,
+                                double *output, enum border_mode border, int threads){
+
+    size_t n = (size_t)width*height;
+    size_t i;
+    int r;
+
+    if(sep->rank == 0){
+        memset(output,0,n*sizeof(double));
+        return;
+    }
+
+    double *rowpass = malloc(n*sizeof(double));
+    double *term = sep->rank > 1 ? malloc(n*sizeof(double)) : NULL;
+
+    for(r=0;r<sep->rank;r++){
+        convolve2d_image_direct(image,width,height,sep->row+(size_t)r*sep->k_x,sep->k_x,1,rowpass,border,threads);
+        convolve2d_image_direct(rowpass,width,height,sep->col+(size_t)r*sep->k_y,1,sep->k_y,
+                                r == 0 ? output : term,border,threads);
+        if(r > 0){
+            for(i=0;i<n;i++) output[i] += term[i];
+        }
+    }
+
+    free(rowpass);
+    free(term);
+}
+
+//Frequency domain path. The transform is the radix-2 decimation-in-time FFT of
+//fft_1d_DIT_radix2 in maths/fft/computefft.c, done iteratively with bit-reversed input
+//ordering and a precomputed twiddle table so it can be reused for every row and tile.
+
+void init_fft_plan(struct fft_plan *plan, int n){
+
+    int bits = 0, i, j;
+
+    if(n < 2 || (n & (n-1))) errx(1,"FFT size must be a power of two!");
+    while((1 << bits) < n) bits++;
+
+    plan->n = n;
+    plan->bitreverse = malloc(n*sizeof(int));
+    plan->twiddle = malloc((n/2)*sizeof(double complex));
+    for(i=0;i<n;i++){
+        int r = 0;
+        for(j=0;j<bits;j++) r |= ((i >> j) & 1) << (bits-1-j);
+        plan->bitreverse[i] = r;
+    }
+    for(i=0;i<n/2;i++){
+        plan->twiddle[i] = cexp(I * -2.0 * M_PI * i/n);
+    }
+}
+
+void free_fft_plan(struct fft_plan *plan){
+
+    free(plan->bitreverse);
+    free(plan->twiddle);
+}
+
+//In-place 1D FFT. The inverse is unscaled.
+static void fft_1d(const struct fft_plan *plan, double complex *data, int inverse){
+
+    int n = plan->n;
+    int i,j,len;
+
+    for(i=0;i<n;i++){
+        int r = plan->bitreverse[i];
+        if(r > i){
+            double complex t = data[i];
+            data[i] = data[r];
+            data[r] = t;
+        }
+    }
+
+    for(len=2;len<=n;len<<=1){
+        int half = len/2, step = n/len;
+        for(i=0;i<n;i+=len){
+            for(j=0;j<half;j++){
+                double complex w = inverse ? conj(plan->twiddle[j*step]) : plan->twiddle[j*step];
+                double complex even = data[i+j];
+                double complex odd = w * data[i+j+half];
+                data[i+j] = even + odd;
+                data[i+j+half] = even - odd;
+            }
+        }
+    }
+}
+
+//In-place n x n 2D FFT, rows then columns. `column` is scratch of n elements.
+static void fft_2d(const struct fft_plan *plan, double complex *data, double complex *column, int inverse){
+
+    int n = plan->n;
+    int i,j;
+
+    for(j=0;j<n;j++){
+        fft_1d(plan,data+(size_t)j*n,inverse);
+    }
+    for(i=0;i<n;i++){
+        for(j=0;j<n;j++) column[j] = data[(size_t)j*n+i];
+        fft_1d(plan,column,inverse);
+        for(j=0;j<n;j++) data[(size_t)j*n+i] = column[j];
+    }
+}
+
+//Direct full 2D convolution of two kernels, out is (x1+x2-1) x (y1+y2-1).
+void compose_kernels_direct(const double *k1, int x1, int y1, const double *k2, int x2, int y2, double *out){
+
+    int ox = x1+x2-1, oy = y1+y2-1;
+    int i,j,ii,jj;
+    memset(out,0,(size_t)ox*oy*sizeof(double));
+    for(j=0;j<y1;j++){
+        for(i=0;i<x1;i++){
+            double a = k1[j*x1+i];
+            if(a == 0.0) continue;
+            for(jj=0;jj<y2;jj++){
+                for(ii=0;ii<x2;ii++){
+                    out[(j+jj)*ox+(i+ii)] += a*k2[jj*x2+ii];
+                }
+            }
+        }
+    }
+}
+
+static int nextpow2(int n){
+
+    int p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+//Full 2D convolution of two kernels through one packed forward transform and one inverse.
+void compose_kernels_fft(const double *k1, int x1, int y1, const double *k2, int x2, int y2, double *out){
+
+    int ox = x1+x2-1, oy = y1+y2-1;
+    int n = nextpow2(ox > oy ? ox : oy);
+    size_t nn = (size_t)n*n;
+    struct fft_plan plan;
+    int i,j;
+
+    init_fft_plan(&plan,n);
+    double complex *packed = calloc(nn,sizeof(double complex));
+    double complex *product = malloc(nn*sizeof(double complex));
+    double complex *column = malloc(n*sizeof(double complex));
+
+    //k1 in the real part, k2 in the imaginary part.
+    for(j=0;j<y1;j++) for(i=0;i<x1;i++) packed[(size_t)j*n+i] += k1[j*x1+i];
+    for(j=0;j<y2;j++) for(i=0;i<x2;i++) packed[(size_t)j*n+i] += I*k2[j*x2+i];
+    fft_2d(&plan,packed,column,0);
+
+    //Split the two real spectra using conjugate symmetry and multiply them.
+    for(j=0;j<n;j++){
+        for(i=0;i<n;i++){
+            double complex z = packed[(size_t)j*n+i];
+            double complex zc = conj(packed[(size_t)((n-j)%n)*n+(n-i)%n]);
+            double complex a = 0.5*(z + zc);
+            double complex b = -0.5*I*(z - zc);
+            product[(size_t)j*n+i] = a*b;
+        }
+    }
+    fft_2d(&plan,product,column,1);
+
+    for(j=0;j<oy;j++){
+        for(i=0;i<ox;i++){
+            out[j*ox+i] = creal(product[(size_t)j*n+i])/nn;
+        }
+    }
+
+    free(packed);
+    free(product);
+    free(column);
+    free_fft_plan(&plan);
+}
+
+//Composes two kernels, in the frequency domain when that is cheaper.
+void compose_kernels(const double *k1, int x1, int y1, const double *k2, int x2, int y2, double *out){
+
+    int ox = x1+x2-1, oy = y1+y2-1;
+    int n = nextpow2(ox > oy ? ox : oy);
+    double directcost = (double)x1*y1*x2*y2*COST_DIRECT_TAP;
+    double fftcost = 2.0*(double)n*n*log2((double)n*n)/2.0*COST_FFT_BUTTERFLY + (double)n*n*COST_FFT_POINT;
+
+    if(fftcost < directcost) compose_kernels_fft(k1,x1,y1,k2,x2,y2,out);
+    else compose_kernels_direct(k1,x1,y1,k2,x2,y2,out);
+}
+
+//Reads `len` pixels of image row `row` starting at column `x`, resolving the border.
+static void padsegment(const double *image, int width, int height, int row, int x, int len,
+                       enum border_mode border, double *dst){
+
+    int y = borderindex(row,height,border);
+    int i;
+
+    if(y < 0){
+        memset(dst,0,(size_t)len*sizeof(double));
+        return;
+    }
+    const double *src = image + (size_t)y*width;
+    if(x >= 0 && x + len <= width){
+        memcpy(dst,src+x,(size_t)len*sizeof(double));
+        return;
+    }
+    for(i=0;i<len;i++){
+        int xi = borderindex(x+i,width,border);
+        dst[i] = xi < 0 ? 0.0 : src[xi];
+    }
+}
+
+//Each thread takes pairs of output tiles. The first tile's input goes in the real part
+//and the second's in the imaginary part; the kernel is real, so the two results come back
+//separated the same way.
+void *fft_convolve_worker(void *threadArg){
+
+    struct fft_thread_data *inst = (struct fft_thread_data *) threadArg;
+    int n = inst->plan->n;
+    int width = inst->width, height = inst->height;
+    int block_x = n - inst->k_x + 1, block_y = n - inst->k_y + 1;
+    int tiles_x = (width + block_x - 1)/block_x;
+    int tiles_y = (height + block_y - 1)/block_y;
+    int ntiles = tiles_x*tiles_y;
+    //Offsets from an output pixel back to the first input it needs.
+    int back_x = inst->k_x - 1 - (inst->k_x-1)/2, back_y = inst->k_y - 1 - (inst->k_y-1)/2;
+    size_t nn = (size_t)n*n;
+    int pair,half,r,c;
+
+    double complex *buffer = malloc(nn*sizeof(double complex));
+    double complex *column = malloc(n*sizeof(double complex));
+    double *row = malloc(n*sizeof(double));
+
+    for(pair=inst->thread_index;2*pair<ntiles;pair+=inst->threads){
+        for(r=0;r<n;r++){
+            for(c=0;c<n;c++) buffer[(size_t)r*n+c] = 0.0;
+        }
+        for(half=0;half<2 && 2*pair+half<ntiles;half++){
+            int t = 2*pair+half;
+            int x0 = (t%tiles_x)*block_x, y0 = (t/tiles_x)*block_y;
+            double complex scale = half ? I : 1.0;
+            for(r=0;r<n;r++){
+                padsegment(inst->image,width,height,y0-back_y+r,x0-back_x,n,inst->border,row);
+                for(c=0;c<n;c++) buffer[(size_t)r*n+c] += scale*row[c];
+            }
+        }
+
+        fft_2d(inst->plan,buffer,column,0);
+        for(r=0;r<(int)nn;r++) buffer[r] *= inst->spectrum[r];
+        fft_2d(inst->plan,buffer,column,1);
+
+        //The last block_y x block_x points are free of circular wrap-around.
+        for(half=0;half<2 && 2*pair+half<ntiles;half++){
+            int t = 2*pair+half;
+            int x0 = (t%tiles_x)*block_x, y0 = (t/tiles_x)*block_y;
+            int rows = height - y0 < block_y ? height - y0 : block_y;
+            int cols = width - x0 < block_x ? width - x0 : block_x;
+            for(r=0;r<rows;r++){
+                const double complex *src = buffer + (size_t)(r + inst->k_y - 1)*n + inst->k_x - 1;
+                double *dst = inst->output + (size_t)(y0+r)*width + x0;
+                for(c=0;c<cols;c++) dst[c] = half ? cimag(src[c]) : creal(src[c]);
+            }
+        }
+    }
+
+    free(buffer);
+    free(column);
+    free(row);
+    return NULL;
+}
+
+//Convolves an image using n x n FFT tiles. n must be a power of two larger than the kernel.
+void convolve2d_image_fft(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                          double *output, enum border_mode border, int threads, int n){
+
+    if(n <= k_x || n <= k_y) errx(1,"FFT tile must be larger than the kernel!");
+    if(threads < 1) threads = 1;
+
+    struct fft_plan plan;
+    size_t nn = (size_t)n*n;
+    int i,j;
+
+    init_fft_plan(&plan,n);
+    double complex *spectrum = calloc(nn,sizeof(double complex));
+    double complex *column = malloc(n*sizeof(double complex));
+    for(j=0;j<k_y;j++){
+        for(i=0;i<k_x;i++){
+            spectrum[(size_t)j*n+i] = kernel[j*k_x+i]/(double)nn; //Fold in the inverse scaling.
+        }
+    }
+    fft_2d(&plan,spectrum,column,0);
+    free(column);
+
+    struct fft_thread_data *thread_desc = malloc(threads*sizeof(struct fft_thread_data));
+    for(i=0;i<threads;i++){
+        thread_desc[i].image = image;
+        thread_desc[i].output = output;
+        thread_desc[i].spectrum = spectrum;
+        thread_desc[i].plan = &plan;
+        thread_desc[i].width = width;
+        thread_desc[i].height = height;
+        thread_desc[i].k_x = k_x;
+        thread_desc[i].k_y = k_y;
+        thread_desc[i].border = border;
+        thread_desc[i].thread_index = i;
+        thread_desc[i].threads = threads;
+        if(pthread_create(&thread_desc[i].thread_id, NULL, fft_convolve_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+
+    free(thread_desc);
+    free(spectrum);
+    free_fft_plan(&plan);
+}
+
+//Estimated cost per output pixel of the FFT path with the best tile size, which is
+//returned through `bestn`. Includes the work wasted on partial tiles at the image edge.
+double fft_cost_per_pixel(int width, int height, int k_x, int k_y, int *bestn){
+
+    double best = INFINITY;
+    int n;
+
+    *bestn = 0;
+    for(n=FFT_MIN_SIZE;n<=FFT_MAX_SIZE;n<<=1){
+        int block_x = n - k_x + 1, block_y = n - k_y + 1;
+        if(block_x < 1 || block_y < 1) continue;
+        double tiles = (double)((width + block_x - 1)/block_x) * ((height + block_y - 1)/block_y);
+        double nn = (double)n*n;
+        //Two transforms of nn/2*log2(nn) butterflies, shared by two packed tiles.
+        double tilecost = (nn*log2(nn)*COST_FFT_BUTTERFLY + nn*COST_FFT_POINT)/2.0;
+        double cost = tiles*tilecost/((double)width*height);
+        if(cost < best){
+            best = cost;
+            *bestn = n;
+        }
+    }
+    return best;
+}
+
+//Picks the cheapest of the direct, separable and FFT paths for a kernel whose separable
+//factors are already known.
+static void convolve2d_image_planned(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                                     const struct separable_kernel *sep, double *output, enum border_mode border, int threads){
+
+    int fftsize;
+    double directcost = (double)k_x*k_y*COST_DIRECT_TAP + COST_PASS;
+    double fftcost = fft_cost_per_pixel(width,height,k_x,k_y,&fftsize);
+
+    if(sep != NULL){
+        double separablecost = sep->rank*((k_x + k_y)*COST_DIRECT_TAP + 2*COST_PASS);
+        if(separablecost < directcost && separablecost <= fftcost){
+            convolve2d_image_separable(image,width,height,sep,output,border,threads);
+            return;
+        }
+    }
+    if(fftcost < directcost){
+        convolve2d_image_fft(image,width,height,kernel,k_x,k_y,output,border,threads,fftsize);
+        return;
+    }
+    convolve2d_image_direct(image,width,height,kernel,k_x,k_y,output,border,threads);
+}
+
+//Convolves an image with a kernel using whichever of the direct, separable and FFT paths
+//the cost model expects to be cheapest.
+void convolve2d_image(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                      double *output, enum border_mode border, int threads){
+
+    struct separable_kernel sep;
+
+    if(k_x > 1 && k_y > 1){
+        analyse_kernel(kernel,k_x,k_y,SEPARABLE_TOLERANCE,&sep);
+        convolve2d_image_planned(image,width,height,kernel,k_x,k_y,&sep,output,border,threads);
+        free_separable_kernel(&sep);
+        return;
+    }
+    convolve2d_image_planned(image,width,height,kernel,k_x,k_y,NULL,output,border,threads);
+}
+
+//FNV-1a over the kernel sizes and raw kernel bytes.
+static uint64_t hashchain(int nkernels, const double **kernels, const int *k_x, const int *k_y){
+
+    uint64_t h = 14695981039346656037ULL;
+    int k;
+    size_t i;
+
+#define FNV_MIX(ptr, len) \
+    for(i=0;i<(len);i++){ h ^= ((const unsigned char *)(ptr))[i]; h *= 1099511628211ULL; }
+
+    FNV_MIX(&nkernels,sizeof(int));
+    for(k=0;k<nkernels;k++){
+        FNV_MIX(&k_x[k],sizeof(int));
+        FNV_MIX(&k_y[k],sizeof(int));
+        FNV_MIX(kernels[k],(size_t)k_x[k]*k_y[k]*sizeof(double));
+    }
+#undef FNV_MIX
+    return h;
+}
+
+static int chainmatches(const struct filter_chain *chain, uint64_t hash, int nkernels,
+                        const double **kernels, const int *k_x, const int *k_y){
+
+    const double *stored = chain->kernels;
+    int k;
+
+    if(chain->hash != hash || chain->nkernels != nkernels) return 0;
+    for(k=0;k<nkernels;k++){
+        size_t n = (size_t)k_x[k]*k_y[k];
+        if(chain->sizes[2*k] != k_x[k] || chain->sizes[2*k+1] != k_y[k]) return 0;
+        if(memcmp(stored,kernels[k],n*sizeof(double))) return 0;
+        stored += n;
+    }
+    return 1;
+}
+
+void init_chain_cache(struct chain_cache *cache, int capacity){
+
+    memset(cache,0,sizeof(*cache));
+    pthread_mutex_init(&cache->lock,NULL);
+    cache->capacity = capacity < 1 ? 1 : capacity;
+}
+
+static void lruunlink(struct chain_cache *cache, struct filter_chain *chain){
+
+    if(chain->lruprev) chain->lruprev->lrunext = chain->lrunext;
+    else cache->lruhead = chain->lrunext;
+    if(chain->lrunext) chain->lrunext->lruprev = chain->lruprev;
+    else cache->lrutail = chain->lruprev;
+    chain->lrunext = chain->lruprev = NULL;
+}
+
+static void lrupush(struct chain_cache *cache, struct filter_chain *chain){
+
+    chain->lruprev = NULL;
+    chain->lrunext = cache->lruhead;
+    if(cache->lruhead) cache->lruhead->lruprev = chain;
+    cache->lruhead = chain;
+    if(cache->lrutail == NULL) cache->lrutail = chain;
+}
+
+static void freechain(struct filter_chain *chain){
+
+    free(chain->sizes);
+    free(chain->kernels);
+    free(chain->composite);
+    free_separable_kernel(&chain->sep);
+    free(chain);
+}
+
+//Drops least recently used chains nobody is holding until the cache fits its capacity.
+static void evictchains(struct chain_cache *cache){
+
+    struct filter_chain *victim = cache->lrutail;
+
+    while(cache->count > cache->capacity && victim != NULL){
+        struct filter_chain *prev = victim->lruprev;
+        if(victim->refs == 0){
+            struct filter_chain **link = &cache->buckets[victim->hash % CHAIN_CACHE_BUCKETS];
+            while(*link != victim) link = &(*link)->bucketnext;
+            *link = victim->bucketnext;
+            lruunlink(cache,victim);
+            freechain(victim);
+            cache->count--;
+        }
+        victim = prev;
+    }
+}
+
+//Composes and analyses a chain. Runs without the cache lock held.
+static struct filter_chain *buildchain(uint64_t hash, int nkernels, const double **kernels, const int *k_x, const int *k_y){
+
+    struct filter_chain *chain = calloc(1,sizeof(struct filter_chain));
+    size_t total = 0;
+    int k;
+
+    chain->hash = hash;
+    chain->nkernels = nkernels;
+    chain->sizes = malloc(2*nkernels*sizeof(int));
+    for(k=0;k<nkernels;k++) total += (size_t)k_x[k]*k_y[k];
+    chain->kernels = malloc(total*sizeof(double));
+    total = 0;
+    for(k=0;k<nkernels;k++){
+        size_t n = (size_t)k_x[k]*k_y[k];
+        chain->sizes[2*k] = k_x[k];
+        chain->sizes[2*k+1] = k_y[k];
+        memcpy(chain->kernels+total,kernels[k],n*sizeof(double));
+        total += n;
+    }
+
+    //Fold the kernels in one at a time.
+    chain->k_x = k_x[0];
+    chain->k_y = k_y[0];
+    chain->composite = malloc((size_t)k_x[0]*k_y[0]*sizeof(double));
+    memcpy(chain->composite,kernels[0],(size_t)k_x[0]*k_y[0]*sizeof(double));
+    for(k=1;k<nkernels;k++){
+        int ox = chain->k_x + k_x[k] - 1, oy = chain->k_y + k_y[k] - 1;
+        double *next = malloc((size_t)ox*oy*sizeof(double));
+        compose_kernels(chain->composite,chain->k_x,chain->k_y,kernels[k],k_x[k],k_y[k],next);
+        free(chain->composite);
+        chain->composite = next;
+        chain->k_x = ox;
+        chain->k_y = oy;
+    }
+
+    analyse_kernel(chain->composite,chain->k_x,chain->k_y,SEPARABLE_TOLERANCE,&chain->sep);
+    return chain;
+}
+
+//Returns the composed chain for kernels[0] followed by kernels[1] ... kernels[nkernels-1],
+//building it on a miss. The caller holds a reference until release_filter_chain().
+struct filter_chain *get_filter_chain(struct chain_cache *cache, int nkernels, const double **kernels,
+                                      const int *k_x, const int *k_y){
+
+    if(nkernels < 1) errx(1,"A filter chain needs at least one kernel!");
+
+    uint64_t hash = hashchain(nkernels,kernels,k_x,k_y);
+    struct filter_chain *chain;
+
+    pthread_mutex_lock(&cache->lock);
+    for(chain=cache->buckets[hash % CHAIN_CACHE_BUCKETS];chain!=NULL;chain=chain->bucketnext){
+        if(chainmatches(chain,hash,nkernels,kernels,k_x,k_y)) break;
+    }
+    if(chain != NULL){
+        cache->hits++;
+        chain->refs++;
+        lruunlink(cache,chain);
+        lrupush(cache,chain);
+        pthread_mutex_unlock(&cache->lock);
+        return chain;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    struct filter_chain *built = buildchain(hash,nkernels,kernels,k_x,k_y);
+
+    //Another thread may have built the same chain meanwhile; keep whichever got in first.
+    pthread_mutex_lock(&cache->lock);
+    for(chain=cache->buckets[hash % CHAIN_CACHE_BUCKETS];chain!=NULL;chain=chain->bucketnext){
+        if(chainmatches(chain,hash,nkernels,kernels,k_x,k_y)) break;
+    }
+    if(chain != NULL){
+        freechain(built);
+        lruunlink(cache,chain);
+    }
+    else {
+        chain = built;
+        chain->bucketnext = cache->buckets[hash % CHAIN_CACHE_BUCKETS];
+        cache->buckets[hash % CHAIN_CACHE_BUCKETS] = chain;
+        cache->count++;
+    }
+    chain->refs++;
+    lrupush(cache,chain);
+    evictchains(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return chain;
+}
+
+void release_filter_chain(struct chain_cache *cache, struct filter_chain *chain){
+
+    pthread_mutex_lock(&cache->lock);
+    chain->refs--;
+    evictchains(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void free_chain_cache(struct chain_cache *cache){
+
+    struct filter_chain *chain = cache->lruhead;
+    while(chain != NULL){
+        struct filter_chain *next = chain->lrunext;
+        freechain(chain);
+        chain = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+}
+
+//Applies a whole filter chain in one convolution. Away from the image edges this equals
+//applying each kernel in turn; at the edges the border is resolved once for the composite
+//rather than once per kernel.
+void convolve2d_image_chain(const double *image, int width, int height, const struct filter_chain *chain,
+                            double *output, enum border_mode border, int threads){
+
+    const struct separable_kernel *sep = (chain->k_x > 1 && chain->k_y > 1) ? &chain->sep : NULL;
+    convolve2d_image_planned(image,width,height,chain->composite,chain->k_x,chain->k_y,sep,output,border,threads);
+}
+
+//Straightforward per-pixel convolution used to check convolve2d_image.
+void convolve2d_image_reference(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                                double *output, enum border_mode border){
+
+    int left = (k_x-1)/2, top = (k_y-1)/2;
+    int x,y,i,j;
+    for(y=0;y<height;y++){
+        for(x=0;x<width;x++){
+            double acc = 0.0;
+            for(j=0;j<k_y;j++){
+                int yi = borderindex(y+top-j,height,border);
+                if(yi < 0) continue;
+                for(i=0;i<k_x;i++){
+                    int xi = borderindex(x+left-i,width,border);
+                    if(xi < 0) continue;
+                    acc += kernel[j*k_x+i] * image[(size_t)yi*width+xi];
+                }
+            }
+            output[(size_t)y*width+x] = acc;
+        }
+    }
+}
+
+static void initimage(double *image, int width, int height){
+
+    size_t i;
+    for(i=0;i<(size_t)width*height;i++){
+        image[i] = rand()%256;
+    }
+}
+
+static void initrandomkernel(double *kernel, int k_x, int k_y){
+
+    int i;
+    for(i=0;i<k_x*k_y;i++){
+        kernel[i] = (double)rand()/RAND_MAX - 0.5;
+    }
+}
+
+static double maxabsdiff(const double *a, const double *b, size_t n){
+
+    double m = 0.0;
+    size_t i;
+    for(i=0;i<n;i++){
+        double d = fabs(a[i]-b[i]);
+        if(d > m) m = d;
+    }
+    return m;
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+int main(int argc, char *argv[]){
+
+    int threads = argc > 1 ? strtol(argv[1],NULL,10) : 1;
+    int width = argc > 3 ? strtol(argv[2],NULL,10) : 3840; //4K frame by default.
+    int height = argc > 3 ? strtol(argv[3],NULL,10) : 2160;
+    const char *bordernames[] = {"zero","clamp","reflect"};
+    int ksizes[] = {3,5,7,15};
+    int b,k,i,j;
+
+    //The composite kernel from convolve2d_kernels.c: 15x15 box * 15x15 box * 7x7 box.
+    double *box15 = malloc(15*15*sizeof(double));
+    double *box7 = malloc(7*7*sizeof(double));
+    double *box29 = malloc(29*29*sizeof(double));
+    double *composite = malloc(35*35*sizeof(double));
+    for(i=0;i<15*15;i++) box15[i] = 1.0/(15*15);
+    for(i=0;i<7*7;i++) box7[i] = 1.0/(7*7);
+    compose_kernels(box15,15,15,box15,15,15,box29);
+    compose_kernels(box29,29,29,box7,7,7,composite);
+
+    //A rank two kernel: Gaussian plus a horizontal derivative of a Gaussian.
+    double lowrank[9*7];
+    for(j=0;j<7;j++){
+        for(i=0;i<9;i++){
+            double gx = exp(-(i-4)*(i-4)/8.0), gy = exp(-(j-3)*(j-3)/4.0);
+            lowrank[j*9+i] = gx*gy + 0.5*(i-4)*gx*exp(-(j-3)*(j-3)/2.0);
+        }
+    }
+
+    struct separable_kernel sep;
+    printf("Composite 35x35 kernel rank: %d\n",analyse_kernel(composite,35,35,SEPARABLE_TOLERANCE,&sep));
+    free_separable_kernel(&sep);
+    printf("Gaussian + derivative 9x7 kernel rank: %d\n",analyse_kernel(lowrank,9,7,SEPARABLE_TOLERANCE,&sep));
+    free_separable_kernel(&sep);
+
+    //Correctness against the per-pixel reference on a small, awkwardly sized image.
+    int sw = 97, sh = 61;
+    double *small = malloc((size_t)sw*sh*sizeof(double));
+    double *smallout = malloc((size_t)sw*sh*sizeof(double));
+    double *smallref = malloc((size_t)sw*sh*sizeof(double));
+    double *kernel = malloc(35*35*sizeof(double));
+    initimage(small,sw,sh);
+    for(b=BORDER_ZERO;b<=BORDER_REFLECT;b++){
+        for(k=0;k<4;k++){
+            initrandomkernel(kernel,ksizes[k],ksizes[k]-(k>0));
+            convolve2d_image(small,sw,sh,kernel,ksizes[k],ksizes[k]-(k>0),smallout,b,threads);
+            convolve2d_image_reference(small,sw,sh,kernel,ksizes[k],ksizes[k]-(k>0),smallref,b);
+            double e = maxabsdiff(smallout,smallref,(size_t)sw*sh);
+            if(e > 1e-9) errx(1,"%s border, %dx%d kernel: error %g",bordernames[b],ksizes[k],ksizes[k]-(k>0),e);
+        }
+        convolve2d_image(small,sw,sh,composite,35,35,smallout,b,threads);
+        convolve2d_image_reference(small,sw,sh,composite,35,35,smallref,b);
+        if(maxabsdiff(smallout,smallref,(size_t)sw*sh) > 1e-9) errx(1,"%s border, separable composite kernel mismatch",bordernames[b]);
+        convolve2d_image(small,sw,sh,lowrank,9,7,smallout,b,threads);
+        convolve2d_image_reference(small,sw,sh,lowrank,9,7,smallref,b);
+        if(maxabsdiff(smallout,smallref,(size_t)sw*sh) > 1e-9) errx(1,"%s border, rank two kernel mismatch",bordernames[b]);
+        for(k=2;k<4;k++){
+            initrandomkernel(kernel,ksizes[k],ksizes[k]+1);
+            convolve2d_image_fft(small,sw,sh,kernel,ksizes[k],ksizes[k]+1,smallout,b,threads,32);
+            convolve2d_image_reference(small,sw,sh,kernel,ksizes[k],ksizes[k]+1,smallref,b);
+            if(maxabsdiff(smallout,smallref,(size_t)sw*sh) > 1e-9) errx(1,"%s border, %dx%d kernel: FFT mismatch",bordernames[b],ksizes[k],ksizes[k]+1);
+        }
+    }
+    printf("All border modes match the reference.\n");
+
+    //Kernel composition in the frequency domain.
+    double *kernel2 = malloc(35*35*sizeof(double));
+    double *composed = malloc(69*69*sizeof(double));
+    double *composedfft = malloc(69*69*sizeof(double));
+    initrandomkernel(kernel,35,29);
+    initrandomkernel(kernel2,33,35);
+    compose_kernels_direct(kernel,35,29,kernel2,33,35,composed);
+    compose_kernels_fft(kernel,35,29,kernel2,33,35,composedfft);
+    if(maxabsdiff(composed,composedfft,67*63) > 1e-9) errx(1,"FFT kernel composition mismatch");
+    printf("FFT kernel composition matches direct.\n\n");
+
+    //Throughput on a full frame.
+    double *image = malloc((size_t)width*height*sizeof(double));
+    double *output = malloc((size_t)width*height*sizeof(double));
+    initimage(image,width,height);
+    memset(output,0,(size_t)width*height*sizeof(double));
+    printf("%dx%d image, %d threads\n",width,height,threads);
+    for(k=0;k<4;k++){
+        initrandomkernel(kernel,ksizes[k],ksizes[k]);
+        double t0 = seconds();
+        convolve2d_image(image,width,height,kernel,ksizes[k],ksizes[k],output,BORDER_REFLECT,threads);
+        double t1 = seconds();
+        printf("%2dx%-2d kernel: %f s (%.1f Mpixel/s)\n",ksizes[k],ksizes[k],t1-t0,width*(double)height/(t1-t0)/1e6);
+    }
+
+    double t0 = seconds();
+    convolve2d_image_direct(image,width,height,composite,35,35,output,BORDER_REFLECT,threads);
+    double t1 = seconds();
+    convolve2d_image(image,width,height,composite,35,35,output,BORDER_REFLECT,threads);
+    double t2 = seconds();
+    printf("35x35 composite kernel: direct %f s, separable %f s\n",t1-t0,t2-t1);
+
+    int fftsize;
+    initrandomkernel(kernel,35,35);
+    double fftcost = fft_cost_per_pixel(width,height,35,35,&fftsize);
+    t0 = seconds();
+    convolve2d_image_direct(image,width,height,kernel,35,35,output,BORDER_REFLECT,threads);
+    t1 = seconds();
+    convolve2d_image_fft(image,width,height,kernel,35,35,output,BORDER_REFLECT,threads,fftsize);
+    t2 = seconds();
+    printf("35x35 random kernel: direct %f s, FFT (%dx%d tiles) %f s, modelled cost %.0f vs %.0f\n",
+           t1-t0,fftsize,fftsize,t2-t1,35.0*35*COST_DIRECT_TAP+COST_PASS,fftcost);
+
+    //Filter chain: the same box sequence, composed once and then served from the cache.
+    struct chain_cache cache;
+    init_chain_cache(&cache,4);
+    const double *sequence[] = {box15,box15,box7};
+    int seq_x[] = {15,15,7}, seq_y[] = {15,15,7};
+    t0 = seconds();
+    struct filter_chain *chain = get_filter_chain(&cache,3,sequence,seq_x,seq_y);
+    t1 = seconds();
+    release_filter_chain(&cache,chain);
+    chain = get_filter_chain(&cache,3,sequence,seq_x,seq_y);
+    t2 = seconds();
+    printf("Filter chain setup: first %f s, cached %f s (%dx%d composite, rank %d)\n",
+           t1-t0,t2-t1,chain->k_x,chain->k_y,chain->sep.rank);
+    if(maxabsdiff(chain->composite,composite,35*35) > 1e-12) errx(1,"Chain composite mismatch");
+
+    //Away from the edges the chain equals applying each kernel in turn.
+    double *step = malloc((size_t)sw*sh*sizeof(double));
+    convolve2d_image(small,sw,sh,box15,15,15,smallref,BORDER_ZERO,threads);
+    convolve2d_image(smallref,sw,sh,box15,15,15,step,BORDER_ZERO,threads);
+    convolve2d_image(step,sw,sh,box7,7,7,smallref,BORDER_ZERO,threads);
+    convolve2d_image_chain(small,sw,sh,chain,smallout,BORDER_ZERO,threads);
+    for(j=17;j<sh-17;j++){
+        for(i=17;i<sw-17;i++){
+            if(fabs(smallout[j*sw+i]-smallref[j*sw+i]) > 1e-9) errx(1,"Chain differs from sequential filtering");
+        }
+    }
+    release_filter_chain(&cache,chain);
+
+    //Churn through more chains than the cache holds.
+    for(k=0;k<8;k++){
+        int churn_x[] = {3+2*(k%4),5}, churn_y[] = {3,5};
+        const double *churn[] = {kernel,box15};
+        chain = get_filter_chain(&cache,2,churn,churn_x,churn_y);
+        release_filter_chain(&cache,chain);
+    }
+    printf("Chain cache: %ld hits, %ld misses, %d resident\n",cache.hits,cache.misses,cache.count);
+    free_chain_cache(&cache);
+    free(step);
+
+    free(box15);
+    free(box7);
+    free(box29);
+    free(composite);
+    free(kernel2);
+    free(composed);
+    free(composedfft);
+    free(small);
+    free(smallout);
+    free(smallref);
+    free(kernel);
+    free(image);
+    free(output);
+
+    return 0;
+}
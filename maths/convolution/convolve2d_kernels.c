@@ -51,8 +51,10 @@ void convolve2d_kernels(double *kernel1, double *kernel2, double *output_kernel,
         }
     }
 
+#ifdef VERBOSE
     printf("Intermediate Kernel: \n");
     printkernel(intermediate_kernel,intk_x,intk_y);
+#endif
 
     int ii,jj;
     for(j=0;j<d_out_y;j++){
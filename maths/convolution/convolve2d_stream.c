@@ -0,0 +1,442 @@
+/* Streaming 2D convolution for images too large to hold in memory.
+ *
+ * Input rows are pulled one at a time from a reader callback and kept in a ring of
+ * kernel_y + 1 line buffers, each already extended horizontally by the border. As soon
+ * as the last input row an output row depends on has arrived, that output row is computed
+ * and handed to a writer callback. Memory use is O(width x kernel_y) whatever the image
+ * height, and the image height does not need to be known in advance: the bottom border is
+ * resolved once the reader reports the end of the image.
+ *
+ * Results match convolve2d_image.c (same kernel centring and border modes). Readers are
+ * provided for synthetic images and for raw array files (the RAWARR1 format of
+ * arrays/reduce_mapped), which are memory mapped and read sequentially. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <err.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RAW_MAGIC "RAWARR1"
+
+enum border_mode { BORDER_ZERO, BORDER_CLAMP, BORDER_REFLECT };
+
+//Fills `row` (width values) with the next image row. Returns 0 once the image is exhausted.
+typedef int (*row_reader)(void *ctx, double *row);
+//Receives output row `y` (width values). The row buffer is reused after returning.
+typedef void (*row_writer)(void *ctx, int y, const double *row);
+
+//Ring of horizontally padded input rows plus the state to stream through an image.
+struct stream_conv {
+    int width;
+    int k_x;
+    int k_y;
+    enum border_mode border;
+    double *kernel; //Flipped, so the row loop is a straight correlation.
+    int ring; //Number of line buffers.
+    double *lines; //ring x (width + k_x - 1)
+    double *rawrow;
+    double *outrow;
+};
+
+struct rawheader {
+    char magic[8];
+    int32_t dtype;
+    int32_t reserved;
+    int64_t rows;
+    int64_t cols;
+};
+
+//Maps a coordinate outside [0,size) back into the image. Returns -1 for BORDER_ZERO.
+static inline int borderindex(int i, int size, enum border_mode border){
+
+    if(i >= 0 && i < size) return i;
+    switch(border){
+    case BORDER_ZERO:
+        return -1;
+    case BORDER_CLAMP:
+        return i < 0 ? 0 : size-1;
+    case BORDER_REFLECT:
+        if(size == 1) return 0;
+        while(i < 0 || i >= size){
+            if(i < 0) i = -i;
+            if(i >= size) i = 2*(size-1) - i;
+        }
+        return i;
+    }
+    return -1;
+}
+
+void init_stream_conv(struct stream_conv *sc, int width, const double *kernel, int k_x, int k_y, enum border_mode border){
+
+    int i,j;
+
+    if(width < 1 || k_x < 1 || k_y < 1) errx(1,"Bad image or kernel dimensions!");
+    sc->width = width;
+    sc->k_x = k_x;
+    sc->k_y = k_y;
+    sc->border = border;
+    //One spare line: with even kernels reflection reaches one row beyond the kernel.
+    sc->ring = k_y + 1;
+    sc->kernel = malloc((size_t)k_x*k_y*sizeof(double));
+    sc->lines = malloc((size_t)sc->ring*(width + k_x - 1)*sizeof(double));
+    sc->rawrow = malloc((size_t)width*sizeof(double));
+    sc->outrow = malloc((size_t)width*sizeof(double));
+    for(j=0;j<k_y;j++){
+        for(i=0;i<k_x;i++){
+            sc->kernel[j*k_x+i] = kernel[(k_y-1-j)*k_x+(k_x-1-i)];
+        }
+    }
+}
+
+void free_stream_conv(struct stream_conv *sc){
+
+    free(sc->kernel);
+    free(sc->lines);
+    free(sc->rawrow);
+    free(sc->outrow);
+}
+
+//Bytes held by the streamer, independent of image height.
+size_t stream_conv_footprint(const struct stream_conv *sc){
+
+    return ((size_t)sc->ring*(sc->width + sc->k_x - 1) + 2*(size_t)sc->width + (size_t)sc->k_x*sc->k_y)*sizeof(double);
+}
+
+//Copies a raw row into line buffer slot, resolving the left and right borders.
+static void storeline(struct stream_conv *sc, int row){
+
+    int left = sc->k_x/2, right = sc->k_x - 1 - left;
+    int pw = sc->width + sc->k_x - 1;
+    double *dst = sc->lines + (size_t)(row % sc->ring)*pw;
+    int x;
+
+    for(x=-left;x<0;x++){
+        int xi = borderindex(x,sc->width,sc->border);
+        dst[x+left] = xi < 0 ? 0.0 : sc->rawrow[xi];
+    }
+    memcpy(dst+left,sc->rawrow,(size_t)sc->width*sizeof(double));
+    for(x=sc->width;x<sc->width+right;x++){
+        int xi = borderindex(x,sc->width,sc->border);
+        dst[x+left] = xi < 0 ? 0.0 : sc->rawrow[xi];
+    }
+}
+
+//Computes output row y. `height` is INT_MAX until the end of the image has been seen,
+//which is safe because rows past the ones read are only needed after that.
+static void emitrow(struct stream_conv *sc, int y, int height, row_writer write, void *wctx){
+
+    int pw = sc->width + sc->k_x - 1;
+    int top = sc->k_y/2;
+    int ky,kx,x;
+    double *restrict acc = sc->outrow;
+
+    memset(acc,0,(size_t)sc->width*sizeof(double));
+    for(ky=0;ky<sc->k_y;ky++){
+        int r = borderindex(y - top + ky,height,sc->border);
+        if(r < 0) continue;
+        const double *restrict src = sc->lines + (size_t)(r % sc->ring)*pw;
+        for(kx=0;kx<sc->k_x;kx++){
+            double w = sc->kernel[ky*sc->k_x+kx];
+            if(w == 0.0) continue;
+            const double *restrict s = src + kx;
+            for(x=0;x<sc->width;x++){
+                acc[x] += w * s[x];
+            }
+        }
+    }
+    write(wctx,y,acc);
+}
+
+//Streams a whole image through the convolution. Returns the number of rows processed.
+int stream_convolve(struct stream_conv *sc, row_reader read, void *rctx, row_writer write, void *wctx){
+
+    //Rows below an output row that it depends on. Reflecting the top border reaches down
+    //k_y/2 rows, one more than the kernel itself does for even heights.
+    int lookahead = sc->k_y/2;
+    if(sc->border != BORDER_REFLECT) lookahead = sc->k_y - 1 - sc->k_y/2;
+    int rows = 0, next = 0;
+
+    while(read(rctx,sc->rawrow)){
+        storeline(sc,rows);
+        rows++;
+        //Output row `next` is complete once row next + lookahead has arrived.
+        while(next + lookahead < rows){
+            emitrow(sc,next,INT_MAX,write,wctx);
+            next++;
+        }
+    }
+    //The image has ended: flush the remaining rows with the bottom border.
+    while(next < rows){
+        emitrow(sc,next,rows,write,wctx);
+        next++;
+    }
+    return rows;
+}
+
+//Synthetic image generated row by row, so arbitrarily tall images cost no storage.
+struct synthetic_reader {
+    int width;
+    int height;
+    int row;
+};
+
+int read_synthetic(void *ctx, double *row){
+
+    struct synthetic_reader *r = ctx;
+    int x;
+    if(r->row >= r->height) return 0;
+    for(x=0;x<r->width;x++){
+        row[x] = (double)((x*7 + r->row*13 + (x*r->row)%31) % 256);
+    }
+    r->row++;
+    return 1;
+}
+
+//Memory-mapped RAWARR1 float64 file, read front to back. Pages behind the read position
+//are dropped so resident memory stays small.
+struct raw_reader {
+    int fd;
+    struct rawheader *header;
+    size_t length;
+    const double *data;
+    int64_t row;
+    size_t pagesize;
+    uintptr_t dropped; //Rows before this page boundary have been released.
+};
+
+void open_raw_reader(struct raw_reader *r, const char *path){
+
+    struct stat st;
+    r->fd = open(path,O_RDONLY);
+    if(r->fd < 0) err(1,"%s",path);
+    if(fstat(r->fd,&st)) err(1,"%s",path);
+    if((size_t)st.st_size < sizeof(struct rawheader)) errx(1,"%s: too short for a header",path);
+    r->length = st.st_size;
+    r->header = mmap(NULL,r->length,PROT_READ,MAP_SHARED,r->fd,0);
+    if(r->header == MAP_FAILED) err(1,"mmap %s",path);
+    if(memcmp(r->header->magic,RAW_MAGIC,sizeof(RAW_MAGIC)) || r->header->dtype != 2)
+        errx(1,"%s: not a float64 raw array",path);
+    if(r->length < sizeof(struct rawheader) + (size_t)(r->header->rows*r->header->cols)*sizeof(double))
+        errx(1,"%s: truncated data",path);
+    r->data = (const double *)(r->header + 1);
+    r->row = 0;
+    r->pagesize = sysconf(_SC_PAGESIZE);
+    //Start after the page holding the header, which is read on every row.
+    r->dropped = ((uintptr_t)r->data + r->pagesize-1) & ~(uintptr_t)(r->pagesize-1);
+    madvise(r->header,r->length,MADV_SEQUENTIAL);
+}
+
+int read_raw(void *ctx, double *row){
+
+    struct raw_reader *r = ctx;
+    if(r->row >= r->header->rows) return 0;
+    const double *src = r->data + (size_t)r->row*r->header->cols;
+    memcpy(row,src,(size_t)r->header->cols*sizeof(double));
+    r->row++;
+    //Every 64 rows, drop the whole pages consumed since the last drop.
+    uintptr_t end = (uintptr_t)src & ~(uintptr_t)(r->pagesize-1);
+    if(r->row % 64 == 0 && end > r->dropped){
+        madvise((void *)r->dropped,end - r->dropped,MADV_DONTNEED);
+        r->dropped = end;
+    }
+    return 1;
+}
+
+void close_raw_reader(struct raw_reader *r){
+
+    munmap(r->header,r->length);
+    close(r->fd);
+}
+
+//Appends rows to a RAWARR1 float64 file with stdio.
+struct raw_writer {
+    FILE *file;
+    struct rawheader header;
+};
+
+void open_raw_writer(struct raw_writer *w, const char *path, int64_t cols){
+
+    w->file = fopen(path,"wb");
+    if(w->file == NULL) err(1,"%s",path);
+    memset(&w->header,0,sizeof(w->header));
+    memcpy(w->header.magic,RAW_MAGIC,sizeof(RAW_MAGIC));
+    w->header.dtype = 2;
+    w->header.cols = cols;
+    if(fwrite(&w->header,sizeof(w->header),1,w->file) != 1) err(1,"%s",path);
+}
+
+void write_raw(void *ctx, int y, const double *row){
+
+    struct raw_writer *w = ctx;
+    if(fwrite(row,sizeof(double),w->header.cols,w->file) != (size_t)w->header.cols) err(1,"write row %d",y);
+    w->header.rows++;
+}
+
+//Rewrites the header with the final row count.
+void close_raw_writer(struct raw_writer *w){
+
+    if(fseek(w->file,0,SEEK_SET) || fwrite(&w->header,sizeof(w->header),1,w->file) != 1) err(1,"header");
+    fclose(w->file);
+}
+
+//Collects rows into a full image, for testing.
+struct memory_writer {
+    int width;
+    double *image;
+};
+
+void write_memory(void *ctx, int y, const double *row){
+
+    struct memory_writer *w = ctx;
+    memcpy(w->image+(size_t)y*w->width,row,(size_t)w->width*sizeof(double));
+}
+
+//Keeps a running checksum, for benchmarking without storage.
+struct checksum_writer {
+    int width;
+    double sum;
+    int rows;
+};
+
+void write_checksum(void *ctx, int y, const double *row){
+
+    struct checksum_writer *w = ctx;
+    int x;
+    if(y != w->rows++) errx(1,"Row %d written out of order",y);
+    for(x=0;x<w->width;x++) w->sum += row[x];
+}
+
+//Straightforward per-pixel convolution on a whole image, for testing.
+void convolve2d_image_reference(const double *image, int width, int height, const double *kernel, int k_x, int k_y,
+                                double *output, enum border_mode border){
+
+    int left = (k_x-1)/2, top = (k_y-1)/2;
+    int x,y,i,j;
+    for(y=0;y<height;y++){
+        for(x=0;x<width;x++){
+            double acc = 0.0;
+            for(j=0;j<k_y;j++){
+                int yi = borderindex(y+top-j,height,border);
+                if(yi < 0) continue;
+                for(i=0;i<k_x;i++){
+                    int xi = borderindex(x+left-i,width,border);
+                    if(xi < 0) continue;
+                    acc += kernel[j*k_x+i] * image[(size_t)yi*width+xi];
+                }
+            }
+            output[(size_t)y*width+x] = acc;
+        }
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//Checks the streamed result against the whole-image reference for every border mode.
+static void selftest(void){
+
+    const char *bordernames[] = {"zero","clamp","reflect"};
+    int sizes[][2] = {{3,3},{5,4},{7,7},{1,9},{15,15}};
+    int heights[] = {1,2,5,40};
+    int width = 23;
+    int b,k,h,i;
+
+    for(h=0;h<4;h++){
+        int height = heights[h];
+        double *image = malloc((size_t)width*height*sizeof(double));
+        double *ref = malloc((size_t)width*height*sizeof(double));
+        double *out = malloc((size_t)width*height*sizeof(double));
+        struct synthetic_reader gen = {width,height,0};
+        for(i=0;i<height;i++) read_synthetic(&gen,image+(size_t)i*width);
+
+        for(b=BORDER_ZERO;b<=BORDER_REFLECT;b++){
+            for(k=0;k<5;k++){
+                int k_x = sizes[k][0], k_y = sizes[k][1];
+                double *kernel = malloc((size_t)k_x*k_y*sizeof(double));
+                for(i=0;i<k_x*k_y;i++) kernel[i] = (double)rand()/RAND_MAX - 0.5;
+
+                struct stream_conv sc;
+                struct synthetic_reader reader = {width,height,0};
+                struct memory_writer writer = {width,out};
+                init_stream_conv(&sc,width,kernel,k_x,k_y,b);
+                if(stream_convolve(&sc,read_synthetic,&reader,write_memory,&writer) != height) errx(1,"Row count mismatch");
+                convolve2d_image_reference(image,width,height,kernel,k_x,k_y,ref,b);
+                for(i=0;i<width*height;i++){
+                    if(fabs(out[i]-ref[i]) > 1e-9) errx(1,"%s border, %dx%d kernel, height %d: mismatch",bordernames[b],k_x,k_y,height);
+                }
+                free_stream_conv(&sc);
+                free(kernel);
+            }
+        }
+        free(image);
+        free(ref);
+        free(out);
+    }
+    printf("Streamed output matches the whole-image reference.\n");
+}
+
+
+int main(int argc, char *argv[]){
+
+    int ksize = 7;
+    double *kernel = malloc(15*15*sizeof(double));
+    int i;
+
+    //Stream a raw file: <input.raw> <output.raw> [kernel size]
+    if(argc >= 3){
+        struct raw_reader reader;
+        struct raw_writer writer;
+        struct stream_conv sc;
+        if(argc > 3) ksize = strtol(argv[3],NULL,10);
+        if(ksize < 1 || ksize > 15) errx(1,"Kernel size must be 1-15.");
+        for(i=0;i<ksize*ksize;i++) kernel[i] = 1.0/(ksize*ksize);
+
+        open_raw_reader(&reader,argv[1]);
+        open_raw_writer(&writer,argv[2],reader.header->cols);
+        init_stream_conv(&sc,reader.header->cols,kernel,ksize,ksize,BORDER_REFLECT);
+        double t0 = seconds();
+        int rows = stream_convolve(&sc,read_raw,&reader,write_raw,&writer);
+        double t1 = seconds();
+        close_raw_writer(&writer);
+        close_raw_reader(&reader);
+        printf("Filtered %d rows of %lld in %f s using %zu bytes of line buffers\n",
+               rows,(long long)writer.header.cols,t1-t0,stream_conv_footprint(&sc));
+        free_stream_conv(&sc);
+        free(kernel);
+        return 0;
+    }
+
+    selftest();
+
+    //A tall synthetic image: only the line buffers are ever resident.
+    int width = argc > 1 ? strtol(argv[1],NULL,10) : 8192;
+    int height = 20000;
+    for(i=0;i<ksize*ksize;i++) kernel[i] = 1.0/(ksize*ksize);
+    struct stream_conv sc;
+    struct synthetic_reader reader = {width,height,0};
+    struct checksum_writer writer = {width,0.0,0};
+    init_stream_conv(&sc,width,kernel,ksize,ksize,BORDER_REFLECT);
+    double t0 = seconds();
+    stream_convolve(&sc,read_synthetic,&reader,write_checksum,&writer);
+    double t1 = seconds();
+    if(writer.rows != height) errx(1,"Wrote %d of %d rows",writer.rows,height);
+    printf("%d x %d image (%.1f GB as doubles), %dx%d kernel: %f s, %.1f Mpixel/s, %zu bytes resident, checksum %.6e\n",
+           width,height,(double)width*height*sizeof(double)/1e9,ksize,ksize,t1-t0,
+           (double)width*height/(t1-t0)/1e6,stream_conv_footprint(&sc),writer.sum);
+
+    free_stream_conv(&sc);
+    free(kernel);
+    return 0;
+}
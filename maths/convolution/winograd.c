@@ -0,0 +1,444 @@
+/* Winograd minimal filtering for 3x3 kernels, F(2x2,3x3) and F(4x4,3x3).
+ *
+ * Direct 3x3 convolution costs 9 multiplies per output. Winograd's algorithm transforms
+ * each (m+2)x(m+2) input tile and the 3x3 filter into a shared domain where an m x m
+ * output tile only needs (m+2)^2 element-wise products:
+ *
+ *     Y = A^T [ (G g G^T) .* (B^T d B) ] A
+ *
+ * That is 16/4 = 4 multiplies per output for F(2x2,3x3) and 36/16 = 2.25 for F(4x4,3x3).
+ * Filters are transformed once. Each input tile is transformed once per input channel and
+ * reused by every output channel, and input channels are summed in the transformed
+ * domain, so the inverse transform runs once per tile and output channel. Tiles are
+ * processed in batches of TILE_BATCH laid out lane-wise, so every transform and product
+ * loop runs across tiles and vectorises.
+ *
+ * As in CNN layers this computes a "valid" multi-channel correlation:
+ *     out[k][y][x] = sum_c sum_{j,i} image[c][y+j][x+i] * filter[k][c][j][i]
+ * giving out_channels outputs of (height-2) x (width-2). Larger tiles save more multiplies but amplify
+ * rounding error, so results are checked against a direct double precision convolution. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include <err.h>
+#include <time.h>
+
+#define TILE_BATCH 16 //Tiles transformed together; one AVX-512 register of floats.
+#define MAX_ALPHA 6
+
+//Transform matrices for F(m x m, 3x3), alpha = m + 2.
+struct winograd_transform {
+    int m;
+    int alpha;
+    const float *BT; //alpha x alpha
+    const float *G; //alpha x 3
+    const float *AT; //m x alpha
+};
+
+static const float BT_2[4*4] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1
+};
+static const float G_2[4*3] = {
+    1.0f,  0.0f, 0.0f,
+    0.5f,  0.5f, 0.5f,
+    0.5f, -0.5f, 0.5f,
+    0.0f,  0.0f, 1.0f
+};
+static const float AT_2[2*4] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1
+};
+
+static const float BT_4[6*6] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1
+};
+static const float G_4[6*3] = {
+     1.0f/4,       0.0f,      0.0f,
+    -1.0f/6,   -1.0f/6,   -1.0f/6,
+    -1.0f/6,    1.0f/6,   -1.0f/6,
+     1.0f/24,   1.0f/12,   1.0f/6,
+     1.0f/24,  -1.0f/12,   1.0f/6,
+     0.0f,      0.0f,      1.0f
+};
+static const float AT_4[4*6] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1
+};
+
+static const struct winograd_transform F2x2_3x3 = {2, 4, BT_2, G_2, AT_2};
+static const struct winograd_transform F4x4_3x3 = {4, 6, BT_4, G_4, AT_4};
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    const struct winograd_transform *wt;
+    const float *image;
+    const float *U; //Transformed filters, out_channels x channels x alpha^2.
+    float *output;
+    int width;
+    int height;
+    int channels;
+    int out_channels;
+    int tilerowmin;
+    int tilerowmax; //Exclusive.
+};
+
+//U = G g G^T for one 3x3 filter.
+static void transform_filter(const struct winograd_transform *wt, const float *g, float *U){
+
+    int a = wt->alpha;
+    float tmp[MAX_ALPHA*3];
+    int i,j,k;
+
+    for(i=0;i<a;i++){
+        for(j=0;j<3;j++){
+            float acc = 0.0f;
+            for(k=0;k<3;k++) acc += wt->G[i*3+k]*g[k*3+j];
+            tmp[i*3+j] = acc;
+        }
+    }
+    for(i=0;i<a;i++){
+        for(j=0;j<a;j++){
+            float acc = 0.0f;
+            for(k=0;k<3;k++) acc += tmp[i*3+k]*wt->G[j*3+k];
+            U[i*a+j] = acc;
+        }
+    }
+}
+
+//out[r][j][t] = sum_k L[r][k] in[k][j][t] for `cols` columns of TILE_BATCH lanes.
+static inline void leftmultiply(const float *L, int rows, int inner, int cols,
+                                const float *restrict in, float *restrict out){
+
+    int r,k,j,t;
+    memset(out,0,(size_t)rows*cols*TILE_BATCH*sizeof(float));
+    for(r=0;r<rows;r++){
+        for(k=0;k<inner;k++){
+            float l = L[r*inner+k];
+            if(l == 0.0f) continue;
+            for(j=0;j<cols;j++){
+                float *restrict o = out + (r*cols+j)*TILE_BATCH;
+                const float *restrict s = in + (k*cols+j)*TILE_BATCH;
+                for(t=0;t<TILE_BATCH;t++) o[t] += l*s[t];
+            }
+        }
+    }
+}
+
+//out[i][r][t] = sum_k in[i][k][t] L[r][k] for `rowsin` rows of TILE_BATCH lanes.
+static inline void rightmultiply(const float *L, int rows, int inner, int rowsin,
+                                 const float *restrict in, float *restrict out){
+
+    int i,r,k,t;
+    memset(out,0,(size_t)rowsin*rows*TILE_BATCH*sizeof(float));
+    for(i=0;i<rowsin;i++){
+        for(r=0;r<rows;r++){
+            float *restrict o = out + (i*rows+r)*TILE_BATCH;
+            for(k=0;k<inner;k++){
+                float l = L[r*inner+k];
+                if(l == 0.0f) continue;
+                const float *restrict s = in + (i*inner+k)*TILE_BATCH;
+                for(t=0;t<TILE_BATCH;t++) o[t] += l*s[t];
+            }
+        }
+    }
+}
+
+void *winograd_worker(void *threadArg){
+
+    struct thread_data *inst = (struct thread_data *) threadArg;
+    const struct winograd_transform *wt = inst->wt;
+    int m = wt->m, a = wt->alpha, aa = a*a;
+    int width = inst->width, height = inst->height;
+    int outw = width - 2, outh = height - 2;
+    int tiles_x = (outw + m - 1)/m;
+    int K = inst->out_channels;
+    size_t plane = (size_t)width*height;
+    size_t outplane = (size_t)outw*outh;
+
+    float d[MAX_ALPHA*MAX_ALPHA*TILE_BATCH];
+    float tmp[MAX_ALPHA*MAX_ALPHA*TILE_BATCH];
+    float M[MAX_ALPHA*MAX_ALPHA*TILE_BATCH];
+    float Y[MAX_ALPHA*MAX_ALPHA*TILE_BATCH];
+    float *V = malloc((size_t)inst->channels*aa*TILE_BATCH*sizeof(float)); //Transformed tiles, every input channel.
+    int ty,tx0,c,k,e,i,j,t;
+
+    for(ty=inst->tilerowmin;ty<inst->tilerowmax;ty++){
+        int y0 = ty*m;
+        for(tx0=0;tx0<tiles_x;tx0+=TILE_BATCH){
+            int batch = tiles_x - tx0 < TILE_BATCH ? tiles_x - tx0 : TILE_BATCH;
+            int inside = (tx0+TILE_BATCH-1)*m + a <= width && y0 + a <= height;
+
+            //Gather alpha x alpha input tiles into lanes, zero beyond the image, and
+            //transform them: V[c] = B^T d B.
+            for(c=0;c<inst->channels;c++){
+                const float *img = inst->image + c*plane;
+                for(i=0;i<a;i++){
+                    int y = y0 + i;
+                    const float *row = img + (size_t)(y < height ? y : height-1)*width; //Rows past the image read as zero.
+                    for(j=0;j<a;j++){
+                        float *lane = d + (i*a+j)*TILE_BATCH;
+                        if(inside){
+                            for(t=0;t<TILE_BATCH;t++) lane[t] = row[(tx0+t)*m + j];
+                        }
+                        else {
+                            for(t=0;t<TILE_BATCH;t++){
+                                int x = (tx0+t)*m + j;
+                                lane[t] = (t < batch && y < height && x < width) ? row[x] : 0.0f;
+                            }
+                        }
+                    }
+                }
+                leftmultiply(wt->BT,a,a,a,d,tmp);
+                rightmultiply(wt->BT,a,a,a,tmp,V+(size_t)c*aa*TILE_BATCH);
+            }
+
+            //For each output channel, M = sum_c U[k][c] .* V[c], then Y = A^T M A.
+            for(k=0;k<K;k++){
+                const float *Uk = inst->U + (size_t)k*inst->channels*aa;
+                for(e=0;e<aa;e++){
+                    //One lane vector per element, kept in registers across channels.
+                    float acc[TILE_BATCH] = {0};
+                    for(c=0;c<inst->channels;c++){
+                        float u = Uk[(size_t)c*aa+e];
+                        const float *restrict vv = V + ((size_t)c*aa+e)*TILE_BATCH;
+                        for(t=0;t<TILE_BATCH;t++) acc[t] += u*vv[t];
+                    }
+                    memcpy(M+e*TILE_BATCH,acc,sizeof(acc));
+                }
+                leftmultiply(wt->AT,m,a,a,M,tmp);
+                rightmultiply(wt->AT,m,a,m,tmp,Y);
+                for(i=0;i<m && y0+i<outh;i++){
+                    float *out = inst->output + k*outplane + (size_t)(y0+i)*outw;
+                    for(t=0;t<batch;t++){
+                        int x0 = (tx0+t)*m;
+                        for(j=0;j<m && x0+j<outw;j++){
+                            out[x0+j] = Y[(i*m+j)*TILE_BATCH+t];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(V);
+    return NULL;
+}
+
+//Valid multi-channel 3x3 correlation of a channels x height x width image with
+//out_channels x channels x 3 x 3 filters into out_channels x (height-2) x (width-2).
+void winograd_convolve3x3(const struct winograd_transform *wt, const float *image, int width, int height,
+                          int channels, int out_channels, const float *filters, float *output, int threads){
+
+    if(width < 3 || height < 3) errx(1,"Image smaller than the kernel!");
+    if(threads < 1) threads = 1;
+
+    int a = wt->alpha;
+    int tiles_y = (height - 2 + wt->m - 1)/wt->m;
+    size_t nfilters = (size_t)out_channels*channels;
+    float *U = malloc(nfilters*a*a*sizeof(float));
+    size_t f;
+    int i;
+
+    for(f=0;f<nfilters;f++){
+        transform_filter(wt,filters+f*9,U+f*a*a);
+    }
+
+    struct thread_data *thread_desc = malloc(threads*sizeof(struct thread_data));
+    for(i=0;i<threads;i++){
+        thread_desc[i].wt = wt;
+        thread_desc[i].image = image;
+        thread_desc[i].U = U;
+        thread_desc[i].output = output;
+        thread_desc[i].width = width;
+        thread_desc[i].height = height;
+        thread_desc[i].channels = channels;
+        thread_desc[i].out_channels = out_channels;
+        thread_desc[i].tilerowmin = (int)((long)tiles_y*i/threads);
+        thread_desc[i].tilerowmax = (int)((long)tiles_y*(i+1)/threads);
+        if(pthread_create(&thread_desc[i].thread_id, NULL, winograd_worker, &thread_desc[i])) errx(1,"Thread creation failed.");
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(thread_desc[i].thread_id,NULL);
+    }
+
+    free(thread_desc);
+    free(U);
+}
+
+//Direct single precision version, for timing.
+void direct_convolve3x3(const float *image, int width, int height, int channels, int out_channels,
+                        const float *filters, float *output){
+
+    int outw = width - 2, outh = height - 2;
+    size_t plane = (size_t)width*height;
+    size_t outplane = (size_t)outw*outh;
+    int k,c,y,x,j,i;
+
+    memset(output,0,out_channels*outplane*sizeof(float));
+    for(k=0;k<out_channels;k++){
+        for(c=0;c<channels;c++){
+            const float *g = filters + ((size_t)k*channels + c)*9;
+            for(y=0;y<outh;y++){
+                float *restrict out = output + k*outplane + (size_t)y*outw;
+                for(j=0;j<3;j++){
+                    const float *restrict in = image + c*plane + (size_t)(y+j)*width;
+                    for(i=0;i<3;i++){
+                        float w = g[j*3+i];
+                        for(x=0;x<outw;x++) out[x] += w*in[x+i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+//Double precision reference. Also returns sum |image|*|filter| per output in `magnitude`
+//for scaling the error bound.
+void reference_convolve3x3(const float *image, int width, int height, int channels, int out_channels,
+                           const float *filters, double *output, double *magnitude){
+
+    int outw = width - 2, outh = height - 2;
+    size_t plane = (size_t)width*height;
+    size_t outplane = (size_t)outw*outh;
+    int k,c,y,x,j,i;
+
+    for(k=0;k<out_channels;k++){
+        for(y=0;y<outh;y++){
+            for(x=0;x<outw;x++){
+                double acc = 0.0, mag = 0.0;
+                for(c=0;c<channels;c++){
+                    const float *g = filters + ((size_t)k*channels + c)*9;
+                    for(j=0;j<3;j++){
+                        for(i=0;i<3;i++){
+                            double v = (double)image[c*plane+(size_t)(y+j)*width+x+i]*g[j*3+i];
+                            acc += v;
+                            mag += fabs(v);
+                        }
+                    }
+                }
+                output[k*outplane+(size_t)y*outw+x] = acc;
+                magnitude[k*outplane+(size_t)y*outw+x] = mag;
+            }
+        }
+    }
+}
+
+//Largest error relative to the magnitude of the terms that produced each output, in units of FLT_EPSILON.
+static double relativeerror(const float *out, const double *ref, const double *magnitude, size_t n){
+
+    double worst = 0.0;
+    size_t i;
+    for(i=0;i<n;i++){
+        double e = fabs(out[i]-ref[i])/(magnitude[i] > 0.0 ? magnitude[i] : 1.0)/FLT_EPSILON;
+        if(e > worst) worst = e;
+    }
+    return worst;
+}
+
+//How much the transforms can amplify one input-filter product: the largest
+//sum_e |A^T[o][e]| |G[e][j]| |B^T[e][i]| over 1D taps, squared for the 2D tile.
+static double amplification(const struct winograd_transform *wt){
+
+    double worst = 0.0;
+    int o,i,j,e;
+    for(o=0;o<wt->m;o++){
+        for(j=0;j<3;j++){
+            for(i=0;i<wt->alpha;i++){
+                double sum = 0.0;
+                for(e=0;e<wt->alpha;e++) sum += fabs(wt->AT[o*wt->alpha+e])*fabs(wt->G[e*3+j])*fabs(wt->BT[e*wt->alpha+i]);
+                if(sum > worst) worst = sum;
+            }
+        }
+    }
+    return worst*worst;
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+int main(int argc, char *argv[]){
+
+    int width = argc > 1 ? strtol(argv[1],NULL,10) : 512;
+    int height = argc > 2 ? strtol(argv[2],NULL,10) : 512;
+    int channels = argc > 3 ? strtol(argv[3],NULL,10) : 32;
+    int out_channels = argc > 4 ? strtol(argv[4],NULL,10) : 32;
+    int threads = argc > 5 ? strtol(argv[5],NULL,10) : 1;
+    if(width < 3 || height < 3 || channels < 1 || out_channels < 1){
+        return 0;
+    }
+
+    //Error bounds in units of FLT_EPSILON * sum|d*g|, scaled by how much each transform amplifies
+    //rounding (4 for F(2x2), about 114 for F(4x4)). A single channel stays within that factor;
+    //errors from independent channels add in quadrature while sum|d*g| grows linearly, leaving
+    //a floor from the accumulation across channels.
+    const double kappa_2 = amplification(&F2x2_3x3), kappa_4 = amplification(&F4x4_3x3);
+    const double bound_2 = kappa_2*(2.0/sqrt(channels) + 1.0/16), bound_4 = kappa_4*(2.0/sqrt(channels) + 1.0/16);
+
+    size_t n = (size_t)channels*width*height;
+    size_t nout = (size_t)out_channels*(width-2)*(height-2);
+    size_t nfilter = (size_t)out_channels*channels*9;
+    float *image = malloc(n*sizeof(float));
+    float *filters = malloc(nfilter*sizeof(float));
+    float *out2 = malloc(nout*sizeof(float));
+    float *out4 = malloc(nout*sizeof(float));
+    float *outdirect = malloc(nout*sizeof(float));
+    double *ref = malloc(nout*sizeof(double));
+    double *magnitude = malloc(nout*sizeof(double));
+    size_t i;
+
+    for(i=0;i<n;i++) image[i] = (float)rand()/RAND_MAX;
+    for(i=0;i<nfilter;i++) filters[i] = (float)rand()/RAND_MAX - 0.5f;
+    memset(out2,0,nout*sizeof(float));
+    memset(out4,0,nout*sizeof(float));
+
+    reference_convolve3x3(image,width,height,channels,out_channels,filters,ref,magnitude);
+
+    double t0 = seconds();
+    direct_convolve3x3(image,width,height,channels,out_channels,filters,outdirect);
+    double t1 = seconds();
+    winograd_convolve3x3(&F2x2_3x3,image,width,height,channels,out_channels,filters,out2,threads);
+    double t2 = seconds();
+    winograd_convolve3x3(&F4x4_3x3,image,width,height,channels,out_channels,filters,out4,threads);
+    double t3 = seconds();
+
+    double e_direct = relativeerror(outdirect,ref,magnitude,nout);
+    double e_2 = relativeerror(out2,ref,magnitude,nout);
+    double e_4 = relativeerror(out4,ref,magnitude,nout);
+
+    printf("%dx%d image, %d -> %d channels, %d threads\n",width,height,channels,out_channels,threads);
+    printf("Direct:         %f s, error %.2f eps\n",t1-t0,e_direct);
+    printf("F(2x2,3x3):     %f s, error %.2f eps (bound %.1f)\n",t2-t1,e_2,bound_2);
+    printf("F(4x4,3x3):     %f s, error %.2f eps (bound %.0f)\n",t3-t2,e_4,bound_4);
+
+    if(e_2 > bound_2) errx(1,"F(2x2,3x3) error exceeds bound!");
+    if(e_4 > bound_4) errx(1,"F(4x4,3x3) error exceeds bound!");
+
+    free(image);
+    free(filters);
+    free(out2);
+    free(out4);
+    free(outdirect);
+    free(ref);
+    free(magnitude);
+    return 0;
+}
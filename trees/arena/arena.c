@@ -0,0 +1,685 @@
+/* Arena/slab allocator for tree nodes.
+ *
+ * Memory is carved from large chunks. Small objects are grouped into power-of-two size
+ * classes, each with its own free list, so freed nodes are reused without going back to
+ * malloc. Every thread keeps a private cache per size class (and its own bump block) and
+ * only takes the arena lock to refill or spill that cache in batches. arena_reset() throws
+ * away every object at once while keeping the chunks for reuse, which makes tearing down a
+ * whole tree O(chunks) instead of a free() per node.
+ *
+ * Generations come from one global counter, so a cache left over from an arena that was reset,
+ * or destroyed and replaced by another at the same address, never matches. Live arenas are kept
+ * in a registry, and a stale cache is only handed back if its arena is still registered. A
+ * thread keeps caches for up to THREAD_CACHES arenas at once, so building several trees in
+ * their own arenas side by side does not throw away bump blocks on every switch. A thread's
+ * caches are flushed when it exits.
+ *
+ * Callers pass the object size to arena_free (like the tree code below, which always knows
+ * its node size), so objects carry no header. Objects bigger than the largest class are
+ * bump allocated and only reclaimed by arena_reset.
+ *
+ * The BST and quadtree functions below are the ones from trees/binary_search_tree and
+ * trees/quad_tree with their malloc/free swapped for the arena; main() benchmarks both ways. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+
+#define ARENA_CHUNK (4 << 20) //Bytes requested from malloc at a time.
+#define THREAD_BLOCK (64 << 10) //Bytes a thread takes from the arena for its bump region.
+#define MIN_CLASS_SHIFT 4 //Smallest class is 16 bytes.
+#define SIZE_CLASSES 8 //16 .. 2048 bytes.
+#define CACHE_LIMIT 256 //Objects per class a thread holds before spilling half back.
+#define ARENA_ALIGN 16
+#define THREAD_CACHES 4 //Arenas a thread can use in turn without flushing a cache.
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char *data;
+};
+
+typedef struct arena {
+    pthread_mutex_t lock;
+    struct arena_chunk *chunks; //Every chunk we own, in allocation order.
+    struct arena_chunk *current; //Chunk being bump allocated from.
+    void *free_lists[SIZE_CLASSES]; //Shared free objects, refilled by thread caches.
+    unsigned long generation; //Replaced by arena_reset, so thread caches know to drop everything.
+    struct arena *next_live; //Registry of arenas that have not been destroyed.
+} arena;
+
+//Per-thread view of one arena.
+struct thread_cache {
+    arena *owner;
+    unsigned long generation;
+    void *free_lists[SIZE_CLASSES];
+    int counts[SIZE_CLASSES];
+    char *bump;
+    char *bump_end;
+};
+
+static __thread struct thread_cache caches[THREAD_CACHES];
+static __thread struct thread_cache *last_cache; //Most recently used entry of caches.
+static __thread int next_victim; //Round-robin eviction when every entry is in use.
+
+//Guards the registry and the generation counter. Taken before any arena lock.
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static arena *live_arenas = NULL;
+static unsigned long next_generation = 1;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void cache_flush(struct thread_cache *cache);
+
+static void cache_exit(void *unused){
+
+    int i;
+    (void)unused;
+    for(i=0;i<THREAD_CACHES;i++) cache_flush(&caches[i]);
+    last_cache = NULL;
+}
+
+static void cache_key_create(void){
+    if(pthread_key_create(&cache_key,cache_exit)) errx(1,"Could not create thread cache key.");
+}
+
+void arena_init(arena *a){
+
+    pthread_once(&cache_key_once,cache_key_create);
+    pthread_mutex_init(&a->lock,NULL);
+    a->chunks = a->current = NULL;
+    memset(a->free_lists,0,sizeof(a->free_lists));
+    pthread_mutex_lock(&live_lock);
+    a->generation = next_generation++;
+    a->next_live = live_arenas;
+    live_arenas = a;
+    pthread_mutex_unlock(&live_lock);
+}
+
+static inline int size_class(size_t size){
+
+    int c = 0;
+    size_t s = (size_t)1 << MIN_CLASS_SHIFT;
+    while(s < size){
+        s <<= 1;
+        c++;
+    }
+    return c;
+}
+
+static inline size_t class_size(int c){
+    return (size_t)1 << (c + MIN_CLASS_SHIFT);
+}
+
+//Bump allocates from the arena's chunks. Caller holds the lock.
+static void *arena_carve(arena *a, size_t size){
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    //Reuse chunks kept from before a reset before asking for more.
+    while(a->current != NULL && a->current->used + size > a->current->size && a->current->next != NULL){
+        a->current = a->current->next;
+    }
+    if(a->current == NULL || a->current->used + size > a->current->size){
+        size_t bytes = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk));
+        if(chunk == NULL || (chunk->data = aligned_alloc(ARENA_ALIGN,bytes)) == NULL) errx(1,"Arena out of memory!");
+        chunk->size = bytes;
+        chunk->used = 0;
+        chunk->next = NULL;
+        //Append so that chunks stay in the order current walks them.
+        if(a->current == NULL){
+            chunk->next = a->chunks;
+            a->chunks = chunk;
+        }
+        else{
+            chunk->next = a->current->next;
+            a->current->next = chunk;
+        }
+        a->current = chunk;
+    }
+    void *p = a->current->data + a->current->used;
+    a->current->used += size;
+    return p;
+}
+
+//Hands a cache's free objects back to its arena, if it is still live and has not been
+//reset since. Otherwise the cache is simply dropped.
+static void cache_flush(struct thread_cache *cache){
+
+    int c;
+    arena *a;
+    if(cache->owner == NULL) return;
+    pthread_mutex_lock(&live_lock);
+    for(a=live_arenas;a!=NULL;a=a->next_live){
+        if(a == cache->owner && a->generation == cache->generation) break;
+    }
+    if(a != NULL){
+        pthread_mutex_lock(&a->lock);
+        for(c=0;c<SIZE_CLASSES;c++){
+            while(cache->free_lists[c] != NULL){
+                void *p = cache->free_lists[c];
+                cache->free_lists[c] = *(void **)p;
+                *(void **)p = a->free_lists[c];
+                a->free_lists[c] = p;
+            }
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    pthread_mutex_unlock(&live_lock);
+    memset(cache,0,sizeof(*cache));
+}
+
+//Returns this thread's cache for a. A cache left from before a reset, or from an arena
+//destroyed at the same address, is dropped and reused; otherwise an empty entry is taken,
+//and only when all are in use is one flushed for a.
+static inline struct thread_cache *cache_attach(arena *a){
+
+    struct thread_cache *cache = last_cache;
+    int i;
+    if(cache != NULL && cache->owner == a && cache->generation == a->generation) return cache;
+    cache = NULL;
+    for(i=0;i<THREAD_CACHES;i++){
+        if(caches[i].owner == a){
+            cache = &caches[i];
+            if(cache->generation == a->generation){
+                last_cache = cache;
+                return cache;
+            }
+            break;
+        }
+    }
+    for(i=0;cache==NULL && i<THREAD_CACHES;i++){
+        if(caches[i].owner == NULL) cache = &caches[i];
+    }
+    if(cache == NULL){
+        cache = &caches[next_victim];
+        next_victim = (next_victim + 1) % THREAD_CACHES;
+    }
+    cache_flush(cache);
+    cache->owner = a;
+    cache->generation = a->generation;
+    pthread_setspecific(cache_key,caches); //So cache_exit runs when this thread ends.
+    last_cache = cache;
+    return cache;
+}
+
+void *arena_alloc(arena *a, size_t size){
+
+    struct thread_cache *cache = cache_attach(a);
+    if(size > class_size(SIZE_CLASSES-1)){
+        pthread_mutex_lock(&a->lock);
+        void *p = arena_carve(a,size);
+        pthread_mutex_unlock(&a->lock);
+        return p;
+    }
+
+    int c = size_class(size);
+    void *p = cache->free_lists[c];
+    if(p != NULL){
+        cache->free_lists[c] = *(void **)p;
+        cache->counts[c]--;
+        return p;
+    }
+
+    size_t bytes = class_size(c);
+    if((size_t)(cache->bump_end - cache->bump) < bytes){
+        //Take a batch of freed objects if the arena has any, otherwise a fresh block.
+        pthread_mutex_lock(&a->lock);
+        if(a->free_lists[c] != NULL){
+            int taken = 0;
+            while(a->free_lists[c] != NULL && taken < CACHE_LIMIT/2){
+                void *q = a->free_lists[c];
+                a->free_lists[c] = *(void **)q;
+                *(void **)q = cache->free_lists[c];
+                cache->free_lists[c] = q;
+                taken++;
+            }
+            pthread_mutex_unlock(&a->lock);
+            cache->counts[c] = taken - 1;
+            p = cache->free_lists[c];
+            cache->free_lists[c] = *(void **)p;
+            return p;
+        }
+        cache->bump = arena_carve(a,THREAD_BLOCK);
+        cache->bump_end = cache->bump + THREAD_BLOCK;
+        pthread_mutex_unlock(&a->lock);
+    }
+    p = cache->bump;
+    cache->bump += bytes;
+    return p;
+}
+
+void arena_free(arena *a, void *p, size_t size){
+
+    if(p == NULL || size > class_size(SIZE_CLASSES-1)) return;
+    struct thread_cache *cache = cache_attach(a);
+    int c = size_class(size);
+    *(void **)p = cache->free_lists[c];
+    cache->free_lists[c] = p;
+    if(++cache->counts[c] > CACHE_LIMIT){
+        //Spill half so that memory freed here can be reused by other threads.
+        pthread_mutex_lock(&a->lock);
+        while(cache->counts[c] > CACHE_LIMIT/2){
+            void *q = cache->free_lists[c];
+            cache->free_lists[c] = *(void **)q;
+            *(void **)q = a->free_lists[c];
+            a->free_lists[c] = q;
+            cache->counts[c]--;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+//Frees every object in the arena at once. Chunks are kept for the next round of allocation.
+//No thread may be allocating from the arena while it is reset.
+void arena_reset(arena *a){
+
+    struct arena_chunk *chunk;
+    pthread_mutex_lock(&live_lock);
+    pthread_mutex_lock(&a->lock);
+    for(chunk=a->chunks;chunk!=NULL;chunk=chunk->next) chunk->used = 0;
+    a->current = a->chunks;
+    memset(a->free_lists,0,sizeof(a->free_lists));
+    a->generation = next_generation++;
+    pthread_mutex_unlock(&a->lock);
+    pthread_mutex_unlock(&live_lock);
+}
+
+//Returns all memory to the system. Other threads' caches of a are dropped when next used.
+void arena_destroy(arena *a){
+
+    struct arena_chunk *chunk = a->chunks;
+    arena **link;
+    pthread_mutex_lock(&live_lock);
+    for(link=&live_arenas;*link!=NULL;link=&(*link)->next_live){
+        if(*link == a){
+            *link = a->next_live;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live_lock);
+    int i;
+    for(i=0;i<THREAD_CACHES;i++){
+        if(caches[i].owner == a) memset(&caches[i],0,sizeof(caches[i]));
+    }
+    while(chunk != NULL){
+        struct arena_chunk *next = chunk->next;
+        free(chunk->data);
+        free(chunk);
+        chunk = next;
+    }
+    a->chunks = a->current = NULL;
+    pthread_mutex_destroy(&a->lock);
+}
+
+size_t arena_footprint(const arena *a){
+
+    size_t bytes = 0;
+    const struct arena_chunk *chunk;
+    for(chunk=a->chunks;chunk!=NULL;chunk=chunk->next) bytes += chunk->size;
+    return bytes;
+}
+
+//Whether p lies in memory a has handed out.
+int arena_owns(const arena *a, const void *p){
+
+    const struct arena_chunk *chunk;
+    for(chunk=a->chunks;chunk!=NULL;chunk=chunk->next){
+        if((const char *)p >= chunk->data && (const char *)p < chunk->data + chunk->used) return 1;
+    }
+    return 0;
+}
+
+/* ---- Binary search tree, as in trees/binary_search_tree, with an allocator. ---- */
+
+//Our tree node datatype
+typedef struct bstNode{
+    int key;
+    int value;
+    struct bstNode *left;
+    struct bstNode *right;
+} bstNode;
+
+//NULL arena means malloc/free.
+static inline bstNode *new_bst_node(arena *a){
+    return a ? arena_alloc(a,sizeof(bstNode)) : malloc(sizeof(bstNode));
+}
+
+static inline void free_bst_node(arena *a, bstNode *node){
+    if(a) arena_free(a,node,sizeof(bstNode));
+    else free(node);
+}
+
+//Iterative so that skewed trees don't overflow the stack.
+bstNode *insert(arena *a, bstNode *Root, int key, int value){
+
+    bstNode *temp = new_bst_node(a);
+    temp->key = key;
+    temp->value = value;
+    temp->left = temp->right = NULL;
+    if(Root == NULL) return temp;
+
+    bstNode *node = Root;
+    for(;;){
+        bstNode **next = key > node->key ? &node->right : &node->left;
+        if(*next == NULL){
+            *next = temp;
+            return Root;
+        }
+        node = *next;
+    }
+}
+
+bstNode* search_tree(bstNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+bstNode* delete(arena *a, bstNode *Root, int key){
+
+    if(Root == NULL) return Root;
+
+    if(key > Root->key){
+        Root->right = delete(a,Root->right,key);
+    }
+    else if(key < Root->key){
+        Root->left = delete(a,Root->left,key);
+    }
+    else {
+        if(Root->left == NULL || Root->right == NULL){
+            bstNode *temp = Root->left ? Root->left : Root->right;
+            free_bst_node(a,Root);
+            return temp;
+        }
+        bstNode *temp = Root->right;
+        while(temp->left != NULL) temp = temp->left;
+        Root->key = temp->key;
+        Root->value = temp->value;
+        Root->right = delete(a,Root->right,temp->key);
+    }
+    return Root;
+}
+
+//Node-by-node teardown, which arena_reset makes unnecessary.
+void free_bst(arena *a, bstNode *Root){
+
+    bstNode **stack = malloc(64*sizeof(bstNode *));
+    int top = 0, capacity = 64;
+    if(Root != NULL) stack[top++] = Root;
+    while(top > 0){
+        bstNode *node = stack[--top];
+        if(top + 2 > capacity){
+            capacity *= 2;
+            stack = realloc(stack,capacity*sizeof(bstNode *));
+        }
+        if(node->left) stack[top++] = node->left;
+        if(node->right) stack[top++] = node->right;
+        free_bst_node(a,node);
+    }
+    free(stack);
+}
+
+/* ---- Static quadtree, as in trees/quad_tree, with an allocator. ---- */
+
+typedef struct treeNode{
+
+  double *grid; //Pointer to our part of the grid.
+  int size; // Size of this subgrid
+
+  //Pointers to the next level of the tree.
+  struct treeNode *NorthWest; 
+  struct treeNode *NorthEast;
+  struct treeNode *SouthWest;
+  struct treeNode *SouthEast;
+} treeNode;
+
+//Returns empty treeNode.
+treeNode* InitNode(arena *a){
+
+  treeNode *temp = a ? arena_alloc(a,sizeof(treeNode)) : malloc(sizeof(treeNode));
+  temp->grid = NULL;
+  temp->NorthWest = temp->NorthEast =
+    temp->SouthWest = temp->SouthEast = NULL;
+  return temp;
+
+}
+
+//Statically divided quad tree. Data allocated at leaves.
+treeNode* StaticTree(arena *a, treeNode *Root, int size, int depth){
+
+  Root->size = size;
+  if(depth>0){
+    Root->NorthWest = StaticTree(a,InitNode(a),size/2,depth-1);
+    Root->NorthEast = StaticTree(a,InitNode(a),size/2,depth-1);
+    Root->SouthWest = StaticTree(a,InitNode(a),size/2,depth-1);
+    Root->SouthEast = StaticTree(a,InitNode(a),size/2,depth-1);
+  }
+  else{
+    size_t bytes = (size_t)size*size*sizeof(double);
+    Root->grid = a ? arena_alloc(a,bytes) : malloc(bytes);
+  }
+
+  return Root;
+    
+}
+
+//Free all data at leaves of static tree. Only needed without an arena.
+void DeleteStaticTree(treeNode *Root){
+
+  if(Root->NorthWest == NULL){
+    free(Root->grid);
+  }
+  else{
+    DeleteStaticTree(Root->NorthWest);
+    DeleteStaticTree(Root->NorthEast);
+    DeleteStaticTree(Root->SouthWest);
+    DeleteStaticTree(Root->SouthEast);
+
+    free(Root->NorthWest);
+    free(Root->NorthEast);
+    free(Root->SouthWest);
+    free(Root->SouthEast);
+  }
+
+}
+
+/* ---- Benchmarks ---- */
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    arena *a; //NULL for malloc.
+    int rounds;
+    int live;
+    long checksum;
+};
+
+//Each thread builds a random BST, deletes half of it and frees the rest, repeatedly.
+void *churn_worker(void *threadArg){
+
+    struct thread_data *data = (struct thread_data *) threadArg;
+    unsigned int seed = (unsigned int)(uintptr_t)data;
+    int r,i;
+
+    for(r=0;r<data->rounds;r++){
+        bstNode *root = NULL;
+        for(i=0;i<data->live;i++) root = insert(data->a,root,rand_r(&seed),i);
+        for(i=0;i<data->live/2;i++) root = delete(data->a,root,root->key);
+        data->checksum += root ? root->key : 0;
+        free_bst(data->a,root);
+    }
+    return NULL;
+}
+
+//Caches frees from one arena, waits while main replaces it with a new arena at the same
+//address, then allocates again. The allocation must come from the new arena.
+struct stale_data {
+    arena *a;
+    pthread_barrier_t *barrier;
+    int owned;
+};
+
+void *stale_cache_worker(void *threadArg){
+
+    struct stale_data *data = (struct stale_data *) threadArg;
+    void *p[8];
+    int i;
+
+    for(i=0;i<8;i++) p[i] = arena_alloc(data->a,sizeof(bstNode));
+    for(i=0;i<8;i++) arena_free(data->a,p[i],sizeof(bstNode));
+    pthread_barrier_wait(data->barrier);
+    pthread_barrier_wait(data->barrier);
+    data->owned = arena_owns(data->a,arena_alloc(data->a,sizeof(bstNode)));
+    return NULL;
+}
+
+//Frees objects into its cache and exits without flushing.
+void *exit_worker(void *threadArg){
+
+    arena *a = threadArg;
+    void *p[8];
+    int i;
+
+    for(i=0;i<8;i++) p[i] = arena_alloc(a,sizeof(bstNode));
+    for(i=0;i<8;i++) arena_free(a,p[i],sizeof(bstNode));
+    return NULL;
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[]){
+
+    int n = argc > 1 ? strtol(argv[1],NULL,10) : 2000000;
+    int threads = argc > 2 ? strtol(argv[2],NULL,10) : 4;
+    int depth = argc > 3 ? strtol(argv[3],NULL,10) : 9;
+    int i, k;
+    arena a;
+
+    if(n < 1 || threads < 1 || depth < 0 || depth > 12) errx(1,"Usage: %s [nodes] [threads] [quadtree depth]",argv[0]);
+    arena_init(&a);
+
+    int *keys = malloc((size_t)n*sizeof(int));
+    srand(1);
+    for(i=0;i<n;i++) keys[i] = rand();
+
+    //BST: build, check, tear down, for malloc and then the arena (twice, to show reuse).
+    for(k=0;k<3;k++){
+        arena *alloc = k ? &a : NULL;
+        bstNode *root = NULL;
+        double t0 = seconds();
+        for(i=0;i<n;i++) root = insert(alloc,root,keys[i],i);
+        double t1 = seconds();
+        for(i=0;i<n;i+=101){
+            bstNode *node = search_tree(root,keys[i]);
+            if(node == NULL || node->key != keys[i]) errx(1,"Key %d missing!",keys[i]);
+        }
+        //Delete a quarter node by node so the free lists get exercised.
+        for(i=0;i<n/4;i++) root = delete(alloc,root,keys[i]);
+        for(i=n/4;i<n;i+=101){
+            if(search_tree(root,keys[i]) == NULL) errx(1,"Key %d lost after deletes!",keys[i]);
+        }
+        double t2 = seconds();
+        if(alloc) arena_reset(alloc);
+        else free_bst(NULL,root);
+        double t3 = seconds();
+        printf("BST %s: insert %d %f s, delete %d %f s, teardown %f s\n",
+               k ? "arena " : "malloc",n,t1-t0,n/4,t2-t1,t3-t2);
+    }
+    printf("Arena holds %.1f MB after reuse\n",arena_footprint(&a)/1e6);
+
+    //Quadtree nodes and leaf grids.
+    for(k=0;k<2;k++){
+        arena *alloc = k ? &a : NULL;
+        int size = 2 << depth;
+        double t0 = seconds();
+        treeNode *tree = StaticTree(alloc,InitNode(alloc),size,depth);
+        double t1 = seconds();
+        if(alloc){
+            arena_reset(alloc);
+        }
+        else{
+            DeleteStaticTree(tree);
+            free(tree);
+        }
+        double t2 = seconds();
+        printf("Quadtree depth %d %s: build %f s, teardown %f s\n",depth,k ? "arena " : "malloc",t1-t0,t2-t1);
+    }
+
+    //Several threads allocating and freeing through one arena.
+    struct thread_data *data = malloc(threads*sizeof(struct thread_data));
+    int live = 20000, rounds = 20;
+    for(k=0;k<2;k++){
+        arena *alloc = k ? &a : NULL;
+        double t0 = seconds();
+        for(i=0;i<threads;i++){
+            data[i].a = alloc;
+            data[i].rounds = rounds;
+            data[i].live = live;
+            data[i].checksum = 0;
+            if(pthread_create(&data[i].thread_id,NULL,churn_worker,&data[i])) errx(1,"Thread creation failed.");
+        }
+        for(i=0;i<threads;i++) pthread_join(data[i].thread_id,NULL);
+        double t1 = seconds();
+        printf("%d threads churning %s: %f s\n",threads,k ? "arena " : "malloc",t1-t0);
+        if(alloc) arena_reset(alloc);
+    }
+
+    //A thread's cache must not outlive its arena, nor keep objects when the thread exits.
+    arena b;
+    pthread_t thread_id;
+    pthread_barrier_t barrier;
+    struct stale_data stale = {&b,&barrier,0};
+    pthread_barrier_init(&barrier,NULL,2);
+    arena_init(&b);
+    if(pthread_create(&thread_id,NULL,stale_cache_worker,&stale)) errx(1,"Thread creation failed.");
+    pthread_barrier_wait(&barrier);
+    arena_destroy(&b);
+    arena_init(&b);
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread_id,NULL);
+    if(!stale.owned) errx(1,"Thread cache served memory from a destroyed arena!");
+    if(pthread_create(&thread_id,NULL,exit_worker,&b)) errx(1,"Thread creation failed.");
+    pthread_join(thread_id,NULL);
+    int c = size_class(sizeof(bstNode)), cached = 0;
+    void *p;
+    for(p=b.free_lists[c];p!=NULL;p=*(void **)p) cached++;
+    if(cached != 8) errx(1,"Exiting thread returned %d of 8 cached objects!",cached);
+    pthread_barrier_destroy(&barrier);
+    arena_destroy(&b);
+    printf("Thread caches survive arena replacement and are flushed on thread exit\n");
+
+    //Two trees built side by side in their own arenas keep their thread caches and bump
+    //blocks, so neither arena grows past its first chunk.
+    arena left, right;
+    bstNode *lroot = NULL, *rroot = NULL;
+    arena_init(&left);
+    arena_init(&right);
+    for(i=0;i<20000;i++){
+        lroot = insert(&left,lroot,keys[i],i);
+        rroot = insert(&right,rroot,keys[i],i);
+    }
+    if(arena_footprint(&left) > ARENA_CHUNK || arena_footprint(&right) > ARENA_CHUNK)
+        errx(1,"Interleaved arenas grew to %zu and %zu bytes!",arena_footprint(&left),arena_footprint(&right));
+    printf("Interleaved trees in two arenas: %.1f MB and %.1f MB\n",arena_footprint(&left)/1e6,arena_footprint(&right)/1e6);
+    arena_destroy(&left);
+    arena_destroy(&right);
+
+    free(data);
+    free(keys);
+    arena_destroy(&a);
+    return 0;
+}
@@ -0,0 +1,309 @@
+/* AVL tree with the same insert/search_tree/delete API as binary_search_tree.c.
+ *
+ * Every node stores the height of its subtree, and insert and delete rotate on the way back
+ * up whenever the two subtrees of a node differ in height by more than one. Height is then
+ * at most about 1.44 log2(n), so sorted or reverse-sorted keys (timestamps, say) cost the
+ * same as random ones. Note insert and delete return the new root, which may change on
+ * every call. Inserting an existing key updates its value. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <err.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+//Our tree node datatype
+typedef struct treeNode{
+    int key;
+    int value;
+    int height; //Height of this subtree, 1 for a leaf.
+    struct treeNode *left;
+    struct treeNode *right;
+} treeNode;
+
+static inline int height(treeNode *node){
+    return node ? node->height : 0;
+}
+
+static inline void update_height(treeNode *node){
+    node->height = 1 + MAX(height(node->left),height(node->right));
+}
+
+/*    Root            L
+ *    /  \           / \
+ *   L    c   ->    a  Root
+ *  / \                / \
+ * a   b              b   c
+ */
+static treeNode* rotate_right(treeNode *Root){
+
+    treeNode *L = Root->left;
+    Root->left = L->right;
+    L->right = Root;
+    update_height(Root);
+    update_height(L);
+    return L;
+}
+
+static treeNode* rotate_left(treeNode *Root){
+
+    treeNode *R = Root->right;
+    Root->right = R->left;
+    R->left = Root;
+    update_height(Root);
+    update_height(R);
+    return R;
+}
+
+//Restores the AVL property at Root, given that its subtrees are balanced.
+static treeNode* rebalance(treeNode *Root){
+
+    update_height(Root);
+    int balance = height(Root->left) - height(Root->right);
+    if(balance > 1){
+        if(height(Root->left->left) < height(Root->left->right)) Root->left = rotate_left(Root->left);
+        return rotate_right(Root);
+    }
+    if(balance < -1){
+        if(height(Root->right->right) < height(Root->right->left)) Root->right = rotate_right(Root->right);
+        return rotate_left(Root);
+    }
+    return Root;
+}
+
+treeNode* search_tree(treeNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+treeNode *insert(treeNode *Root,int key, int value){
+    if(Root==NULL){
+        treeNode *temp = (treeNode*)malloc(sizeof(treeNode));
+        temp->key=key;
+        temp->value=value;
+        temp->height=1;
+        temp->left = temp->right = NULL;
+        return temp;
+    }
+    else if(key > Root->key){
+        Root->right = insert(Root->right,key,value);
+    }
+    else if(key < Root->key){
+        Root->left = insert(Root->left,key,value);
+    }
+    else{
+        Root->value = value;
+        return Root;
+    }
+    return rebalance(Root);
+
+}
+
+treeNode* minValueNode(treeNode *Root){
+
+    treeNode *current = Root;
+    while(current->left != NULL){
+        current = current->left;
+    }
+    return current;
+}
+
+treeNode* delete(treeNode *Root,int key){
+
+    if(Root == NULL) return Root;
+    
+    if(key > Root->key){
+        Root->right = delete(Root->right,key);
+    }
+    else if(key < Root->key){
+        Root->left = delete(Root->left,key);
+    }
+    else {
+        if(Root->left == NULL){
+            treeNode *temp = Root->right;
+            free(Root);
+            return temp;
+        }
+        else if(Root->right == NULL){
+            treeNode *temp = Root->left;
+            free(Root);
+            return temp;
+        }
+        else {
+            treeNode *temp = minValueNode(Root->right);
+            Root->key = temp->key;
+            Root->value = temp->value; 
+            Root->right = delete(Root->right,temp->key);
+        }
+    }
+    return rebalance(Root);
+
+}
+
+void free_tree(treeNode *Root){
+
+    if(Root == NULL) return;
+    free_tree(Root->left);
+    free_tree(Root->right);
+    free(Root);
+}
+
+//Checks ordering, stored heights and balance. Returns the subtree's node count.
+static int check_tree(treeNode *node, long lo, long hi){
+
+    if(node == NULL) return 0;
+    if(node->key < lo || node->key > hi) errx(1,"Key %d out of order!",node->key);
+    int l = check_tree(node->left,lo,(long)node->key-1);
+    int r = check_tree(node->right,(long)node->key+1,hi);
+    if(node->height != 1 + MAX(height(node->left),height(node->right))) errx(1,"Stale height at key %d!",node->key);
+    int balance = height(node->left) - height(node->right);
+    if(balance > 1 || balance < -1) errx(1,"Unbalanced at key %d!",node->key);
+    return l + r + 1;
+}
+
+/* The unbalanced tree from binary_search_tree.c, made iterative so that sorted input
+ * (a linked list in disguise) doesn't overflow the stack. For comparison only. */
+typedef struct plainNode{
+    int key;
+    int value;
+    struct plainNode *left;
+    struct plainNode *right;
+} plainNode;
+
+plainNode *plain_insert(plainNode *Root, int key, int value){
+
+    plainNode *temp = malloc(sizeof(plainNode));
+    temp->key = key;
+    temp->value = value;
+    temp->left = temp->right = NULL;
+    if(Root == NULL) return temp;
+    plainNode *node = Root;
+    for(;;){
+        plainNode **next = key > node->key ? &node->right : &node->left;
+        if(*next == NULL){
+            *next = temp;
+            return Root;
+        }
+        node = *next;
+    }
+}
+
+plainNode* plain_search(plainNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+void plain_free(plainNode *Root){
+
+    //Flatten by right rotations so no recursion is needed.
+    while(Root != NULL){
+        if(Root->left != NULL){
+            plainNode *l = Root->left;
+            Root->left = l->right;
+            l->right = Root;
+            Root = l;
+        }
+        else{
+            plainNode *next = Root->right;
+            free(Root);
+            Root = next;
+        }
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//Keys 0..n-1 in sorted, reverse or shuffled order.
+static void make_keys(int *keys, int n, int order){
+
+    int i;
+    for(i=0;i<n;i++) keys[i] = order == 1 ? n-1-i : i;
+    if(order == 2){
+        for(i=n-1;i>0;i--){
+            int j = rand() % (i+1);
+            int t = keys[i]; keys[i] = keys[j]; keys[j] = t;
+        }
+    }
+}
+
+int main(int argc, char *argv[]){
+
+    int n = argc > 1 ? strtol(argv[1],NULL,10) : 1000000;
+    int plain_n = argc > 2 ? strtol(argv[2],NULL,10) : 30000;
+    int lookups = 1000000;
+    const char *orders[] = {"sorted","reverse","random"};
+    int i, o;
+
+    if(n < 2 || plain_n < 2) errx(1,"Usage: %s [avl keys] [plain bst keys]",argv[0]);
+    int *keys = malloc((size_t)n*sizeof(int));
+    int *probes = malloc((size_t)lookups*sizeof(int));
+    srand(1);
+
+    printf("AVL tree, %d keys:\n",n);
+    for(o=0;o<3;o++){
+        make_keys(keys,n,o);
+        for(i=0;i<lookups;i++) probes[i] = rand() % n;
+
+        treeNode *root = NULL;
+        double t0 = seconds();
+        for(i=0;i<n;i++) root = insert(root,keys[i],i);
+        double t1 = seconds();
+        long found = 0;
+        for(i=0;i<lookups;i++) found += search_tree(root,probes[i]) != NULL;
+        double t2 = seconds();
+        if(found != lookups || check_tree(root,0,n-1) != n) errx(1,"AVL tree is wrong after inserts!");
+        int h = root->height;
+        for(i=0;i<n;i+=2) root = delete(root,keys[i]);
+        double t3 = seconds();
+        if(check_tree(root,0,n-1) != n/2) errx(1,"AVL tree is wrong after deletes!");
+        for(i=0;i<n;i++){
+            if((search_tree(root,keys[i]) != NULL) != (i % 2)) errx(1,"Key %d wrong after deletes!",keys[i]);
+        }
+        printf("  %-7s: height %d, insert %.0f ns/key, search %.0f ns, delete %.0f ns/key\n",orders[o],h,
+               (t1-t0)/n*1e9,(t2-t1)/lookups*1e9,(t3-t2)/(n/2)*1e9);
+        free_tree(root);
+    }
+
+    //The unbalanced tree degrades to a list on ordered input, hence the smaller n.
+    printf("Unbalanced BST against AVL, %d keys:\n",plain_n);
+    for(o=0;o<3;o++){
+        make_keys(keys,plain_n,o);
+        for(i=0;i<lookups/10;i++) probes[i] = rand() % plain_n;
+
+        plainNode *plain = NULL;
+        treeNode *root = NULL;
+        double t0 = seconds();
+        for(i=0;i<plain_n;i++) plain = plain_insert(plain,keys[i],i);
+        double t1 = seconds();
+        for(i=0;i<lookups/10;i++){
+            if(plain_search(plain,probes[i]) == NULL) errx(1,"Plain BST lost key %d!",probes[i]);
+        }
+        double t2 = seconds();
+        for(i=0;i<plain_n;i++) root = insert(root,keys[i],i);
+        double t3 = seconds();
+        for(i=0;i<lookups/10;i++){
+            if(search_tree(root,probes[i]) == NULL) errx(1,"AVL lost key %d!",probes[i]);
+        }
+        double t4 = seconds();
+        printf("  %-7s: plain insert %.0f ns/key, search %.0f ns; AVL insert %.0f ns/key, search %.0f ns\n",orders[o],
+               (t1-t0)/plain_n*1e9,(t2-t1)/(lookups/10)*1e9,(t3-t2)/plain_n*1e9,(t4-t3)/(lookups/10)*1e9);
+        plain_free(plain);
+        free_tree(root);
+    }
+
+    free(keys);
+    free(probes);
+    return(0);
+}
@@ -0,0 +1,396 @@
+/* B+-tree for int keys and int values.
+ *
+ * Nodes hold NODE_KEYS keys in a cache-line aligned array, so a lookup costs one or two
+ * cache lines per level instead of one miss per binary-tree level, and the tree is about
+ * log_NODE_KEYS(n) deep. Unused key slots are filled with INT_MAX, so searching a node is a
+ * branch-free count of keys less than the target: eight at a time with AVX2, or a simple
+ * loop the compiler can vectorise otherwise. Values live only in the leaves, which are
+ * linked left to right for range scans.
+ *
+ * Deletes remove the key from its leaf without merging underfull nodes; scans skip leaves
+ * left empty. main() compares lookups against the pointer-based tree from
+ * binary_search_tree.c. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <err.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define NODE_KEYS 32 //Multiple of 16, so the keys fill whole cache lines.
+#define CACHE_LINE 64
+
+typedef struct bpLeaf {
+    int keys[NODE_KEYS];
+    int values[NODE_KEYS];
+    int count;
+    struct bpLeaf *next;
+} bpLeaf;
+
+typedef struct bpInner {
+    int keys[NODE_KEYS]; //keys[i] is the smallest key under children[i+1].
+    int count;
+    void *children[NODE_KEYS+1];
+} bpInner;
+
+typedef struct bpTree {
+    void *root;
+    int height; //Inner levels above the leaves.
+    long size;
+} bpTree;
+
+//Number of keys in the node less than key. Padding is INT_MAX, so it never counts.
+static inline int count_less(const int *keys, int key){
+
+#ifdef __AVX2__
+    __m256i k = _mm256_set1_epi32(key);
+    int i, c = 0;
+    for(i=0;i<NODE_KEYS;i+=8){
+        __m256i v = _mm256_load_si256((const __m256i *)(keys+i));
+        c += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k,v))));
+    }
+    return c;
+#else
+    int i, c = 0;
+    for(i=0;i<NODE_KEYS;i++) c += keys[i] < key;
+    return c;
+#endif
+}
+
+//Child of an inner node to follow for key: the number of separators <= key.
+static inline int child_index(const bpInner *node, int key){
+
+    int c = count_less(node->keys,key);
+    if(c < node->count && node->keys[c] == key) c++;
+    return c;
+}
+
+static bpLeaf* new_leaf(void){
+
+    bpLeaf *leaf = aligned_alloc(CACHE_LINE,(sizeof(bpLeaf)+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE);
+    if(leaf == NULL) errx(1,"Could not allocate leaf!");
+    int i;
+    for(i=0;i<NODE_KEYS;i++) leaf->keys[i] = INT_MAX;
+    leaf->count = 0;
+    leaf->next = NULL;
+    return leaf;
+}
+
+static bpInner* new_inner(void){
+
+    bpInner *inner = aligned_alloc(CACHE_LINE,(sizeof(bpInner)+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE);
+    if(inner == NULL) errx(1,"Could not allocate node!");
+    int i;
+    for(i=0;i<NODE_KEYS;i++) inner->keys[i] = INT_MAX;
+    inner->count = 0;
+    return inner;
+}
+
+void bp_init(bpTree *tree){
+
+    tree->root = new_leaf();
+    tree->height = 0;
+    tree->size = 0;
+}
+
+static bpLeaf* find_leaf(const bpTree *tree, int key){
+
+    void *node = tree->root;
+    int level;
+    for(level=tree->height;level>0;level--){
+        const bpInner *inner = node;
+        node = inner->children[child_index(inner,key)];
+    }
+    return node;
+}
+
+//Returns a pointer to key's value, or NULL if it is not in the tree.
+int* bp_search(const bpTree *tree, int key){
+
+    bpLeaf *leaf = find_leaf(tree,key);
+    int i = count_less(leaf->keys,key);
+    return (i < leaf->count && leaf->keys[i] == key) ? &leaf->values[i] : NULL;
+}
+
+//Inserts into node's subtree. If node splits, returns the new right sibling and sets
+//*separator to its smallest key.
+static void* insert_recurse(bpTree *tree, void *node, int level, int key, int value, int *separator){
+
+    int i;
+    if(level == 0){
+        bpLeaf *leaf = node;
+        int pos = count_less(leaf->keys,key);
+        if(pos < leaf->count && leaf->keys[pos] == key){
+            leaf->values[pos] = value;
+            return NULL;
+        }
+        tree->size++;
+        if(leaf->count < NODE_KEYS){
+            memmove(leaf->keys+pos+1,leaf->keys+pos,(leaf->count-pos)*sizeof(int));
+            memmove(leaf->values+pos+1,leaf->values+pos,(leaf->count-pos)*sizeof(int));
+            leaf->keys[pos] = key;
+            leaf->values[pos] = value;
+            leaf->count++;
+            return NULL;
+        }
+        //Split a full leaf in half, then insert into the proper side.
+        bpLeaf *right = new_leaf();
+        int half = NODE_KEYS/2;
+        memcpy(right->keys,leaf->keys+half,(NODE_KEYS-half)*sizeof(int));
+        memcpy(right->values,leaf->values+half,(NODE_KEYS-half)*sizeof(int));
+        right->count = NODE_KEYS-half;
+        for(i=half;i<NODE_KEYS;i++) leaf->keys[i] = INT_MAX;
+        leaf->count = half;
+        right->next = leaf->next;
+        leaf->next = right;
+        bpLeaf *target = pos <= half ? leaf : right;
+        if(target == right) pos -= half;
+        memmove(target->keys+pos+1,target->keys+pos,(target->count-pos)*sizeof(int));
+        memmove(target->values+pos+1,target->values+pos,(target->count-pos)*sizeof(int));
+        target->keys[pos] = key;
+        target->values[pos] = value;
+        target->count++;
+        *separator = right->keys[0];
+        return right;
+    }
+
+    bpInner *inner = node;
+    int c = child_index(inner,key);
+    int childsep;
+    void *split = insert_recurse(tree,inner->children[c],level-1,key,value,&childsep);
+    if(split == NULL) return NULL;
+
+    if(inner->count < NODE_KEYS){
+        memmove(inner->keys+c+1,inner->keys+c,(inner->count-c)*sizeof(int));
+        memmove(inner->children+c+2,inner->children+c+1,(inner->count-c)*sizeof(void *));
+        inner->keys[c] = childsep;
+        inner->children[c+1] = split;
+        inner->count++;
+        return NULL;
+    }
+    //Full inner node: lay out all NODE_KEYS+1 separators, push the middle one up.
+    int keys[NODE_KEYS+1];
+    void *children[NODE_KEYS+2];
+    memcpy(keys,inner->keys,c*sizeof(int));
+    keys[c] = childsep;
+    memcpy(keys+c+1,inner->keys+c,(NODE_KEYS-c)*sizeof(int));
+    memcpy(children,inner->children,(c+1)*sizeof(void *));
+    children[c+1] = split;
+    memcpy(children+c+2,inner->children+c+1,(NODE_KEYS-c)*sizeof(void *));
+
+    int mid = (NODE_KEYS+1)/2;
+    bpInner *right = new_inner();
+    for(i=0;i<NODE_KEYS;i++) inner->keys[i] = INT_MAX;
+    memcpy(inner->keys,keys,mid*sizeof(int));
+    memcpy(inner->children,children,(mid+1)*sizeof(void *));
+    inner->count = mid;
+    memcpy(right->keys,keys+mid+1,(NODE_KEYS-mid)*sizeof(int));
+    memcpy(right->children,children+mid+1,(NODE_KEYS-mid+1)*sizeof(void *));
+    right->count = NODE_KEYS-mid;
+    *separator = keys[mid];
+    return right;
+}
+
+//Inserts key, or updates its value if it is already present.
+void bp_insert(bpTree *tree, int key, int value){
+
+    int separator;
+    void *split = insert_recurse(tree,tree->root,tree->height,key,value,&separator);
+    if(split != NULL){
+        bpInner *root = new_inner();
+        root->keys[0] = separator;
+        root->children[0] = tree->root;
+        root->children[1] = split;
+        root->count = 1;
+        tree->root = root;
+        tree->height++;
+    }
+}
+
+//Removes key. Returns 0 if it was not present.
+int bp_delete(bpTree *tree, int key){
+
+    bpLeaf *leaf = find_leaf(tree,key);
+    int pos = count_less(leaf->keys,key);
+    if(pos >= leaf->count || leaf->keys[pos] != key) return 0;
+    memmove(leaf->keys+pos,leaf->keys+pos+1,(leaf->count-pos-1)*sizeof(int));
+    memmove(leaf->values+pos,leaf->values+pos+1,(leaf->count-pos-1)*sizeof(int));
+    leaf->count--;
+    leaf->keys[leaf->count] = INT_MAX;
+    tree->size--;
+    return 1;
+}
+
+//Calls visit on every key in [lo,hi] in order, walking the leaf chain. Returns the count.
+long bp_scan(const bpTree *tree, int lo, int hi, void (*visit)(int key, int value, void *arg), void *arg){
+
+    bpLeaf *leaf = find_leaf(tree,lo);
+    int i = count_less(leaf->keys,lo);
+    long count = 0;
+    while(leaf != NULL){
+        for(;i<leaf->count;i++){
+            if(leaf->keys[i] > hi) return count;
+            visit(leaf->keys[i],leaf->values[i],arg);
+            count++;
+        }
+        leaf = leaf->next;
+        i = 0;
+    }
+    return count;
+}
+
+static void free_recurse(void *node, int level){
+
+    int i;
+    if(level > 0){
+        bpInner *inner = node;
+        for(i=0;i<=inner->count;i++) free_recurse(inner->children[i],level-1);
+    }
+    free(node);
+}
+
+void bp_free(bpTree *tree){
+
+    free_recurse(tree->root,tree->height);
+    tree->root = NULL;
+}
+
+/* Pointer-based tree from binary_search_tree.c (iterative insert/search), for comparison. */
+typedef struct treeNode{
+    int key;
+    int value;
+    struct treeNode *left;
+    struct treeNode *right;
+} treeNode;
+
+treeNode *insert(treeNode *Root, int key, int value){
+
+    treeNode *temp = malloc(sizeof(treeNode));
+    temp->key = key;
+    temp->value = value;
+    temp->left = temp->right = NULL;
+    if(Root == NULL) return temp;
+    treeNode *node = Root;
+    for(;;){
+        treeNode **next = key > node->key ? &node->right : &node->left;
+        if(*next == NULL){
+            *next = temp;
+            return Root;
+        }
+        node = *next;
+    }
+}
+
+treeNode* search_tree(treeNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+void free_tree(treeNode *Root){
+
+    while(Root != NULL){
+        if(Root->left != NULL){
+            treeNode *l = Root->left;
+            Root->left = l->right;
+            l->right = Root;
+            Root = l;
+        }
+        else{
+            treeNode *next = Root->right;
+            free(Root);
+            Root = next;
+        }
+    }
+}
+
+struct scan_check {
+    long expected_key;
+    int step;
+};
+
+static void check_visit(int key, int value, void *arg){
+
+    struct scan_check *check = arg;
+    if(key != check->expected_key) errx(1,"Scan returned %d, expected %ld!",key,check->expected_key);
+    if(value != key*3) errx(1,"Scan returned wrong value for %d!",key);
+    check->expected_key += check->step;
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[]){
+
+    int n = argc > 1 ? strtol(argv[1],NULL,10) : 4000000;
+    int lookups = 2000000;
+    int i;
+
+    if(n < 2) errx(1,"Usage: %s [keys]",argv[0]);
+    //Even keys 0..2n-2 in random order, so odd probes are misses.
+    int *keys = malloc((size_t)n*sizeof(int));
+    int *probes = malloc((size_t)lookups*sizeof(int));
+    srand(1);
+    for(i=0;i<n;i++) keys[i] = 2*i;
+    for(i=n-1;i>0;i--){
+        int j = (int)(((long)rand()*RAND_MAX + rand()) % (i+1));
+        int t = keys[i]; keys[i] = keys[j]; keys[j] = t;
+    }
+    for(i=0;i<lookups;i++) probes[i] = (int)(((long)rand()*RAND_MAX + rand()) % (2L*n));
+
+    bpTree tree;
+    bp_init(&tree);
+    double t0 = seconds();
+    for(i=0;i<n;i++) bp_insert(&tree,keys[i],keys[i]*3);
+    double t1 = seconds();
+    long hits = 0;
+    for(i=0;i<lookups;i++){
+        int *v = bp_search(&tree,probes[i]);
+        if((v != NULL) != (probes[i] % 2 == 0) || (v && *v != probes[i]*3)) errx(1,"Lookup of %d wrong!",probes[i]);
+        hits += v != NULL;
+    }
+    double t2 = seconds();
+    struct scan_check check = {0,2};
+    if(bp_scan(&tree,0,INT_MAX,check_visit,&check) != n) errx(1,"Scan missed keys!");
+    double t3 = seconds();
+    printf("B+-tree (%d keys/node, height %d): insert %d %.0f ns/key, lookup %.2f Mops/s, full scan %.1f Mkeys/s\n",
+           NODE_KEYS,tree.height+1,n,(t1-t0)/n*1e9,lookups/(t2-t1)/1e6,n/(t3-t2)/1e6);
+
+    treeNode *root = NULL;
+    t0 = seconds();
+    for(i=0;i<n;i++) root = insert(root,keys[i],keys[i]*3);
+    t1 = seconds();
+    long bsthits = 0;
+    for(i=0;i<lookups;i++) bsthits += search_tree(root,probes[i]) != NULL;
+    t2 = seconds();
+    if(bsthits != hits) errx(1,"Trees disagree on lookups!");
+    printf("Pointer BST: insert %d %.0f ns/key, lookup %.2f Mops/s\n",n,(t1-t0)/n*1e9,lookups/(t2-t1)/1e6);
+    free_tree(root);
+
+    //Delete every other key and check scans skip the gaps.
+    for(i=0;i<n;i++){
+        if(keys[i] % 4 == 2 && !bp_delete(&tree,keys[i])) errx(1,"Delete of %d failed!",keys[i]);
+    }
+    if(tree.size != (n+1)/2) errx(1,"Wrong size after deletes!");
+    for(i=0;i<n;i++){
+        if((bp_search(&tree,2*i) != NULL) != (i % 2 == 0)) errx(1,"Key %d wrong after deletes!",2*i);
+    }
+    struct scan_check after = {0,4};
+    if(bp_scan(&tree,0,INT_MAX,check_visit,&after) != tree.size) errx(1,"Scan after deletes missed keys!");
+    printf("Deletes, lookups and scans check out (%ld keys left)\n",tree.size);
+
+    bp_free(&tree);
+    free(keys);
+    free(probes);
+    return 0;
+}
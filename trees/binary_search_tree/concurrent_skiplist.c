@@ -0,0 +1,667 @@
+/* Concurrent ordered int -> int map: a lazy skip list.
+ *
+ * Lookups and scans never take a lock or write to nodes; they just follow next pointers,
+ * so readers never block and scale with the number of threads. The one write a reader makes
+ * is publishing its epoch in its own cache-line-aligned slot (see below). Writers lock only
+ * the nodes around the key they change (Herlihy, Lev, Luchangco and Shavit's lazy skip
+ * list): a removal first marks the node as logically deleted, then unlinks it level by
+ * level, and readers treat marked or not yet fully linked nodes as absent.
+ *
+ * Unlinked nodes may still be in use by readers, so they are retired with epoch-based
+ * reclamation. Each thread announces the global epoch while it is inside an operation, and
+ * a retired node is freed only once the global epoch has moved on twice, at which point no
+ * reader can still hold it.
+ *
+ * main() runs a mixed get/put/remove workload across thread counts, against the
+ * binary_search_tree.c tree behind a single reader-writer lock. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <err.h>
+
+#define MAX_LEVEL 24
+#define MAX_THREADS 64
+#define RETIRE_BATCH 256 //Retired nodes a thread collects before trying to free some.
+
+typedef struct skipNode {
+    int key;
+    _Atomic int value;
+    int top_level;
+    atomic_bool marked; //Logically deleted.
+    atomic_bool fully_linked; //Linked at every level, so visible to readers.
+    atomic_flag lock; //Spinlock: held only for a few pointer writes.
+    struct skipNode *_Atomic next[]; //top_level + 1 entries.
+} skipNode;
+
+typedef struct skipList {
+    skipNode *head; //Sentinel before every key. Never compared by key.
+    skipNode *tail; //Sentinel after every key, so INT_MAX is an ordinary key.
+} skipList;
+
+/* ---- Epoch-based reclamation ---- */
+
+//One per thread, on its own cache line so that publishing an epoch does not disturb others.
+struct epoch_slot {
+    _Alignas(64) _Atomic unsigned long epoch; //0 while the thread is outside any operation.
+    atomic_bool in_use;
+};
+
+struct retired {
+    skipNode *node;
+    unsigned long epoch;
+};
+
+static _Atomic unsigned long global_epoch = 1;
+static struct epoch_slot epoch_slots[MAX_THREADS];
+static __thread int my_slot = -1;
+static __thread struct retired *limbo;
+static __thread int limbo_count, limbo_capacity;
+
+//Nodes retired by threads that have since finished, freed by whoever collects next.
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct retired *orphans;
+static int orphan_count, orphan_capacity;
+
+static inline void epoch_enter(void){
+
+    if(my_slot < 0){
+        int t;
+        for(t=0;t<MAX_THREADS;t++){
+            _Bool expected = 0;
+            if(atomic_compare_exchange_strong(&epoch_slots[t].in_use,&expected,1)) break;
+        }
+        if(t == MAX_THREADS) errx(1,"More than %d threads in the map at once!",MAX_THREADS);
+        my_slot = t;
+    }
+    atomic_store(&epoch_slots[my_slot].epoch,atomic_load(&global_epoch));
+}
+
+static inline void epoch_exit(void){
+    atomic_store_explicit(&epoch_slots[my_slot].epoch,0,memory_order_release);
+}
+
+static void free_node(skipNode *node){
+    free(node);
+}
+
+static inline void lock_node(skipNode *node){
+
+    while(atomic_flag_test_and_set_explicit(&node->lock,memory_order_acquire)) sched_yield();
+}
+
+static inline void unlock_node(skipNode *node){
+    atomic_flag_clear_explicit(&node->lock,memory_order_release);
+}
+
+//Frees entries of list retired at least two epochs before e, compacting the rest.
+static int free_old(struct retired *list, int count, unsigned long e){
+
+    int i, kept = 0;
+    for(i=0;i<count;i++){
+        if(list[i].epoch + 2 <= e) free_node(list[i].node);
+        else list[kept++] = list[i];
+    }
+    return kept;
+}
+
+//Moves the global epoch on if every active thread has seen it, then frees whatever was
+//retired two epochs ago.
+static void epoch_collect(void){
+
+    unsigned long e = atomic_load(&global_epoch);
+    int t, advance = 1;
+    for(t=0;t<MAX_THREADS;t++){
+        unsigned long seen = atomic_load(&epoch_slots[t].epoch);
+        if(seen != 0 && seen != e) advance = 0;
+    }
+    if(advance) atomic_compare_exchange_strong(&global_epoch,&e,e+1);
+    e = atomic_load(&global_epoch);
+    limbo_count = free_old(limbo,limbo_count,e);
+    if(pthread_mutex_trylock(&orphan_lock) == 0){
+        orphan_count = free_old(orphans,orphan_count,e);
+        pthread_mutex_unlock(&orphan_lock);
+    }
+}
+
+static void retire(skipNode *node){
+
+    if(limbo_count == limbo_capacity){
+        limbo_capacity = limbo_capacity ? 2*limbo_capacity : RETIRE_BATCH;
+        limbo = realloc(limbo,limbo_capacity*sizeof(struct retired));
+        if(limbo == NULL) errx(1,"Could not grow retire list!");
+    }
+    limbo[limbo_count].node = node;
+    limbo[limbo_count].epoch = atomic_load(&global_epoch);
+    limbo_count++;
+    if(limbo_count >= RETIRE_BATCH) epoch_collect();
+}
+
+//Called by a thread that is done with the map: frees what it can, hands the rest to the
+//orphan list and gives up its epoch slot.
+static void epoch_thread_done(void){
+
+    if(my_slot < 0) return;
+    epoch_collect();
+    pthread_mutex_lock(&orphan_lock);
+    if(orphan_count + limbo_count > orphan_capacity){
+        orphan_capacity = 2*(orphan_count + limbo_count);
+        orphans = realloc(orphans,orphan_capacity*sizeof(struct retired));
+        if(orphans == NULL) errx(1,"Could not grow orphan list!");
+    }
+    if(limbo_count > 0) memcpy(orphans+orphan_count,limbo,limbo_count*sizeof(struct retired));
+    orphan_count += limbo_count;
+    pthread_mutex_unlock(&orphan_lock);
+    free(limbo);
+    limbo = NULL;
+    limbo_count = limbo_capacity = 0;
+    atomic_store(&epoch_slots[my_slot].in_use,0);
+    my_slot = -1;
+}
+
+//Frees everything still waiting to be reclaimed. No thread may be inside the map.
+static void epoch_drain(void){
+
+    epoch_thread_done();
+    pthread_mutex_lock(&orphan_lock);
+    orphan_count = free_old(orphans,orphan_count,ULONG_MAX);
+    pthread_mutex_unlock(&orphan_lock);
+}
+
+/* ---- Skip list ---- */
+
+static skipNode* new_node(int key, int value, int top_level){
+
+    skipNode *node = malloc(sizeof(skipNode) + (top_level+1)*sizeof(skipNode *));
+    if(node == NULL) errx(1,"Could not allocate node!");
+    node->key = key;
+    atomic_init(&node->value,value);
+    node->top_level = top_level;
+    atomic_init(&node->marked,0);
+    atomic_init(&node->fully_linked,0);
+    atomic_flag_clear(&node->lock);
+    return node;
+}
+
+void skiplist_init(skipList *list){
+
+    int l;
+    list->head = new_node(INT_MIN,0,MAX_LEVEL-1);
+    list->tail = new_node(INT_MAX,0,MAX_LEVEL-1);
+    for(l=0;l<MAX_LEVEL;l++){
+        atomic_init(&list->head->next[l],list->tail);
+        atomic_init(&list->tail->next[l],NULL);
+    }
+    atomic_store(&list->head->fully_linked,1);
+    atomic_store(&list->tail->fully_linked,1);
+}
+
+//Geometric level with p = 1/2 from a per-thread xorshift generator.
+static int random_level(void){
+
+    static __thread uint64_t state;
+    if(state == 0) state = (uint64_t)(uintptr_t)&state * 0x9e3779b97f4a7c15ull | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    int level = __builtin_ctzll(state | (1ull << (MAX_LEVEL-1)));
+    return level;
+}
+
+//Whether node holds a key smaller than key. The tail is recognised by address, not by its
+//key, so that INT_MAX can be stored.
+static inline int before(const skipList *list, const skipNode *node, int key){
+    return node != list->tail && node->key < key;
+}
+
+static inline int holds(const skipList *list, const skipNode *node, int key){
+    return node != list->tail && node->key == key;
+}
+
+//Fills preds/succs with the nodes either side of key at every level. Returns the highest
+//level at which a node with key was found, or -1. Takes no locks.
+static int find(const skipList *list, int key, skipNode **preds, skipNode **succs){
+
+    int found = -1, l;
+    skipNode *pred = list->head;
+    for(l=MAX_LEVEL-1;l>=0;l--){
+        skipNode *curr = atomic_load(&pred->next[l]);
+        while(before(list,curr,key)){
+            pred = curr;
+            curr = atomic_load(&pred->next[l]);
+        }
+        if(found == -1 && holds(list,curr,key)) found = l;
+        preds[l] = pred;
+        succs[l] = curr;
+    }
+    return found;
+}
+
+//Looks up key. Never blocks.
+int skiplist_get(const skipList *list, int key, int *value){
+
+    int l, result = 0;
+    epoch_enter();
+    skipNode *pred = list->head, *curr = NULL;
+    for(l=MAX_LEVEL-1;l>=0;l--){
+        curr = atomic_load(&pred->next[l]);
+        while(before(list,curr,key)){
+            pred = curr;
+            curr = atomic_load(&pred->next[l]);
+        }
+        if(holds(list,curr,key)) break;
+    }
+    if(holds(list,curr,key) && atomic_load(&curr->fully_linked) && !atomic_load(&curr->marked)){
+        *value = atomic_load(&curr->value);
+        result = 1;
+    }
+    epoch_exit();
+    return result;
+}
+
+static void unlock_preds(skipNode **preds, int highest){
+
+    int l;
+    skipNode *prev = NULL;
+    for(l=0;l<=highest;l++){
+        if(preds[l] != prev) unlock_node(preds[l]);
+        prev = preds[l];
+    }
+}
+
+//Inserts key, or updates its value. Returns 1 if the key was new.
+int skiplist_put(skipList *list, int key, int value){
+
+    skipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    int top_level = random_level();
+    epoch_enter();
+    for(;;){
+        int found = find(list,key,preds,succs);
+        if(found != -1){
+            skipNode *node = succs[found];
+            if(!atomic_load(&node->marked)){
+                //Present (or about to be): update in place.
+                while(!atomic_load(&node->fully_linked)) sched_yield();
+                atomic_store(&node->value,value);
+                epoch_exit();
+                return 0;
+            }
+            continue; //Being removed; retry once it is gone.
+        }
+        //Lock the predecessors bottom-up and check nothing changed around them.
+        int highest = -1, valid = 1, l;
+        skipNode *prev = NULL;
+        for(l=0;valid && l<=top_level;l++){
+            if(preds[l] != prev){
+                lock_node(preds[l]);
+                prev = preds[l];
+            }
+            highest = l;
+            valid = !atomic_load(&preds[l]->marked) && !atomic_load(&succs[l]->marked) &&
+                atomic_load(&preds[l]->next[l]) == succs[l];
+        }
+        if(!valid){
+            unlock_preds(preds,highest);
+            continue;
+        }
+        skipNode *node = new_node(key,value,top_level);
+        for(l=0;l<=top_level;l++) atomic_init(&node->next[l],succs[l]);
+        for(l=0;l<=top_level;l++) atomic_store(&preds[l]->next[l],node);
+        atomic_store(&node->fully_linked,1);
+        unlock_preds(preds,highest);
+        epoch_exit();
+        return 1;
+    }
+}
+
+//Removes key. Returns 1 if it was present.
+int skiplist_remove(skipList *list, int key){
+
+    skipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    skipNode *victim = NULL;
+    int marked = 0, top_level = -1;
+    epoch_enter();
+    for(;;){
+        int found = find(list,key,preds,succs);
+        if(!marked){
+            if(found == -1) break;
+            victim = succs[found];
+            //Only remove fully linked nodes, found at their top level (so not mid-insert).
+            if(!atomic_load(&victim->fully_linked) || victim->top_level != found || atomic_load(&victim->marked)){
+                if(atomic_load(&victim->marked)) break;
+                continue;
+            }
+            top_level = victim->top_level;
+            lock_node(victim);
+            if(atomic_load(&victim->marked)){
+                unlock_node(victim);
+                break;
+            }
+            atomic_store(&victim->marked,1);
+            marked = 1;
+        }
+        int highest = -1, valid = 1, l;
+        skipNode *prev = NULL;
+        for(l=0;valid && l<=top_level;l++){
+            if(preds[l] != prev){
+                lock_node(preds[l]);
+                prev = preds[l];
+            }
+            highest = l;
+            valid = !atomic_load(&preds[l]->marked) && atomic_load(&preds[l]->next[l]) == victim;
+        }
+        if(!valid){
+            unlock_preds(preds,highest);
+            continue;
+        }
+        for(l=top_level;l>=0;l--) atomic_store(&preds[l]->next[l],atomic_load(&victim->next[l]));
+        unlock_node(victim);
+        unlock_preds(preds,highest);
+        retire(victim);
+        epoch_exit();
+        return 1;
+    }
+    epoch_exit();
+    return 0;
+}
+
+//Calls visit on every key in [lo,hi] in order without locking. Concurrent updates may or
+//may not be seen, but every key present for the whole scan is visited exactly once.
+long skiplist_scan(const skipList *list, int lo, int hi, void (*visit)(int key, int value, void *arg), void *arg){
+
+    skipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    long count = 0;
+    epoch_enter();
+    find(list,lo,preds,succs);
+    skipNode *curr = succs[0];
+    while(curr != list->tail && curr->key <= hi){
+        if(atomic_load(&curr->fully_linked) && !atomic_load(&curr->marked)){
+            visit(curr->key,atomic_load(&curr->value),arg);
+            count++;
+        }
+        curr = atomic_load(&curr->next[0]);
+    }
+    epoch_exit();
+    return count;
+}
+
+//Frees the whole list, and anything retired but not yet reclaimed. No other thread may be
+//using it.
+void skiplist_free(skipList *list){
+
+    epoch_drain();
+    skipNode *node = list->head;
+    while(node != NULL){
+        skipNode *next = atomic_load(&node->next[0]);
+        free_node(node);
+        node = next;
+    }
+}
+
+/* ---- The binary_search_tree.c tree behind one reader-writer lock, as a baseline. ---- */
+
+typedef struct treeNode{
+    int key;
+    int value;
+    struct treeNode *left;
+    struct treeNode *right;
+} treeNode;
+
+typedef struct lockedTree {
+    pthread_rwlock_t lock;
+    treeNode *root;
+} lockedTree;
+
+treeNode* search_tree(treeNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+treeNode *insert(treeNode *Root, int key, int value){
+
+    treeNode *temp = malloc(sizeof(treeNode));
+    temp->key = key;
+    temp->value = value;
+    temp->left = temp->right = NULL;
+    if(Root == NULL) return temp;
+    treeNode *node = Root;
+    for(;;){
+        treeNode **next = key > node->key ? &node->right : &node->left;
+        if(*next == NULL){
+            *next = temp;
+            return Root;
+        }
+        node = *next;
+    }
+}
+
+treeNode* delete(treeNode *Root, int key){
+
+    if(Root == NULL) return Root;
+    if(key > Root->key){
+        Root->right = delete(Root->right,key);
+    }
+    else if(key < Root->key){
+        Root->left = delete(Root->left,key);
+    }
+    else {
+        if(Root->left == NULL || Root->right == NULL){
+            treeNode *temp = Root->left ? Root->left : Root->right;
+            free(Root);
+            return temp;
+        }
+        treeNode *temp = Root->right;
+        while(temp->left != NULL) temp = temp->left;
+        Root->key = temp->key;
+        Root->value = temp->value;
+        Root->right = delete(Root->right,temp->key);
+    }
+    return Root;
+}
+
+void free_tree(treeNode *Root){
+
+    while(Root != NULL){
+        if(Root->left != NULL){
+            treeNode *l = Root->left;
+            Root->left = l->right;
+            l->right = Root;
+            Root = l;
+        }
+        else{
+            treeNode *next = Root->right;
+            free(Root);
+            Root = next;
+        }
+    }
+}
+
+/* ---- Benchmark ---- */
+
+//Encapsulates all data for each thread.
+struct thread_data {
+    pthread_t thread_id;
+    int thread_index;
+    skipList *list; //One of list or tree.
+    lockedTree *tree;
+    int keyspace;
+    int ops;
+    int read_percent;
+    long hits;
+};
+
+//Mixed workload: read_percent gets, the rest split evenly between puts and removes.
+void *workload_worker(void *threadArg){
+
+    struct thread_data *data = (struct thread_data *) threadArg;
+    unsigned int seed = 12345u + data->thread_index*7919u;
+    int i, value;
+
+    for(i=0;i<data->ops;i++){
+        int key = rand_r(&seed) % data->keyspace;
+        int op = rand_r(&seed) % 100;
+        if(data->list != NULL){
+            if(op < data->read_percent) data->hits += skiplist_get(data->list,key,&value);
+            else if(op % 2) skiplist_put(data->list,key,i);
+            else skiplist_remove(data->list,key);
+        }
+        else if(op < data->read_percent){
+            pthread_rwlock_rdlock(&data->tree->lock);
+            data->hits += search_tree(data->tree->root,key) != NULL;
+            pthread_rwlock_unlock(&data->tree->lock);
+        }
+        else{
+            pthread_rwlock_wrlock(&data->tree->lock);
+            treeNode *node = search_tree(data->tree->root,key);
+            if(op % 2){
+                if(node) node->value = i;
+                else data->tree->root = insert(data->tree->root,key,i);
+            }
+            else if(node){
+                data->tree->root = delete(data->tree->root,key);
+            }
+            pthread_rwlock_unlock(&data->tree->lock);
+        }
+    }
+    if(data->list != NULL) epoch_thread_done();
+    return NULL;
+}
+
+//Each thread owns the keys congruent to its index: puts them all, removes every other one.
+void *ownership_worker(void *threadArg){
+
+    struct thread_data *data = (struct thread_data *) threadArg;
+    int key;
+    for(key=data->thread_index;key<data->keyspace;key+=MAX_THREADS){
+        if(!skiplist_put(data->list,key,key)) errx(1,"Put of new key %d reported existing!",key);
+    }
+    for(key=data->thread_index;key<data->keyspace;key+=2*MAX_THREADS){
+        if(!skiplist_remove(data->list,key)) errx(1,"Remove of %d failed!",key);
+    }
+    epoch_thread_done();
+    return NULL;
+}
+
+struct scan_state {
+    long last;
+    long count;
+};
+
+static void scan_visit(int key, int value, void *arg){
+
+    struct scan_state *s = arg;
+    if(key <= s->last) errx(1,"Scan out of order at %d!",key);
+    if(value != key) errx(1,"Wrong value for %d!",key);
+    s->last = key;
+    s->count++;
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[]){
+
+    int max_threads = argc > 1 ? strtol(argv[1],NULL,10) : 8;
+    int keyspace = argc > 2 ? strtol(argv[2],NULL,10) : 1000000;
+    int ops = 2000000; //Total per run, shared between threads.
+    int read_percent = 90;
+    int t, i, threads;
+
+    if(max_threads < 1 || max_threads > MAX_THREADS/2 || keyspace < 2*MAX_THREADS)
+        errx(1,"Usage: %s [threads <= %d] [keys]",argv[0],MAX_THREADS/2);
+    struct thread_data *data = malloc(max_threads*sizeof(struct thread_data));
+
+    //Correctness: concurrent puts and removes on disjoint keys, then a full scan.
+    skipList list;
+    skiplist_init(&list);
+    for(t=0;t<max_threads;t++){
+        data[t].thread_index = t;
+        data[t].list = &list;
+        data[t].keyspace = keyspace;
+    }
+    //Threads own residues t mod MAX_THREADS; one thread covers all the residues left over.
+    for(t=0;t<max_threads;t++){
+        if(pthread_create(&data[t].thread_id,NULL,ownership_worker,&data[t])) errx(1,"Thread creation failed.");
+    }
+    for(t=0;t<max_threads;t++) pthread_join(data[t].thread_id,NULL);
+    for(t=max_threads;t<MAX_THREADS;t++){
+        data[0].thread_index = t;
+        ownership_worker(&data[0]);
+    }
+    struct scan_state state = {LONG_MIN,0};
+    long expected = 0;
+    for(i=0;i<keyspace;i++) expected += (i % (2*MAX_THREADS)) >= MAX_THREADS;
+    if(skiplist_scan(&list,INT_MIN+1,INT_MAX-1,scan_visit,&state) != expected || state.count != expected)
+        errx(1,"Scan found %ld keys, expected %ld!",state.count,expected);
+    for(i=0;i<keyspace;i++){
+        int value, present = skiplist_get(&list,i,&value);
+        if(present != ((i % (2*MAX_THREADS)) >= MAX_THREADS)) errx(1,"Key %d wrong after concurrent updates!",i);
+    }
+    printf("Concurrent puts/removes on disjoint keys check out (%ld keys)\n",expected);
+
+    //The extremes of int are ordinary keys, not the sentinels.
+    int value;
+    if(skiplist_get(&list,INT_MAX,&value) || skiplist_get(&list,INT_MIN,&value)) errx(1,"Found extreme keys before inserting them!");
+    if(!skiplist_put(&list,INT_MAX,INT_MAX) || !skiplist_put(&list,INT_MIN,INT_MIN)) errx(1,"Extreme keys reported as present!");
+    if(!skiplist_get(&list,INT_MAX,&value) || value != INT_MAX || !skiplist_get(&list,INT_MIN,&value) || value != INT_MIN)
+        errx(1,"Extreme keys not found after insert!");
+    state.last = LONG_MIN;
+    state.count = 0;
+    if(skiplist_scan(&list,INT_MIN,INT_MAX,scan_visit,&state) != expected+2) errx(1,"Full-range scan missed extreme keys!");
+    if(!skiplist_remove(&list,INT_MAX) || !skiplist_remove(&list,INT_MIN) || skiplist_remove(&list,INT_MAX))
+        errx(1,"Removing extreme keys failed!");
+    if(skiplist_get(&list,INT_MAX,&value) || skiplist_get(&list,INT_MIN,&value) || !skiplist_get(&list,MAX_THREADS,&value))
+        errx(1,"List wrong after removing extreme keys!");
+    skiplist_free(&list);
+
+    //Throughput on a %d%% read workload, with the map prefilled to half the key space.
+    printf("%d%% get, %d%% put, %d%% remove over %d keys:\n",read_percent,(100-read_percent)/2,(100-read_percent)/2,keyspace);
+    for(threads=1;threads<=max_threads;threads*=2){
+        int kind;
+        for(kind=0;kind<2;kind++){
+            lockedTree tree;
+            skiplist_init(&list);
+            pthread_rwlock_init(&tree.lock,NULL);
+            tree.root = NULL;
+            unsigned int seed = 99;
+            for(i=0;i<keyspace/2;i++){
+                int key = rand_r(&seed) % keyspace;
+                if(kind == 0) skiplist_put(&list,key,key);
+                else if(search_tree(tree.root,key) == NULL) tree.root = insert(tree.root,key,key);
+            }
+            double t0 = seconds();
+            for(t=0;t<threads;t++){
+                data[t].thread_index = t;
+                data[t].list = kind == 0 ? &list : NULL;
+                data[t].tree = &tree;
+                data[t].keyspace = keyspace;
+                data[t].ops = ops/threads;
+                data[t].read_percent = read_percent;
+                data[t].hits = 0;
+                if(pthread_create(&data[t].thread_id,NULL,workload_worker,&data[t])) errx(1,"Thread creation failed.");
+            }
+            for(t=0;t<threads;t++) pthread_join(data[t].thread_id,NULL);
+            double t1 = seconds();
+            printf("  %2d threads, %-18s %.2f Mops/s\n",threads,kind == 0 ? "lazy skip list:" : "rwlock BST:",ops/(t1-t0)/1e6);
+            skiplist_free(&list);
+            free_tree(tree.root);
+            pthread_rwlock_destroy(&tree.lock);
+        }
+    }
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,280 @@
+/* Static search index in Eytzinger (breadth-first) order.
+ *
+ * A sorted key/value array is laid out as an implicit complete binary tree: the root is at
+ * index 1 and the children of k are at 2k and 2k+1, so no pointers are stored (8 bytes per
+ * entry instead of the BST's 24) and the top levels of every search share the same few
+ * cache lines. Search is branch-free, k = 2k + (key[k] < x), and prefetches the cache line
+ * holding the 16 descendants four levels down, so memory latency overlaps with the compares.
+ * The batched lookup walks a group of queries down the tree in lockstep, so each level's
+ * loads are independent and can all be in flight at once. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#define CACHE_LINE 64
+#define PREFETCH_LEVELS 4 //16 ints = one cache line of descendants.
+#define BATCH 16
+
+typedef struct eytzinger {
+    int n;
+    int levels; //Complete levels: every query takes at least this many steps.
+    int *keys; //1-based; keys[0] unused.
+    int *values;
+} eytzinger;
+
+//Fills the tree by an in-order walk, which visits slots in sorted order. Returns the next
+//sorted index to use.
+static int fill(eytzinger *index, const int *keys, const int *values, int i, int k){
+
+    //Explicit stack: go left as far as possible, place, then go right.
+    int stack[64];
+    int top = 0;
+    while(k <= index->n || top > 0){
+        if(k <= index->n){
+            stack[top++] = k;
+            k = 2*k;
+        }
+        else{
+            k = stack[--top];
+            index->keys[k] = keys[i];
+            index->values[k] = values[i];
+            i++;
+            k = 2*k + 1;
+        }
+    }
+    return i;
+}
+
+//Builds an index from n keys sorted ascending with their values.
+void eytzinger_build(eytzinger *index, const int *keys, const int *values, int n){
+
+    int i;
+    for(i=1;i<n;i++){
+        if(keys[i] < keys[i-1]) errx(1,"Keys are not sorted at %d!",i);
+    }
+    index->n = n;
+    index->levels = 0;
+    while((2L << index->levels) - 1 <= n) index->levels++;
+    //Prefetches near the bottom point past the end, which is harmless: prefetches never fault.
+    size_t bytes = ((size_t)(n+1)*sizeof(int) + CACHE_LINE-1) / CACHE_LINE * CACHE_LINE;
+    index->keys = aligned_alloc(CACHE_LINE,bytes);
+    index->values = aligned_alloc(CACHE_LINE,bytes);
+    if(index->keys == NULL || index->values == NULL) errx(1,"Could not allocate index!");
+    fill(index,keys,values,0,1);
+}
+
+void eytzinger_free(eytzinger *index){
+
+    free(index->keys);
+    free(index->values);
+}
+
+//Turns the final position of a descent into the slot of the lower bound, or 0 if every
+//key is less than x. Going right appends a 1 bit, so strip the trailing ones and one more.
+static inline int lower_bound_slot(unsigned int k){
+    return k >> __builtin_ffs(~k);
+}
+
+//Returns a pointer to key's value, or NULL if it is not present.
+int* eytzinger_search(const eytzinger *index, int key){
+
+    const int *keys = index->keys;
+    unsigned int k = 1;
+    while(k <= (unsigned int)index->n){
+        __builtin_prefetch(keys + (k << PREFETCH_LEVELS));
+        k = 2*k + (keys[k] < key);
+    }
+    k = lower_bound_slot(k);
+    return (k != 0 && keys[k] == key) ? &index->values[k] : NULL;
+}
+
+//Looks up count keys, writing each value (or missing) to out. Queries go down the tree
+//BATCH at a time in lockstep: the loads of one level are independent of each other.
+//Returns how many keys were found.
+int eytzinger_search_batch(const eytzinger *index, const int *queries, int count, int *out, int missing){
+
+    const int *keys = index->keys;
+    unsigned int n = index->n;
+    int found = 0, b, j, level;
+
+    for(b=0;b<count;b+=BATCH){
+        unsigned int k[BATCH];
+        int m = count - b < BATCH ? count - b : BATCH;
+        for(j=0;j<m;j++) k[j] = 1;
+        for(level=0;level<index->levels;level++){
+            for(j=0;j<m;j++){
+                __builtin_prefetch(keys + (k[j] << PREFETCH_LEVELS));
+                k[j] = 2*k[j] + (keys[k[j]] < queries[b+j]);
+            }
+        }
+        //At most one more, partial, level.
+        for(j=0;j<m;j++){
+            if(k[j] <= n) k[j] = 2*k[j] + (keys[k[j]] < queries[b+j]);
+            unsigned int slot = lower_bound_slot(k[j]);
+            if(slot != 0 && keys[slot] == queries[b+j]){
+                out[b+j] = index->values[slot];
+                found++;
+            }
+            else{
+                out[b+j] = missing;
+            }
+        }
+    }
+    return found;
+}
+
+//Plain binary search on the sorted array, for comparison.
+static int binary_search(const int *keys, int n, int key){
+
+    int lo = 0, hi = n;
+    while(lo < hi){
+        int mid = lo + (hi-lo)/2;
+        if(keys[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < n && keys[lo] == key) ? lo : -1;
+}
+
+/* Pointer-based tree from binary_search_tree.c (iterative insert/search), for comparison. */
+typedef struct treeNode{
+    int key;
+    int value;
+    struct treeNode *left;
+    struct treeNode *right;
+} treeNode;
+
+treeNode *insert(treeNode *Root, int key, int value){
+
+    treeNode *temp = malloc(sizeof(treeNode));
+    temp->key = key;
+    temp->value = value;
+    temp->left = temp->right = NULL;
+    if(Root == NULL) return temp;
+    treeNode *node = Root;
+    for(;;){
+        treeNode **next = key > node->key ? &node->right : &node->left;
+        if(*next == NULL){
+            *next = temp;
+            return Root;
+        }
+        node = *next;
+    }
+}
+
+treeNode* search_tree(treeNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+void free_tree(treeNode *Root){
+
+    while(Root != NULL){
+        if(Root->left != NULL){
+            treeNode *l = Root->left;
+            Root->left = l->right;
+            l->right = Root;
+            Root = l;
+        }
+        else{
+            treeNode *next = Root->right;
+            free(Root);
+            Root = next;
+        }
+    }
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[]){
+
+    int n = argc > 1 ? strtol(argv[1],NULL,10) : 8000000;
+    int lookups = 4000000;
+    int i;
+
+    if(n < 1) errx(1,"Usage: %s [keys]",argv[0]);
+    //Sorted keys 3i (values i); probes hit about one time in three.
+    int *keys = malloc((size_t)n*sizeof(int));
+    int *values = malloc((size_t)n*sizeof(int));
+    int *queries = malloc((size_t)lookups*sizeof(int));
+    int *out = malloc((size_t)lookups*sizeof(int));
+    srand(1);
+    for(i=0;i<n;i++){
+        keys[i] = 3*i;
+        values[i] = i;
+    }
+    for(i=0;i<lookups;i++) queries[i] = (int)(((long)rand()*RAND_MAX + rand()) % (3L*n + 2)) - 1;
+
+    eytzinger index;
+    double t0 = seconds();
+    eytzinger_build(&index,keys,values,n);
+    double t1 = seconds();
+    printf("Built Eytzinger index of %d keys in %f s\n",n,t1-t0);
+
+    //Single lookups, batched lookups and binary search must all agree.
+    long hits = 0, bhits = 0;
+    for(i=0;i<lookups;i++){
+        int *v = eytzinger_search(&index,queries[i]);
+        int expect = queries[i] >= 0 && queries[i] < 3*n && queries[i] % 3 == 0 ? queries[i]/3 : -1;
+        if((v ? *v : -1) != expect) errx(1,"Lookup of %d wrong!",queries[i]);
+        hits += v != NULL;
+    }
+    int found = eytzinger_search_batch(&index,queries,lookups,out,-1);
+    for(i=0;i<lookups;i++){
+        int b = binary_search(keys,n,queries[i]);
+        if(out[i] != (b < 0 ? -1 : values[b])) errx(1,"Batched lookup of %d wrong!",queries[i]);
+        bhits += b >= 0;
+    }
+    if(found != hits || bhits != hits) errx(1,"Hit counts disagree!");
+
+    //Time each method on its own, without the checks above.
+    volatile long sink = 0;
+    t0 = seconds();
+    for(i=0;i<lookups;i++){
+        int *v = eytzinger_search(&index,queries[i]);
+        sink += v ? *v : -1;
+    }
+    t1 = seconds();
+    sink += eytzinger_search_batch(&index,queries,lookups,out,-1);
+    double t2 = seconds();
+    for(i=0;i<lookups;i++) sink += binary_search(keys,n,queries[i]);
+    double t3 = seconds();
+    printf("Eytzinger: %.2f Mops/s single, %.2f Mops/s batched; binary search %.2f Mops/s\n",
+           lookups/(t1-t0)/1e6,lookups/(t2-t1)/1e6,lookups/(t3-t2)/1e6);
+
+    //Pointer BST from random insertion order.
+    int *order = malloc((size_t)n*sizeof(int));
+    for(i=0;i<n;i++) order[i] = i;
+    for(i=n-1;i>0;i--){
+        int j = (int)(((long)rand()*RAND_MAX + rand()) % (i+1));
+        int t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+    treeNode *root = NULL;
+    for(i=0;i<n;i++) root = insert(root,keys[order[i]],values[order[i]]);
+    long thits = 0;
+    t0 = seconds();
+    for(i=0;i<lookups;i++) thits += search_tree(root,queries[i]) != NULL;
+    t1 = seconds();
+    if(thits != hits) errx(1,"BST disagrees!");
+    printf("Pointer BST: %.2f Mops/s, %zu bytes per key against %zu\n",
+           lookups/(t1-t0)/1e6,sizeof(treeNode),2*sizeof(int));
+    free_tree(root);
+    free(order);
+
+    eytzinger_free(&index);
+    free(keys);
+    free(values);
+    free(queries);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,358 @@
+/* Order-statistic tree: the AVL tree from avl_tree.c with subtree sizes.
+ *
+ * Every node also stores how many nodes are in its subtree, kept up to date by the same
+ * rotations and path updates as the heights. That gives select (the k-th smallest key) and
+ * rank (how many keys are smaller) in O(log n), by walking down and skipping left subtrees
+ * whole. Range scans use an iterator holding an explicit stack of the path to the current
+ * node, so iterating over k keys between a and b costs O(log n + k) with no recursion. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <err.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MAX_HEIGHT 64 //AVL height bound for any n that fits in memory.
+
+//Our tree node datatype
+typedef struct treeNode{
+    int key;
+    int value;
+    int height; //Height of this subtree, 1 for a leaf.
+    int size; //Nodes in this subtree, including this one.
+    struct treeNode *left;
+    struct treeNode *right;
+} treeNode;
+
+static inline int height(treeNode *node){
+    return node ? node->height : 0;
+}
+
+static inline int size(treeNode *node){
+    return node ? node->size : 0;
+}
+
+static inline void update(treeNode *node){
+    node->height = 1 + MAX(height(node->left),height(node->right));
+    node->size = 1 + size(node->left) + size(node->right);
+}
+
+static treeNode* rotate_right(treeNode *Root){
+
+    treeNode *L = Root->left;
+    Root->left = L->right;
+    L->right = Root;
+    update(Root);
+    update(L);
+    return L;
+}
+
+static treeNode* rotate_left(treeNode *Root){
+
+    treeNode *R = Root->right;
+    Root->right = R->left;
+    R->left = Root;
+    update(Root);
+    update(R);
+    return R;
+}
+
+static treeNode* rebalance(treeNode *Root){
+
+    update(Root);
+    int balance = height(Root->left) - height(Root->right);
+    if(balance > 1){
+        if(height(Root->left->left) < height(Root->left->right)) Root->left = rotate_left(Root->left);
+        return rotate_right(Root);
+    }
+    if(balance < -1){
+        if(height(Root->right->right) < height(Root->right->left)) Root->right = rotate_right(Root->right);
+        return rotate_left(Root);
+    }
+    return Root;
+}
+
+treeNode* search_tree(treeNode *node, int key){
+
+    while(node != NULL && node->key != key){
+        node = key > node->key ? node->right : node->left;
+    }
+    return node;
+}
+
+treeNode *insert(treeNode *Root,int key, int value){
+    if(Root==NULL){
+        treeNode *temp = (treeNode*)malloc(sizeof(treeNode));
+        temp->key=key;
+        temp->value=value;
+        temp->height=1;
+        temp->size=1;
+        temp->left = temp->right = NULL;
+        return temp;
+    }
+    else if(key > Root->key){
+        Root->right = insert(Root->right,key,value);
+    }
+    else if(key < Root->key){
+        Root->left = insert(Root->left,key,value);
+    }
+    else{
+        Root->value = value;
+        return Root;
+    }
+    return rebalance(Root);
+
+}
+
+treeNode* minValueNode(treeNode *Root){
+
+    treeNode *current = Root;
+    while(current->left != NULL){
+        current = current->left;
+    }
+    return current;
+}
+
+treeNode* delete(treeNode *Root,int key){
+
+    if(Root == NULL) return Root;
+    
+    if(key > Root->key){
+        Root->right = delete(Root->right,key);
+    }
+    else if(key < Root->key){
+        Root->left = delete(Root->left,key);
+    }
+    else {
+        if(Root->left == NULL){
+            treeNode *temp = Root->right;
+            free(Root);
+            return temp;
+        }
+        else if(Root->right == NULL){
+            treeNode *temp = Root->left;
+            free(Root);
+            return temp;
+        }
+        else {
+            treeNode *temp = minValueNode(Root->right);
+            Root->key = temp->key;
+            Root->value = temp->value; 
+            Root->right = delete(Root->right,temp->key);
+        }
+    }
+    return rebalance(Root);
+
+}
+
+//The node holding the k-th smallest key (k from 0), or NULL if k is out of range.
+treeNode* select_kth(treeNode *node, int k){
+
+    if(k < 0 || k >= size(node)) return NULL;
+    while(node != NULL){
+        int left = size(node->left);
+        if(k < left){
+            node = node->left;
+        }
+        else if(k == left){
+            return node;
+        }
+        else{
+            k -= left + 1;
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+//Number of keys less than key.
+int rank(treeNode *node, int key){
+
+    int r = 0;
+    while(node != NULL){
+        if(key > node->key){
+            r += size(node->left) + 1;
+            node = node->right;
+        }
+        else{
+            node = node->left;
+        }
+    }
+    return r;
+}
+
+//In-order iterator over [lo,hi]. stack holds the ancestors whose keys are still to come.
+typedef struct rangeIterator {
+    treeNode *stack[MAX_HEIGHT];
+    int top;
+    int hi;
+} rangeIterator;
+
+//Positions the iterator at the first key >= lo.
+void range_begin(rangeIterator *it, treeNode *Root, int lo, int hi){
+
+    it->top = 0;
+    it->hi = hi;
+    while(Root != NULL){
+        if(Root->key >= lo){
+            it->stack[it->top++] = Root;
+            Root = Root->left;
+        }
+        else{
+            Root = Root->right;
+        }
+    }
+}
+
+//Returns the next node in the range, or NULL when done.
+treeNode* range_next(rangeIterator *it){
+
+    if(it->top == 0) return NULL;
+    treeNode *node = it->stack[--it->top];
+    if(node->key > it->hi){
+        it->top = 0;
+        return NULL;
+    }
+    treeNode *next = node->right;
+    while(next != NULL){
+        it->stack[it->top++] = next;
+        next = next->left;
+    }
+    return node;
+}
+
+void free_tree(treeNode *Root){
+
+    if(Root == NULL) return;
+    free_tree(Root->left);
+    free_tree(Root->right);
+    free(Root);
+}
+
+//Checks heights, sizes, balance and ordering. Returns the subtree size.
+static int check_tree(treeNode *node, long lo, long hi){
+
+    if(node == NULL) return 0;
+    if(node->key < lo || node->key > hi) errx(1,"Key %d out of order!",node->key);
+    int l = check_tree(node->left,lo,(long)node->key-1);
+    int r = check_tree(node->right,(long)node->key+1,hi);
+    int balance = height(node->left) - height(node->right);
+    if(node->size != l + r + 1) errx(1,"Stale size at key %d!",node->key);
+    if(node->height != 1 + MAX(height(node->left),height(node->right)) || balance > 1 || balance < -1)
+        errx(1,"Bad height or balance at key %d!",node->key);
+    return l + r + 1;
+}
+
+//Full in-order walk to the k-th key: what a percentile query costs without sizes.
+static treeNode* walk_kth(treeNode *node, int *k){
+
+    if(node == NULL) return NULL;
+    treeNode *found = walk_kth(node->left,k);
+    if(found != NULL) return found;
+    if((*k)-- == 0) return node;
+    return walk_kth(node->right,k);
+}
+
+static double seconds(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[]){
+
+    int n = argc > 1 ? strtol(argv[1],NULL,10) : 1000000;
+    int queries = 100000, walks = 20;
+    int i, q;
+
+    if(n < 4) errx(1,"Usage: %s [keys]",argv[0]);
+    //Keys 5i inserted in random order; after deleting every fourth, present[] says which remain.
+    int *order = malloc((size_t)n*sizeof(int));
+    char *present = malloc(n);
+    int *sorted = malloc((size_t)n*sizeof(int));
+    srand(1);
+    for(i=0;i<n;i++) order[i] = i;
+    for(i=n-1;i>0;i--){
+        int j = (int)(((long)rand()*RAND_MAX + rand()) % (i+1));
+        int t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+    treeNode *root = NULL;
+    double t0 = seconds();
+    for(i=0;i<n;i++) root = insert(root,5*order[i],order[i]);
+    for(i=0;i<n;i++) present[i] = 1;
+    for(i=0;i<n;i+=4){
+        root = delete(root,5*order[i]);
+        present[order[i]] = 0;
+    }
+    double t1 = seconds();
+    int m = 0;
+    for(i=0;i<n;i++){
+        if(present[i]) sorted[m++] = 5*i;
+    }
+    if(check_tree(root,0,5L*n) != m) errx(1,"Tree size is wrong!");
+    printf("%d inserts and %d deletes in %f s, %d keys left\n",n,(n+3)/4,t1-t0,m);
+
+    //select and rank against the sorted keys.
+    for(i=0;i<m;i++){
+        treeNode *node = select_kth(root,i);
+        if(node == NULL || node->key != sorted[i]) errx(1,"select(%d) is wrong!",i);
+        if(rank(root,sorted[i]) != i || rank(root,sorted[i]+1) != i+1) errx(1,"rank(%d) is wrong!",sorted[i]);
+    }
+    if(select_kth(root,m) != NULL || select_kth(root,-1) != NULL) errx(1,"select out of range!");
+
+    //Percentiles: select against a full in-order walk.
+    long sum = 0;
+    t0 = seconds();
+    for(q=0;q<queries;q++) sum += select_kth(root,(int)((long)m*(q % 100)/100))->key;
+    t1 = seconds();
+    long expect_sum = 0;
+    for(q=0;q<queries;q++) expect_sum += sorted[(long)m*(q % 100)/100];
+    if(sum != expect_sum) errx(1,"Percentile queries are wrong!");
+    double t2 = seconds();
+    for(q=0;q<walks;q++){
+        int k = (int)((long)m*(q % 100)/100), kk = k;
+        if(walk_kth(root,&kk)->key != select_kth(root,k)->key) errx(1,"Walk and select disagree!");
+    }
+    double t3 = seconds();
+    printf("Percentile query: select %.0f ns, in-order walk %.0f us\n",(t1-t0)/queries*1e9,(t3-t2)/walks*1e6);
+
+    //Range iteration against the sorted keys, then timed on its own over the same ranges.
+    int *lows = malloc(queries*sizeof(int));
+    int span = 500;
+    long visited = 0;
+    for(q=0;q<queries;q++){
+        int lo = lows[q] = (int)(((long)rand()*RAND_MAX + rand()) % (5L*n));
+        int hi = lo + span;
+        rangeIterator it;
+        treeNode *node;
+        int expect = rank(root,lo);
+        range_begin(&it,root,lo,hi);
+        while((node = range_next(&it)) != NULL){
+            if(node->key != sorted[expect]) errx(1,"Range [%d,%d] returned %d, expected %d!",lo,hi,node->key,sorted[expect]);
+            expect++;
+            visited++;
+        }
+        if(expect != rank(root,hi+1)) errx(1,"Range [%d,%d] stopped early!",lo,hi);
+    }
+    rangeIterator it;
+    range_begin(&it,root,-1,5*n);
+    for(i=0;range_next(&it) != NULL;i++);
+    if(i != m) errx(1,"Full range visited %d of %d keys!",i,m);
+    volatile long sink = 0;
+    t0 = seconds();
+    for(q=0;q<queries;q++){
+        treeNode *node;
+        range_begin(&it,root,lows[q],lows[q]+span);
+        while((node = range_next(&it)) != NULL) sink += node->value;
+    }
+    t1 = seconds();
+    printf("Range scans: %.0f ns per range of ~%.0f keys\n",(t1-t0)/queries*1e9,(double)visited/queries);
+    free(lows);
+
+    free_tree(root);
+    free(order);
+    free(present);
+    free(sorted);
+    return(0);
+}
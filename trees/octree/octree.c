@@ -0,0 +1,772 @@
+/* Octrees for volumes and point clouds.
+ *
+ * Volumes: as with the quadtree in trees/quad_tree, every node is a strided view (base,
+ * offset, row and plane stride, size) into the original voxel grid, so leaves are voxel
+ * blocks and nothing is copied. The tree is either split uniformly to a fixed depth, or
+ * adaptively wherever a block's max - min exceeds a threshold. Nodes keep min/max so box
+ * queries take whole subtrees from their statistics.
+ *
+ * Point clouds: leaves hold up to BUCKET_SIZE points as a range of an index array that is
+ * partitioned in place, so the cloud itself is never copied or reordered. Points are read
+ * through a pointCloud, which applies a rotation (from a quaternion, see maths/quaternions)
+ * and translation on the fly, so a rotated cloud is indexed in its rotated position without
+ * being transformed into a new array. Supports box and view-frustum queries.
+ *
+ * Both builds hand the eight octants of the root to separate threads. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+
+#define MIN_BLOCK 8 //Smallest voxel block side.
+#define BUCKET_SIZE 32
+#define MAX_DEPTH 21
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+//Our quaternion datatype, as in maths/quaternions/quaternion.c.
+typedef struct quaternion {
+
+  double real;
+  double i;
+  double j;
+  double k;
+} quaternion;
+
+quaternion create_quaternion(double real, double i, double j, double k){
+
+  quaternion result;
+  result.real = real;
+  result.i = i;
+  result.j = j;
+  result.k = k;
+  return result;
+
+}
+
+//Unit quaternion rotating by angle about axis.
+quaternion axis_angle_quaternion(double x, double y, double z, double angle){
+
+  double norm = sqrt(x*x + y*y + z*z);
+  double s = sin(angle/2)/norm;
+  return create_quaternion(cos(angle/2),x*s,y*s,z*s);
+
+}
+
+/* ---- Volumes ---- */
+
+typedef struct volumeNode {
+
+  double *grid; //Base pointer of the volume we view into.
+  size_t offset; //Index of our first voxel in grid.
+  int stride_y; //Elements between rows.
+  size_t stride_z; //Elements between planes.
+  int size; //Side of this block.
+  int x, y, z; //Position of our first voxel.
+  double min, max;
+
+  struct volumeNode *child[8]; //Bit 0 is +x, bit 1 is +y, bit 2 is +z.
+} volumeNode;
+
+enum build_mode { BUILD_STATIC, BUILD_ADAPTIVE };
+
+//Encapsulates all data for each thread building a subtree.
+struct volume_thread_data {
+  pthread_t thread_id;
+  volumeNode *node;
+  enum build_mode mode;
+  int depth; //Levels left for BUILD_STATIC.
+  double threshold; //max - min above which BUILD_ADAPTIVE splits.
+};
+
+#define VOXEL(node,i,j,k) ((node)->grid[(node)->offset + (size_t)(k)*(node)->stride_z + (size_t)(j)*(node)->stride_y + (i)])
+
+volumeNode* InitVolumeNode(double *grid, int stride_y, size_t stride_z, int x, int y, int z, int size){
+
+  volumeNode *temp = malloc(sizeof(volumeNode));
+  if(temp == NULL) errx(1,"Could not allocate node!");
+  temp->grid = grid;
+  temp->stride_y = stride_y;
+  temp->stride_z = stride_z;
+  temp->offset = (size_t)z*stride_z + (size_t)y*stride_y + x;
+  temp->x = x;
+  temp->y = y;
+  temp->z = z;
+  temp->size = size;
+  memset(temp->child,0,sizeof(temp->child));
+  return temp;
+
+}
+
+static inline int IsVolumeLeaf(const volumeNode *node){
+  return node->child[0] == NULL;
+}
+
+void DeleteVolumeTree(volumeNode *node){
+
+  int c;
+  if(!IsVolumeLeaf(node)){
+    for(c=0;c<8;c++) DeleteVolumeTree(node->child[c]);
+  }
+  free(node);
+
+}
+
+static void MakeVolumeChildren(volumeNode *node){
+
+  int half = node->size/2, c;
+  for(c=0;c<8;c++){
+    node->child[c] = InitVolumeNode(node->grid,node->stride_y,node->stride_z,
+                                    node->x + (c&1)*half,node->y + ((c>>1)&1)*half,node->z + ((c>>2)&1)*half,half);
+  }
+
+}
+
+//Builds node's subtree, min/max coming bottom-up so each voxel is read once.
+static void BuildVolume(volumeNode *node, enum build_mode mode, int depth, double threshold){
+
+  int c,i,j,k;
+  int split = mode == BUILD_STATIC ? depth > 0 : node->size > MIN_BLOCK;
+
+  if(!split){
+    node->min = INFINITY;
+    node->max = -INFINITY;
+    for(k=0;k<node->size;k++){
+      for(j=0;j<node->size;j++){
+        for(i=0;i<node->size;i++){
+          double v = VOXEL(node,i,j,k);
+          node->min = MIN(node->min,v);
+          node->max = MAX(node->max,v);
+        }
+      }
+    }
+    return;
+  }
+  MakeVolumeChildren(node);
+  node->min = INFINITY;
+  node->max = -INFINITY;
+  for(c=0;c<8;c++){
+    BuildVolume(node->child[c],mode,depth-1,threshold);
+    node->min = MIN(node->min,node->child[c]->min);
+    node->max = MAX(node->max,node->child[c]->max);
+  }
+  if(mode == BUILD_ADAPTIVE && node->max - node->min <= threshold){
+    for(c=0;c<8;c++){
+      DeleteVolumeTree(node->child[c]);
+      node->child[c] = NULL;
+    }
+  }
+
+}
+
+void *volume_worker(void *threadArg){
+
+  struct volume_thread_data *data = (struct volume_thread_data *) threadArg;
+  BuildVolume(data->node,data->mode,data->depth,data->threshold);
+  return NULL;
+
+}
+
+//Builds an octree over a size^3 volume stored x fastest, then y, then z. With BUILD_STATIC
+//the tree has depth levels below the root; with BUILD_ADAPTIVE a block is split down to
+//MIN_BLOCK wherever max - min > threshold.
+volumeNode* VolumeTree(double *grid, int size, enum build_mode mode, int depth, double threshold, int threads){
+
+  if(mode == BUILD_STATIC && (depth < 0 || size % (1 << depth)))
+    errx(1,"Volume size %d is not divisible into %d levels!",size,depth);
+  if(mode == BUILD_ADAPTIVE && (size < MIN_BLOCK || size % MIN_BLOCK || ((size/MIN_BLOCK) & (size/MIN_BLOCK-1))))
+    errx(1,"Volume size %d is not %d times a power of two!",size,MIN_BLOCK);
+
+  volumeNode *root = InitVolumeNode(grid,size,(size_t)size*size,0,0,0,size);
+  int split = mode == BUILD_STATIC ? depth > 0 : size > MIN_BLOCK;
+  if(threads <= 1 || !split){
+    BuildVolume(root,mode,depth,threshold);
+    return root;
+  }
+
+  //One thread per octant of the root, then finish the root here.
+  struct volume_thread_data data[8];
+  int c;
+  MakeVolumeChildren(root);
+  for(c=0;c<8;c++){
+    data[c].node = root->child[c];
+    data[c].mode = mode;
+    data[c].depth = depth-1;
+    data[c].threshold = threshold;
+    if(pthread_create(&data[c].thread_id,NULL,volume_worker,&data[c])) errx(1,"Thread creation failed.");
+  }
+  root->min = INFINITY;
+  root->max = -INFINITY;
+  for(c=0;c<8;c++){
+    pthread_join(data[c].thread_id,NULL);
+    root->min = MIN(root->min,root->child[c]->min);
+    root->max = MAX(root->max,root->child[c]->max);
+  }
+  if(mode == BUILD_ADAPTIVE && root->max - root->min <= threshold){
+    for(c=0;c<8;c++){
+      DeleteVolumeTree(root->child[c]);
+      root->child[c] = NULL;
+    }
+  }
+  return root;
+
+}
+
+//Maximum voxel in [x0,x1) x [y0,y1) x [z0,z1).
+double VolumeBoxMax(const volumeNode *node, int x0, int y0, int z0, int x1, int y1, int z1){
+
+  int c,i,j,k;
+  double max = -INFINITY;
+
+  if(node->x >= x1 || node->x+node->size <= x0 || node->y >= y1 || node->y+node->size <= y0 ||
+     node->z >= z1 || node->z+node->size <= z0) return max;
+  if(node->x >= x0 && node->x+node->size <= x1 && node->y >= y0 && node->y+node->size <= y1 &&
+     node->z >= z0 && node->z+node->size <= z1) return node->max;
+  if(IsVolumeLeaf(node)){
+    if(node->min == node->max) return node->max;
+    for(k=MAX(z0,node->z);k<MIN(z1,node->z+node->size);k++){
+      for(j=MAX(y0,node->y);j<MIN(y1,node->y+node->size);j++){
+        for(i=MAX(x0,node->x);i<MIN(x1,node->x+node->size);i++){
+          max = MAX(max,node->grid[(size_t)k*node->stride_z + (size_t)j*node->stride_y + i]);
+        }
+      }
+    }
+    return max;
+  }
+  for(c=0;c<8;c++) max = MAX(max,VolumeBoxMax(node->child[c],x0,y0,z0,x1,y1,z1));
+  return max;
+
+}
+
+void CountVolumeNodes(const volumeNode *node, long *leaves, long *nodes){
+
+  int c;
+  (*nodes)++;
+  if(IsVolumeLeaf(node)){
+    (*leaves)++;
+    return;
+  }
+  for(c=0;c<8;c++) CountVolumeNodes(node->child[c],leaves,nodes);
+
+}
+
+/* ---- Point clouds ---- */
+
+//Points read in place from x, y, z and mapped through rotation then translation.
+typedef struct pointCloud {
+  const double *x, *y, *z;
+  int n;
+  double rotation[3][3];
+  double translation[3];
+} pointCloud;
+
+void InitPointCloud(pointCloud *cloud, const double *x, const double *y, const double *z, int n){
+
+  int i,j;
+  cloud->x = x;
+  cloud->y = y;
+  cloud->z = z;
+  cloud->n = n;
+  for(i=0;i<3;i++){
+    cloud->translation[i] = 0.0;
+    for(j=0;j<3;j++) cloud->rotation[i][j] = i == j;
+  }
+
+}
+
+//Sets the cloud's pose to p' = q p q^-1 + t. The quaternion is turned into a matrix once
+//rather than doing two quaternion products per point.
+void SetCloudPose(pointCloud *cloud, quaternion q, double tx, double ty, double tz){
+
+  double norm = sqrt(q.real*q.real + q.i*q.i + q.j*q.j + q.k*q.k);
+  double w = q.real/norm, a = q.i/norm, b = q.j/norm, c = q.k/norm;
+
+  cloud->rotation[0][0] = 1 - 2*(b*b + c*c);
+  cloud->rotation[0][1] = 2*(a*b - w*c);
+  cloud->rotation[0][2] = 2*(a*c + w*b);
+  cloud->rotation[1][0] = 2*(a*b + w*c);
+  cloud->rotation[1][1] = 1 - 2*(a*a + c*c);
+  cloud->rotation[1][2] = 2*(b*c - w*a);
+  cloud->rotation[2][0] = 2*(a*c - w*b);
+  cloud->rotation[2][1] = 2*(b*c + w*a);
+  cloud->rotation[2][2] = 1 - 2*(a*a + b*b);
+  cloud->translation[0] = tx;
+  cloud->translation[1] = ty;
+  cloud->translation[2] = tz;
+
+}
+
+static inline void CloudPoint(const pointCloud *cloud, int i, double p[3]){
+
+  double x = cloud->x[i], y = cloud->y[i], z = cloud->z[i];
+  int r;
+  for(r=0;r<3;r++){
+    p[r] = cloud->rotation[r][0]*x + cloud->rotation[r][1]*y + cloud->rotation[r][2]*z + cloud->translation[r];
+  }
+
+}
+
+typedef struct pointNode {
+
+  double centre[3];
+  double half;
+  int first, count; //Range of the tree's index array.
+  struct pointNode *child[8]; //NULL at leaves; empty octants get no node.
+} pointNode;
+
+typedef struct pointTree {
+  const pointCloud *cloud;
+  int *index; //Cloud indices, grouped by node.
+  int *scratch;
+  unsigned char *octant;
+  pointNode *root;
+} pointTree;
+
+struct point_thread_data {
+  pthread_t thread_id;
+  pointTree *tree;
+  pointNode *node;
+  int depth;
+};
+
+static pointNode* InitPointNode(const double centre[3], double half, int first, int count){
+
+  pointNode *temp = malloc(sizeof(pointNode));
+  if(temp == NULL) errx(1,"Could not allocate node!");
+  memcpy(temp->centre,centre,sizeof(temp->centre));
+  temp->half = half;
+  temp->first = first;
+  temp->count = count;
+  memset(temp->child,0,sizeof(temp->child));
+  return temp;
+
+}
+
+static inline int IsPointLeaf(const pointNode *node){
+
+  int c;
+  for(c=0;c<8;c++){
+    if(node->child[c] != NULL) return 0;
+  }
+  return 1;
+
+}
+
+//Groups node's indices by octant (a stable counting sort through the scratch array) and
+//creates the non-empty children. Different nodes use disjoint ranges of index, octant and
+//scratch, so subtrees can be split concurrently.
+static void SplitPointNode(pointTree *tree, pointNode *node){
+
+  int counts[8] = {0}, starts[8];
+  int i, c, end = node->first + node->count;
+
+  for(i=node->first;i<end;i++){
+    double p[3];
+    CloudPoint(tree->cloud,tree->index[i],p);
+    int o = (p[0] >= node->centre[0]) | (p[1] >= node->centre[1]) << 1 | (p[2] >= node->centre[2]) << 2;
+    tree->octant[i] = o;
+    counts[o]++;
+  }
+  starts[0] = node->first;
+  for(c=1;c<8;c++) starts[c] = starts[c-1] + counts[c-1];
+  int fill[8];
+  memcpy(fill,starts,sizeof(fill));
+  for(i=node->first;i<end;i++) tree->scratch[fill[tree->octant[i]]++] = tree->index[i];
+  memcpy(tree->index+node->first,tree->scratch+node->first,node->count*sizeof(int));
+
+  double h = node->half/2;
+  for(c=0;c<8;c++){
+    if(counts[c] == 0) continue;
+    double centre[3] = {node->centre[0] + ((c&1) ? h : -h),
+                        node->centre[1] + ((c&2) ? h : -h),
+                        node->centre[2] + ((c&4) ? h : -h)};
+    node->child[c] = InitPointNode(centre,h,starts[c],counts[c]);
+  }
+
+}
+
+static void BuildPoints(pointTree *tree, pointNode *node, int depth){
+
+  int c;
+  if(node->count <= BUCKET_SIZE || depth >= MAX_DEPTH) return;
+  SplitPointNode(tree,node);
+  for(c=0;c<8;c++){
+    if(node->child[c] != NULL) BuildPoints(tree,node->child[c],depth+1);
+  }
+
+}
+
+void *point_worker(void *threadArg){
+
+  struct point_thread_data *data = (struct point_thread_data *) threadArg;
+  BuildPoints(data->tree,data->node,data->depth);
+  return NULL;
+
+}
+
+//Indexes every point of cloud in its current pose.
+void BuildPointTree(pointTree *tree, const pointCloud *cloud, int threads){
+
+  double lo[3] = {INFINITY,INFINITY,INFINITY}, hi[3] = {-INFINITY,-INFINITY,-INFINITY};
+  int i, r, c;
+
+  tree->cloud = cloud;
+  tree->index = malloc((size_t)cloud->n*sizeof(int));
+  tree->scratch = malloc((size_t)cloud->n*sizeof(int));
+  tree->octant = malloc((size_t)cloud->n);
+  if(!tree->index || !tree->scratch || !tree->octant) errx(1,"Could not allocate index!");
+  for(i=0;i<cloud->n;i++){
+    double p[3];
+    tree->index[i] = i;
+    CloudPoint(cloud,i,p);
+    for(r=0;r<3;r++){
+      lo[r] = MIN(lo[r],p[r]);
+      hi[r] = MAX(hi[r],p[r]);
+    }
+  }
+  double centre[3], half = 0.0;
+  for(r=0;r<3;r++){
+    centre[r] = 0.5*(lo[r]+hi[r]);
+    half = MAX(half,0.5*(hi[r]-lo[r]));
+  }
+  //Slightly enlarged so points on the faces fall inside.
+  tree->root = InitPointNode(centre,half*(1+1e-9)+1e-300,0,cloud->n);
+
+  if(threads <= 1 || cloud->n <= BUCKET_SIZE){
+    BuildPoints(tree,tree->root,0);
+  }
+  else{
+    struct point_thread_data data[8];
+    SplitPointNode(tree,tree->root);
+    for(c=0;c<8;c++){
+      data[c].tree = tree;
+      data[c].node = tree->root->child[c];
+      data[c].depth = 1;
+      if(data[c].node != NULL && pthread_create(&data[c].thread_id,NULL,point_worker,&data[c]))
+        errx(1,"Thread creation failed.");
+    }
+    for(c=0;c<8;c++){
+      if(data[c].node != NULL) pthread_join(data[c].thread_id,NULL);
+    }
+  }
+  free(tree->scratch);
+  free(tree->octant);
+  tree->scratch = NULL;
+  tree->octant = NULL;
+
+}
+
+static void DeletePointNodes(pointNode *node){
+
+  int c;
+  for(c=0;c<8;c++){
+    if(node->child[c] != NULL) DeletePointNodes(node->child[c]);
+  }
+  free(node);
+
+}
+
+void DeletePointTree(pointTree *tree){
+
+  DeletePointNodes(tree->root);
+  free(tree->index);
+
+}
+
+//A convex region as planes a.p + d >= 0.
+typedef struct convexRegion {
+  double plane[6][4];
+  int planes;
+} convexRegion;
+
+//Axis-aligned box [lo,hi] as six planes.
+void BoxRegion(convexRegion *region, const double lo[3], const double hi[3]){
+
+  int r;
+  memset(region,0,sizeof(*region));
+  region->planes = 6;
+  for(r=0;r<3;r++){
+    region->plane[2*r][r] = 1.0;
+    region->plane[2*r][3] = -lo[r];
+    region->plane[2*r+1][r] = -1.0;
+    region->plane[2*r+1][3] = hi[r];
+  }
+
+}
+
+static void Cross(const double a[3], const double b[3], double out[3]){
+
+  out[0] = a[1]*b[2] - a[2]*b[1];
+  out[1] = a[2]*b[0] - a[0]*b[2];
+  out[2] = a[0]*b[1] - a[1]*b[0];
+
+}
+
+static void Normalise(double v[3]){
+
+  double n = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+  v[0] /= n;
+  v[1] /= n;
+  v[2] /= n;
+
+}
+
+//Sets plane i to pass through point with the given inward normal.
+static void SetPlane(convexRegion *region, int i, const double normal[3], const double point[3]){
+
+  region->plane[i][0] = normal[0];
+  region->plane[i][1] = normal[1];
+  region->plane[i][2] = normal[2];
+  region->plane[i][3] = -(normal[0]*point[0] + normal[1]*point[1] + normal[2]*point[2]);
+
+}
+
+//Perspective view frustum from an eye position looking along dir, with vertical field of
+//view fovy (radians), width/height aspect and near/far distances.
+void FrustumRegion(convexRegion *region, const double eye[3], const double dir[3], const double up[3],
+                   double fovy, double aspect, double near, double far){
+
+  double f[3] = {dir[0],dir[1],dir[2]}, r[3], u[3], n[3], p[3];
+  double th = tan(fovy/2), tw = th*aspect;
+  int i;
+
+  Normalise(f);
+  Cross(f,up,r);
+  Normalise(r);
+  Cross(r,f,u);
+  region->planes = 6;
+  for(i=0;i<3;i++) p[i] = eye[i] + near*f[i];
+  SetPlane(region,0,f,p);
+  for(i=0;i<3;i++){
+    p[i] = eye[i] + far*f[i];
+    n[i] = -f[i];
+  }
+  SetPlane(region,1,n,p);
+  //Side planes pass through the eye; their normals point inwards.
+  for(i=0;i<3;i++) n[i] = f[i]*tw + r[i];
+  SetPlane(region,2,n,eye);
+  for(i=0;i<3;i++) n[i] = f[i]*tw - r[i];
+  SetPlane(region,3,n,eye);
+  for(i=0;i<3;i++) n[i] = f[i]*th + u[i];
+  SetPlane(region,4,n,eye);
+  for(i=0;i<3;i++) n[i] = f[i]*th - u[i];
+  SetPlane(region,5,n,eye);
+
+}
+
+static inline int InsideRegion(const convexRegion *region, const double p[3]){
+
+  int i;
+  for(i=0;i<region->planes;i++){
+    const double *pl = region->plane[i];
+    if(pl[0]*p[0] + pl[1]*p[1] + pl[2]*p[2] + pl[3] < 0) return 0;
+  }
+  return 1;
+
+}
+
+//-1 if the node's cube is entirely outside the region, 1 if entirely inside, 0 otherwise.
+//Uses the cube corner furthest along (and against) each plane normal.
+static int ClassifyNode(const convexRegion *region, const pointNode *node){
+
+  int i, inside = 1;
+  for(i=0;i<region->planes;i++){
+    const double *pl = region->plane[i];
+    double centre = pl[0]*node->centre[0] + pl[1]*node->centre[1] + pl[2]*node->centre[2] + pl[3];
+    double extent = node->half*(fabs(pl[0]) + fabs(pl[1]) + fabs(pl[2]));
+    if(centre + extent < 0) return -1;
+    if(centre - extent < 0) inside = 0;
+  }
+  return inside;
+
+}
+
+static int RegionRecurse(const pointTree *tree, const pointNode *node, const convexRegion *region,
+                         int *out, int max, int found){
+
+  int c, i;
+  int class = ClassifyNode(region,node);
+
+  if(class < 0) return found;
+  if(class > 0){
+    for(i=node->first;i<node->first+node->count;i++){
+      if(found < max) out[found] = tree->index[i];
+      found++;
+    }
+    return found;
+  }
+  if(IsPointLeaf(node)){
+    for(i=node->first;i<node->first+node->count;i++){
+      double p[3];
+      CloudPoint(tree->cloud,tree->index[i],p);
+      if(InsideRegion(region,p)){
+        if(found < max) out[found] = tree->index[i];
+        found++;
+      }
+    }
+    return found;
+  }
+  for(c=0;c<8;c++){
+    if(node->child[c] != NULL) found = RegionRecurse(tree,node->child[c],region,out,max,found);
+  }
+  return found;
+
+}
+
+//Cloud indices of points inside region (at most max written). Returns the number found.
+int RegionQuery(const pointTree *tree, const convexRegion *region, int *out, int max){
+  return RegionRecurse(tree,tree->root,region,out,max,0);
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int size = argc > 1 ? strtol(argv[1],NULL,10) : 256;
+  int npoints = argc > 2 ? strtol(argv[2],NULL,10) : 2000000;
+  int threads = argc > 3 ? strtol(argv[3],NULL,10) : 8;
+  int i,j,k,q;
+
+  //Volume: flat background with a few spherical blobs.
+  double *volume = malloc((size_t)size*size*size*sizeof(double));
+  if(volume == NULL) errx(1,"Could not allocate volume!");
+  for(k=0;k<size;k++){
+    for(j=0;j<size;j++){
+      for(i=0;i<size;i++){
+        double x = (double)i/size, y = (double)j/size, z = (double)k/size;
+        double v = 0.0;
+        double r2 = (x-0.3)*(x-0.3) + (y-0.4)*(y-0.4) + (z-0.5)*(z-0.5);
+        if(r2 < 0.01) v += 1.0 - r2/0.01;
+        r2 = (x-0.7)*(x-0.7) + (y-0.2)*(y-0.2) + (z-0.3)*(z-0.3);
+        if(r2 < 0.004) v += 2.0;
+        volume[((size_t)k*size + j)*size + i] = v;
+      }
+    }
+  }
+
+  long leaves, nodes;
+  double t0 = seconds();
+  volumeNode *fixed = VolumeTree(volume,size,BUILD_STATIC,4,0.0,threads);
+  double t1 = seconds();
+  volumeNode *adaptive = VolumeTree(volume,size,BUILD_ADAPTIVE,0,0.05,threads);
+  double t2 = seconds();
+  leaves = nodes = 0;
+  CountVolumeNodes(fixed,&leaves,&nodes);
+  printf("%d^3 volume: static depth 4 %f s (%ld leaves), ",size,t1-t0,leaves);
+  leaves = nodes = 0;
+  CountVolumeNodes(adaptive,&leaves,&nodes);
+  printf("adaptive %f s (%ld leaves, %.2f%% of blocks at %d^3)\n",t2-t1,leaves,
+         100.0*leaves/((double)(size/MIN_BLOCK)*(size/MIN_BLOCK)*(size/MIN_BLOCK)),MIN_BLOCK);
+  for(q=0;q<20;q++){
+    int x0 = rand()%size, y0 = rand()%size, z0 = rand()%size;
+    int x1 = x0 + 1 + rand()%(size-x0), y1 = y0 + 1 + rand()%(size-y0), z1 = z0 + 1 + rand()%(size-z0);
+    double brute = -INFINITY;
+    for(k=z0;k<z1;k++){
+      for(j=y0;j<y1;j++){
+        for(i=x0;i<x1;i++) brute = MAX(brute,volume[((size_t)k*size + j)*size + i]);
+      }
+    }
+    if(VolumeBoxMax(fixed,x0,y0,z0,x1,y1,z1) != brute || VolumeBoxMax(adaptive,x0,y0,z0,x1,y1,z1) != brute)
+      errx(1,"Volume box query %d mismatch!",q);
+  }
+  printf("Volume box queries match a direct scan\n");
+  DeleteVolumeTree(fixed);
+  DeleteVolumeTree(adaptive);
+  free(volume);
+
+  //Point cloud: a noisy sphere shell plus a ground plane, indexed in place after rotation.
+  double *px = malloc((size_t)npoints*sizeof(double));
+  double *py = malloc((size_t)npoints*sizeof(double));
+  double *pz = malloc((size_t)npoints*sizeof(double));
+  int *out = malloc((size_t)npoints*sizeof(int));
+  for(i=0;i<npoints;i++){
+    double u = (double)rand()/RAND_MAX, v = (double)rand()/RAND_MAX;
+    if(i % 3){
+      double theta = 2*M_PI*u, phi = acos(2*v-1), r = 1.0 + 0.01*((double)rand()/RAND_MAX-0.5);
+      px[i] = r*sin(phi)*cos(theta);
+      py[i] = r*sin(phi)*sin(theta);
+      pz[i] = r*cos(phi);
+    }
+    else{
+      px[i] = 4*u-2;
+      py[i] = 4*v-2;
+      pz[i] = -1.2;
+    }
+  }
+
+  pointCloud cloud;
+  InitPointCloud(&cloud,px,py,pz,npoints);
+  SetCloudPose(&cloud,axis_angle_quaternion(1,1,0,0.7),5.0,-2.0,1.0);
+  pointTree tree;
+  t0 = seconds();
+  BuildPointTree(&tree,&cloud,1);
+  t1 = seconds();
+  DeletePointTree(&tree);
+  t2 = seconds();
+  BuildPointTree(&tree,&cloud,threads);
+  double t3 = seconds();
+  printf("%d rotated points: build %f s with 1 thread, %f s with %d\n",npoints,t1-t0,t3-t2,threads);
+
+  //The matrix pose must agree with rotating by quaternion products.
+  quaternion qr = axis_angle_quaternion(1,1,0,0.7);
+  quaternion qc = create_quaternion(qr.real,-qr.i,-qr.j,-qr.k);
+  for(i=0;i<npoints;i+=npoints/100+1){
+    double p[3];
+    CloudPoint(&cloud,i,p);
+    quaternion v = create_quaternion(0,px[i],py[i],pz[i]);
+    quaternion a = create_quaternion(qr.real*v.real - qr.i*v.i - qr.j*v.j - qr.k*v.k,
+                                     qr.real*v.i + qr.i*v.real + qr.j*v.k - qr.k*v.j,
+                                     qr.real*v.j - qr.i*v.k + qr.j*v.real + qr.k*v.i,
+                                     qr.real*v.k + qr.i*v.j - qr.j*v.i + qr.k*v.real);
+    quaternion b = create_quaternion(a.real*qc.real - a.i*qc.i - a.j*qc.j - a.k*qc.k,
+                                     a.real*qc.i + a.i*qc.real + a.j*qc.k - a.k*qc.j,
+                                     a.real*qc.j - a.i*qc.k + a.j*qc.real + a.k*qc.i,
+                                     a.real*qc.k + a.i*qc.j - a.j*qc.i + a.k*qc.real);
+    if(fabs(p[0]-b.i-5.0) > 1e-12 || fabs(p[1]-b.j+2.0) > 1e-12 || fabs(p[2]-b.k-1.0) > 1e-12)
+      errx(1,"Pose matrix disagrees with quaternion rotation!");
+  }
+
+  double eye[3] = {5.0,-6.0,1.5}, dir[3] = {0.0,1.0,-0.1}, up[3] = {0.0,0.0,1.0};
+  convexRegion regions[2];
+  double lo[3] = {5.5,-2.5,0.5}, hi[3] = {6.5,-1.5,1.5};
+  BoxRegion(&regions[0],lo,hi);
+  FrustumRegion(&regions[1],eye,dir,up,0.5,16.0/9.0,0.5,4.5);
+  const char *names[] = {"box","frustum"};
+  for(q=0;q<2;q++){
+    t0 = seconds();
+    int found = RegionQuery(&tree,&regions[q],out,npoints);
+    t1 = seconds();
+    int brute = 0;
+    for(i=0;i<npoints;i++){
+      double p[3];
+      CloudPoint(&cloud,i,p);
+      brute += InsideRegion(&regions[q],p);
+    }
+    t2 = seconds();
+    if(found != brute) errx(1,"%s query found %d points, brute force %d!",names[q],found,brute);
+    for(i=0;i<found;i++){
+      double p[3];
+      CloudPoint(&cloud,out[i],p);
+      if(!InsideRegion(&regions[q],p)) errx(1,"%s query returned an outside point!",names[q]);
+    }
+    printf("%s query: %d points in %f s (brute force %f s)\n",names[q],found,t1-t0,t2-t1);
+  }
+
+  DeletePointTree(&tree);
+  free(px);
+  free(py);
+  free(pz);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,416 @@
+/* Adaptive mesh refinement quadtree over a square grid.
+ *
+ * Like DistributeGridTree in quad_tree.c every node is a strided view into the original
+ * grid, but a node is only split where a split criterion (variance, max-min range or the
+ * largest difference between neighbouring cells) exceeds a threshold, down to MIN_SIZE.
+ * Each node keeps summary statistics of its subgrid, built bottom-up by combining its
+ * children, so the whole build reads the data once. The statistics let region queries
+ * take covered subtrees wholesale and let UpdateRegion refine or coarsen only the part of
+ * the tree whose data has changed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+
+#define MIN_SIZE 8 //Smallest leaf side.
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+enum split_criterion { SPLIT_VARIANCE, SPLIT_RANGE, SPLIT_GRADIENT };
+
+struct nodestats {
+  double count;
+  double mean;
+  double m2; //Sum of squared deviations from the mean.
+  double min;
+  double max;
+  double gradient; //Largest |difference| between adjacent cells.
+};
+
+typedef struct treeNode{
+
+  double *grid; //Base pointer of the grid we view into.
+  size_t offset; //Index of our top-left element in grid.
+  int stride; //Row stride of grid.
+  int size; // Size of this subgrid
+  int x, y; //Position of our top-left element in the grid.
+  struct nodestats stats;
+
+  //Pointers to the next level of the tree.
+  struct treeNode *NorthWest; 
+  struct treeNode *NorthEast;
+  struct treeNode *SouthWest;
+  struct treeNode *SouthEast;
+} treeNode;
+
+struct refinement {
+  enum split_criterion criterion;
+  double threshold;
+};
+
+#define NODE_AT(node,i,j) ((node)->grid[(node)->offset + (size_t)(j)*(node)->stride + (i)])
+
+//Returns an empty node viewing the size x size window of grid at (x,y).
+treeNode* InitNode(double *grid, int stride, int x, int y, int size){
+
+  treeNode *temp = (treeNode*)malloc(sizeof(treeNode));
+  if(temp == NULL) errx(1,"Could not allocate node!");
+  temp->grid = grid;
+  temp->stride = stride;
+  temp->offset = (size_t)y*stride + x;
+  temp->x = x;
+  temp->y = y;
+  temp->size = size;
+  temp->NorthWest = temp->NorthEast =
+    temp->SouthWest = temp->SouthEast = NULL;
+  return temp;
+
+}
+
+static inline int IsLeaf(const treeNode *node){
+  return node->NorthWest == NULL;
+}
+
+//Frees everything below Root, leaving it a leaf.
+void DeleteChildren(treeNode *Root){
+
+  if(IsLeaf(Root)) return;
+  DeleteChildren(Root->NorthWest);
+  DeleteChildren(Root->NorthEast);
+  DeleteChildren(Root->SouthWest);
+  DeleteChildren(Root->SouthEast);
+  free(Root->NorthWest);
+  free(Root->NorthEast);
+  free(Root->SouthWest);
+  free(Root->SouthEast);
+  Root->NorthWest = Root->NorthEast = Root->SouthWest = Root->SouthEast = NULL;
+
+}
+
+//Statistics of a small block read directly from the grid.
+static void BlockStats(const treeNode *node, struct nodestats *s){
+
+  int i,j;
+  double sum = 0.0;
+
+  s->min = INFINITY;
+  s->max = -INFINITY;
+  s->gradient = 0.0;
+  for(j=0;j<node->size;j++){
+    for(i=0;i<node->size;i++){
+      double v = NODE_AT(node,i,j);
+      sum += v;
+      s->min = MIN(s->min,v);
+      s->max = MAX(s->max,v);
+      if(i > 0) s->gradient = MAX(s->gradient,fabs(v-NODE_AT(node,i-1,j)));
+      if(j > 0) s->gradient = MAX(s->gradient,fabs(v-NODE_AT(node,i,j-1)));
+    }
+  }
+  s->count = (double)node->size*node->size;
+  s->mean = sum/s->count;
+  s->m2 = 0.0;
+  for(j=0;j<node->size;j++){
+    for(i=0;i<node->size;i++){
+      double d = NODE_AT(node,i,j) - s->mean;
+      s->m2 += d*d;
+    }
+  }
+
+}
+
+//Combines the children's statistics (Chan et al. for the variance) and adds the
+//gradients across the seams between the quadrants.
+static void CombineStats(treeNode *node){
+
+  const treeNode *children[4] = {node->NorthWest,node->NorthEast,node->SouthWest,node->SouthEast};
+  struct nodestats *s = &node->stats;
+  int c, k, half = node->size/2;
+
+  *s = children[0]->stats;
+  for(c=1;c<4;c++){
+    const struct nodestats *b = &children[c]->stats;
+    double count = s->count + b->count;
+    double delta = b->mean - s->mean;
+    s->m2 += b->m2 + delta*delta*s->count*b->count/count;
+    s->mean += delta*b->count/count;
+    s->count = count;
+    s->min = MIN(s->min,b->min);
+    s->max = MAX(s->max,b->max);
+    s->gradient = MAX(s->gradient,b->gradient);
+  }
+  for(k=0;k<node->size;k++){
+    s->gradient = MAX(s->gradient,fabs(NODE_AT(node,half,k)-NODE_AT(node,half-1,k)));
+    s->gradient = MAX(s->gradient,fabs(NODE_AT(node,k,half)-NODE_AT(node,k,half-1)));
+  }
+
+}
+
+static int ShouldSplit(const treeNode *node, const struct refinement *ref){
+
+  const struct nodestats *s = &node->stats;
+  if(node->size <= MIN_SIZE) return 0;
+  switch(ref->criterion){
+  case SPLIT_VARIANCE:
+    return s->m2/s->count > ref->threshold;
+  case SPLIT_RANGE:
+    return s->max - s->min > ref->threshold;
+  case SPLIT_GRADIENT:
+    return s->gradient > ref->threshold;
+  }
+  return 0;
+
+}
+
+//Computes Root's statistics from MIN_SIZE blocks upwards, keeping children only where
+//the criterion asks for them. Each cell is read once whatever the depth.
+static void Refine(treeNode *Root, const struct refinement *ref){
+
+  if(Root->size <= MIN_SIZE){
+    BlockStats(Root,&Root->stats);
+    return;
+  }
+  int half = Root->size/2;
+  Root->NorthWest = InitNode(Root->grid,Root->stride,Root->x,Root->y,half);
+  Root->NorthEast = InitNode(Root->grid,Root->stride,Root->x+half,Root->y,half);
+  Root->SouthWest = InitNode(Root->grid,Root->stride,Root->x,Root->y+half,half);
+  Root->SouthEast = InitNode(Root->grid,Root->stride,Root->x+half,Root->y+half,half);
+  Refine(Root->NorthWest,ref);
+  Refine(Root->NorthEast,ref);
+  Refine(Root->SouthWest,ref);
+  Refine(Root->SouthEast,ref);
+  CombineStats(Root);
+  if(!ShouldSplit(Root,ref)) DeleteChildren(Root);
+
+}
+
+//Builds an adaptive tree over a size x size grid. size must be MIN_SIZE times a power of two.
+treeNode* AdaptiveTree(double *grid, int size, const struct refinement *ref){
+
+  if(size < MIN_SIZE || size % MIN_SIZE || ((size/MIN_SIZE) & (size/MIN_SIZE - 1)))
+    errx(1,"Grid size %d is not %d times a power of two!",size,MIN_SIZE);
+  treeNode *root = InitNode(grid,size,0,0,size);
+  Refine(root,ref);
+  return root;
+
+}
+
+static inline int Overlaps(const treeNode *node, int x0, int y0, int x1, int y1){
+  return node->x < x1 && node->x+node->size > x0 && node->y < y1 && node->y+node->size > y0;
+}
+
+//Brings the tree up to date after the grid changed inside [x0,x1) x [y0,y1): leaves in the
+//region are rebuilt (refining them if needed) and ancestors recombined, coarsening any
+//that no longer meet the criterion. Nodes outside the region are not touched.
+void UpdateRegion(treeNode *Root, int x0, int y0, int x1, int y1, const struct refinement *ref){
+
+  if(!Overlaps(Root,x0,y0,x1,y1)) return;
+  if(IsLeaf(Root)){
+    Refine(Root,ref);
+    return;
+  }
+  UpdateRegion(Root->NorthWest,x0,y0,x1,y1,ref);
+  UpdateRegion(Root->NorthEast,x0,y0,x1,y1,ref);
+  UpdateRegion(Root->SouthWest,x0,y0,x1,y1,ref);
+  UpdateRegion(Root->SouthEast,x0,y0,x1,y1,ref);
+  CombineStats(Root);
+  if(!ShouldSplit(Root,ref)) DeleteChildren(Root);
+
+}
+
+//Sum, min and max over [x0,x1) x [y0,y1). Nodes inside the region contribute their stored
+//statistics; only leaves straddling its edge are read cell by cell.
+void RegionStats(const treeNode *Root, int x0, int y0, int x1, int y1, double *sum, double *min, double *max){
+
+  if(!Overlaps(Root,x0,y0,x1,y1)) return;
+  if(Root->x >= x0 && Root->x+Root->size <= x1 && Root->y >= y0 && Root->y+Root->size <= y1){
+    *sum += Root->stats.mean*Root->stats.count;
+    *min = MIN(*min,Root->stats.min);
+    *max = MAX(*max,Root->stats.max);
+    return;
+  }
+  if(IsLeaf(Root) && Root->stats.min == Root->stats.max){
+    //Constant leaf: the overlap's area is enough.
+    double area = (double)(MIN(x1,Root->x+Root->size)-MAX(x0,Root->x)) * (MIN(y1,Root->y+Root->size)-MAX(y0,Root->y));
+    *sum += Root->stats.min*area;
+    *min = MIN(*min,Root->stats.min);
+    *max = MAX(*max,Root->stats.max);
+    return;
+  }
+  if(IsLeaf(Root)){
+    int i,j;
+    for(j=MAX(y0,Root->y);j<MIN(y1,Root->y+Root->size);j++){
+      for(i=MAX(x0,Root->x);i<MIN(x1,Root->x+Root->size);i++){
+        double v = Root->grid[(size_t)j*Root->stride+i];
+        *sum += v;
+        *min = MIN(*min,v);
+        *max = MAX(*max,v);
+      }
+    }
+    return;
+  }
+  RegionStats(Root->NorthWest,x0,y0,x1,y1,sum,min,max);
+  RegionStats(Root->NorthEast,x0,y0,x1,y1,sum,min,max);
+  RegionStats(Root->SouthWest,x0,y0,x1,y1,sum,min,max);
+  RegionStats(Root->SouthEast,x0,y0,x1,y1,sum,min,max);
+
+}
+
+//Counts cells above value, skipping subtrees whose max is below it and counting subtrees
+//whose min is above it without reading them.
+long CountAbove(const treeNode *Root, double value){
+
+  if(Root->stats.max <= value) return 0;
+  if(Root->stats.min > value) return (long)Root->stats.count;
+  if(IsLeaf(Root)){
+    long count = 0;
+    int i,j;
+    for(j=0;j<Root->size;j++){
+      for(i=0;i<Root->size;i++){
+        count += NODE_AT(Root,i,j) > value;
+      }
+    }
+    return count;
+  }
+  return CountAbove(Root->NorthWest,value) + CountAbove(Root->NorthEast,value) +
+    CountAbove(Root->SouthWest,value) + CountAbove(Root->SouthEast,value);
+
+}
+
+//Counts leaves and nodes.
+void CountNodes(const treeNode *Root, long *leaves, long *nodes){
+
+  (*nodes)++;
+  if(IsLeaf(Root)){
+    (*leaves)++;
+    return;
+  }
+  CountNodes(Root->NorthWest,leaves,nodes);
+  CountNodes(Root->NorthEast,leaves,nodes);
+  CountNodes(Root->SouthWest,leaves,nodes);
+  CountNodes(Root->SouthEast,leaves,nodes);
+
+}
+
+//Whether two trees have the same shape and (to rounding) the same statistics.
+static int SameTree(const treeNode *a, const treeNode *b){
+
+  if(IsLeaf(a) != IsLeaf(b)) return 0;
+  if(fabs(a->stats.mean-b->stats.mean) > 1e-9*(1+fabs(a->stats.mean)) ||
+     fabs(a->stats.m2-b->stats.m2) > 1e-6*(1+fabs(a->stats.m2)) ||
+     a->stats.min != b->stats.min || a->stats.max != b->stats.max ||
+     a->stats.gradient != b->stats.gradient) return 0;
+  if(IsLeaf(a)) return 1;
+  return SameTree(a->NorthWest,b->NorthWest) && SameTree(a->NorthEast,b->NorthEast) &&
+    SameTree(a->SouthWest,b->SouthWest) && SameTree(a->SouthEast,b->SouthEast);
+
+}
+
+//Mostly flat field: a few narrow bumps and a sharp circular front.
+static void FillField(double *grid, int size){
+
+  int x,y;
+  for(y=0;y<size;y++){
+    for(x=0;x<size;x++){
+      double u = (double)x/size, v = (double)y/size;
+      double value = 1.0;
+      value += 5.0*exp(-((u-0.3)*(u-0.3)+(v-0.3)*(v-0.3))/0.0005);
+      value += 3.0*exp(-((u-0.7)*(u-0.7)+(v-0.6)*(v-0.6))/0.0002);
+      if((u-0.6)*(u-0.6)+(v-0.7)*(v-0.7) < 0.01) value += 2.0;
+      grid[(size_t)y*size+x] = value;
+    }
+  }
+
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int size = argc > 1 ? strtol(argv[1],NULL,10) : 4096;
+  const char *names[] = {"variance","range","gradient"};
+  double thresholds[] = {1e-4,1e-2,1e-3};
+  int c;
+
+  double *grid = malloc((size_t)size*size*sizeof(double));
+  if(grid == NULL) errx(1,"Could not allocate grid!");
+  FillField(grid,size);
+  long uniform = (long)(size/MIN_SIZE)*(size/MIN_SIZE);
+
+  for(c=SPLIT_VARIANCE;c<=SPLIT_GRADIENT;c++){
+    struct refinement ref = {c,thresholds[c]};
+    long leaves = 0, nodes = 0;
+    FillField(grid,size);
+
+    double t0 = seconds();
+    treeNode *root = AdaptiveTree(grid,size,&ref);
+    double t1 = seconds();
+    CountNodes(root,&leaves,&nodes);
+    printf("%s > %g: %ld leaves (%.2f%% of a uniform tree at %d x %d), build %f s\n",
+           names[c],thresholds[c],leaves,100.0*leaves/uniform,MIN_SIZE,MIN_SIZE,t1-t0);
+
+    //Region query against a direct scan.
+    int x0 = size/5, y0 = size/7, x1 = size/2 + 3, y1 = 3*size/4 + 1;
+    double sum = 0.0, min = INFINITY, max = -INFINITY;
+    double bsum = 0.0, bmin = INFINITY, bmax = -INFINITY;
+    int i,j;
+    t0 = seconds();
+    RegionStats(root,x0,y0,x1,y1,&sum,&min,&max);
+    t1 = seconds();
+    for(j=y0;j<y1;j++){
+      for(i=x0;i<x1;i++){
+        double v = grid[(size_t)j*size+i];
+        bsum += v;
+        bmin = MIN(bmin,v);
+        bmax = MAX(bmax,v);
+      }
+    }
+    double t2 = seconds();
+    if(fabs(sum-bsum) > 1e-9*fabs(bsum) || min != bmin || max != bmax) errx(1,"Region stats mismatch!");
+    long above = CountAbove(root,2.5), babove = 0;
+    size_t k;
+    for(k=0;k<(size_t)size*size;k++) babove += grid[k] > 2.5;
+    if(above != babove) errx(1,"CountAbove mismatch!");
+    printf("  region stats %f s (scan %f s)\n",t1-t0,t2-t1);
+
+    //Move the bumps: add one, flatten another, and update just those regions.
+    int bx = size/8, by = 5*size/8, bw = size/16;
+    for(j=by;j<by+bw;j++){
+      for(i=bx;i<bx+bw;i++){
+        double u = (double)(i-bx)/bw - 0.5, v = (double)(j-by)/bw - 0.5;
+        grid[(size_t)j*size+i] += 4.0*exp(-(u*u+v*v)/0.01);
+      }
+    }
+    int fx = (int)(0.25*size), fy = (int)(0.25*size), fw = size/8;
+    for(j=fy;j<fy+fw;j++){
+      for(i=fx;i<fx+fw;i++) grid[(size_t)j*size+i] = 1.0;
+    }
+    t0 = seconds();
+    UpdateRegion(root,bx,by,bx+bw,by+bw,&ref);
+    UpdateRegion(root,fx,fy,fx+fw,fy+fw,&ref);
+    t1 = seconds();
+    treeNode *fresh = AdaptiveTree(grid,size,&ref);
+    t2 = seconds();
+    if(!SameTree(root,fresh)) errx(1,"Updated tree differs from a rebuild!");
+    leaves = nodes = 0;
+    CountNodes(root,&leaves,&nodes);
+    printf("  after update: %ld leaves, update %f s (rebuild %f s)\n",leaves,t1-t0,t2-t1);
+
+    DeleteChildren(root);
+    DeleteChildren(fresh);
+    free(root);
+    free(fresh);
+  }
+
+  free(grid);
+  return 0;
+}
@@ -0,0 +1,347 @@
+/* Barnes-Hut gravitational forces on a quadtree.
+ *
+ * Bodies are partitioned in place into quadrants, so every node owns a contiguous range of
+ * the body array and nodes live in one array indexed by position. Each node stores its
+ * total mass and centre of mass, accumulated bottom-up. To evaluate the force on a body the
+ * tree is walked from the root; a node of side s at distance d is treated as a single point
+ * mass when s/d < theta, and opened otherwise. Leaves hold up to LEAF_BODIES bodies, summed
+ * directly. The force pass is split across threads by body range, and since bodies are in
+ * tree order each thread walks neighbouring paths through the tree.
+ *
+ * This is a separate tree rather than an extension of quad_tree.c. That tree views a square
+ * grid of values and always splits down to fixed-size cells, while particles need a tree
+ * over points, refined only where bodies are, with mass aggregates in each node. Like the
+ * other programs here it stands alone.
+ *
+ * main() compares against O(N^2) direct summation at small N and times large N. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+
+#define LEAF_BODIES 8
+#define MAX_DEPTH 40 //Bodies closer together than 2^-40 of the domain share a leaf.
+#define SOFTENING 1e-6 //Added to r^2 so close encounters stay finite.
+
+typedef struct body {
+  double x, y;
+  double mass;
+} body;
+
+typedef struct bhNode {
+
+  double cx, cy, half; //Square covered by this node.
+  double mass;
+  double comx, comy; //Centre of mass.
+  int first, count; //Bodies in this subtree.
+  int child[4]; //NW, NE, SW, SE node indices, or -1 at a leaf.
+} bhNode;
+
+typedef struct bhTree {
+  bhNode *nodes;
+  int n;
+  int capacity;
+} bhTree;
+
+//Encapsulates all data for each thread.
+struct thread_data {
+  pthread_t thread_id;
+  const bhTree *tree;
+  const body *bodies;
+  double *ax, *ay;
+  int start, end;
+  double theta;
+};
+
+static int AddNode(bhTree *tree, double cx, double cy, double half, int first, int count){
+
+  if(tree->n == tree->capacity){
+    tree->capacity = tree->capacity ? 2*tree->capacity : 1024;
+    tree->nodes = realloc(tree->nodes,tree->capacity*sizeof(bhNode));
+    if(tree->nodes == NULL) errx(1,"Could not grow tree!");
+  }
+  bhNode *node = &tree->nodes[tree->n];
+  node->cx = cx;
+  node->cy = cy;
+  node->half = half;
+  node->first = first;
+  node->count = count;
+  node->child[0] = node->child[1] = node->child[2] = node->child[3] = -1;
+  return tree->n++;
+
+}
+
+//Moves bodies in [lo,hi) satisfying the predicate to the front. Returns the split point.
+static int Partition(body *bodies, int lo, int hi, int axis, double pivot){
+
+  while(lo < hi){
+    double v = axis ? bodies[lo].y : bodies[lo].x;
+    if(v >= pivot){
+      body t = bodies[--hi];
+      bodies[hi] = bodies[lo];
+      bodies[lo] = t;
+    }
+    else{
+      lo++;
+    }
+  }
+  return lo;
+
+}
+
+//Builds node index's subtree and fills in its mass and centre of mass.
+static void BuildNode(bhTree *tree, body *bodies, int index, int depth){
+
+  bhNode node = tree->nodes[index];
+  int i, q;
+
+  if(node.count <= LEAF_BODIES || depth >= MAX_DEPTH){
+    double m = 0.0, mx = 0.0, my = 0.0;
+    for(i=node.first;i<node.first+node.count;i++){
+      m += bodies[i].mass;
+      mx += bodies[i].mass*bodies[i].x;
+      my += bodies[i].mass*bodies[i].y;
+    }
+    tree->nodes[index].mass = m;
+    tree->nodes[index].comx = m > 0 ? mx/m : node.cx;
+    tree->nodes[index].comy = m > 0 ? my/m : node.cy;
+    return;
+  }
+
+  //Split into south|north, then each half into west|east: SW, SE, NW, NE in memory.
+  int end = node.first + node.count;
+  int north = Partition(bodies,node.first,end,1,node.cy);
+  int southeast = Partition(bodies,node.first,north,0,node.cx);
+  int northeast = Partition(bodies,north,end,0,node.cx);
+  int starts[4] = {north,northeast,node.first,southeast}; //NW, NE, SW, SE
+  int stops[4] = {northeast,end,southeast,north};
+  double h = node.half/2;
+  double cxs[4] = {node.cx-h,node.cx+h,node.cx-h,node.cx+h};
+  double cys[4] = {node.cy+h,node.cy+h,node.cy-h,node.cy-h};
+
+  double m = 0.0, mx = 0.0, my = 0.0;
+  for(q=0;q<4;q++){
+    if(stops[q] == starts[q]) continue;
+    int c = AddNode(tree,cxs[q],cys[q],h,starts[q],stops[q]-starts[q]);
+    tree->nodes[index].child[q] = c;
+    BuildNode(tree,bodies,c,depth+1);
+    m += tree->nodes[c].mass;
+    mx += tree->nodes[c].mass*tree->nodes[c].comx;
+    my += tree->nodes[c].mass*tree->nodes[c].comy;
+  }
+  tree->nodes[index].mass = m;
+  tree->nodes[index].comx = m > 0 ? mx/m : node.cx;
+  tree->nodes[index].comy = m > 0 ? my/m : node.cy;
+
+}
+
+//Builds the tree over bodies, reordering them into tree order.
+void BuildBarnesHut(bhTree *tree, body *bodies, int n){
+
+  double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+  int i;
+
+  for(i=0;i<n;i++){
+    xmin = fmin(xmin,bodies[i].x);
+    xmax = fmax(xmax,bodies[i].x);
+    ymin = fmin(ymin,bodies[i].y);
+    ymax = fmax(ymax,bodies[i].y);
+  }
+  //Slightly enlarged so bodies on the edge fall inside.
+  double half = 0.5*fmax(xmax-xmin,ymax-ymin)*(1+1e-9) + 1e-300;
+  tree->n = 0;
+  AddNode(tree,0.5*(xmin+xmax),0.5*(ymin+ymax),half,0,n);
+  BuildNode(tree,bodies,0,0);
+
+}
+
+//Acceleration (with G = 1) on a point at (x,y), excluding the body at index self.
+static void Accelerate(const bhTree *tree, const body *bodies, int self, double x, double y,
+                       double theta, double *ax, double *ay){
+
+  int stack[4*MAX_DEPTH+4];
+  int top = 0, i;
+  double fx = 0.0, fy = 0.0;
+  double theta2 = theta*theta;
+
+  stack[top++] = 0;
+  while(top > 0){
+    const bhNode *node = &tree->nodes[stack[--top]];
+    if(node->child[0] < 0 && node->child[1] < 0 && node->child[2] < 0 && node->child[3] < 0){
+      for(i=node->first;i<node->first+node->count;i++){
+        if(i == self) continue;
+        double dx = bodies[i].x - x, dy = bodies[i].y - y;
+        double r2 = dx*dx + dy*dy + SOFTENING;
+        double inv = bodies[i].mass/(r2*sqrt(r2));
+        fx += dx*inv;
+        fy += dy*inv;
+      }
+      continue;
+    }
+    double dx = node->comx - x, dy = node->comy - y;
+    double r2 = dx*dx + dy*dy;
+    double s = 2*node->half;
+    int inside = fabs(x-node->cx) <= node->half && fabs(y-node->cy) <= node->half;
+    //s/d < theta, and never approximate a node containing the point itself.
+    if(!inside && s*s < theta2*r2){
+      r2 += SOFTENING;
+      double inv = node->mass/(r2*sqrt(r2));
+      fx += dx*inv;
+      fy += dy*inv;
+    }
+    else{
+      int q;
+      for(q=0;q<4;q++){
+        if(node->child[q] >= 0) stack[top++] = node->child[q];
+      }
+    }
+  }
+  *ax = fx;
+  *ay = fy;
+
+}
+
+void *force_worker(void *threadArg){
+
+  struct thread_data *data = (struct thread_data *) threadArg;
+  int i;
+  for(i=data->start;i<data->end;i++){
+    Accelerate(data->tree,data->bodies,i,data->bodies[i].x,data->bodies[i].y,data->theta,&data->ax[i],&data->ay[i]);
+  }
+  return NULL;
+
+}
+
+//Accelerations on every body, split across threads.
+void BarnesHutForces(const bhTree *tree, const body *bodies, int n, double theta, double *ax, double *ay, int threads){
+
+  struct thread_data *data = malloc(threads*sizeof(struct thread_data));
+  int t;
+
+  for(t=0;t<threads;t++){
+    data[t].tree = tree;
+    data[t].bodies = bodies;
+    data[t].ax = ax;
+    data[t].ay = ay;
+    data[t].theta = theta;
+    data[t].start = (int)((long)n*t/threads);
+    data[t].end = (int)((long)n*(t+1)/threads);
+    if(pthread_create(&data[t].thread_id,NULL,force_worker,&data[t])) errx(1,"Thread creation failed.");
+  }
+  for(t=0;t<threads;t++) pthread_join(data[t].thread_id,NULL);
+  free(data);
+
+}
+
+//O(N^2) reference.
+void DirectForces(const body *bodies, int n, double *ax, double *ay){
+
+  int i,j;
+  for(i=0;i<n;i++){
+    double fx = 0.0, fy = 0.0;
+    for(j=0;j<n;j++){
+      if(j == i) continue;
+      double dx = bodies[j].x - bodies[i].x, dy = bodies[j].y - bodies[i].y;
+      double r2 = dx*dx + dy*dy + SOFTENING;
+      double inv = bodies[j].mass/(r2*sqrt(r2));
+      fx += dx*inv;
+      fy += dy*inv;
+    }
+    ax[i] = fx;
+    ay[i] = fy;
+  }
+
+}
+
+//A disc galaxy-like distribution: dense core, exponential fall-off.
+static void MakeBodies(body *bodies, int n){
+
+  int i;
+  for(i=0;i<n;i++){
+    double u = ((double)rand()+1)/((double)RAND_MAX+2);
+    double r = -0.1*log(u);
+    double a = 2*M_PI*rand()/((double)RAND_MAX+1);
+    bodies[i].x = r*cos(a);
+    bodies[i].y = r*sin(a);
+    bodies[i].mass = 1.0/n;
+  }
+
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int n = argc > 1 ? strtol(argv[1],NULL,10) : 1000000;
+  int threads = argc > 2 ? strtol(argv[2],NULL,10) : 4;
+  double thetas[] = {0.3,0.5,0.7,1.0};
+  int small = 5000;
+  int i,k;
+
+  if(n < 2 || threads < 1) errx(1,"Usage: %s [bodies] [threads]",argv[0]);
+  srand(1);
+
+  //Accuracy against direct summation.
+  body *bodies = malloc(small*sizeof(body));
+  double *ax = malloc(small*sizeof(double)), *ay = malloc(small*sizeof(double));
+  double *dx = malloc(small*sizeof(double)), *dy = malloc(small*sizeof(double));
+  MakeBodies(bodies,small);
+  bhTree tree = {NULL,0,0};
+  BuildBarnesHut(&tree,bodies,small);
+  double t0 = seconds();
+  DirectForces(bodies,small,dx,dy);
+  double t1 = seconds();
+  double direct = t1-t0;
+  printf("Direct summation, %d bodies: %f s\n",small,direct);
+  for(k=0;k<4;k++){
+    t0 = seconds();
+    BarnesHutForces(&tree,bodies,small,thetas[k],ax,ay,threads);
+    t1 = seconds();
+    double err2 = 0.0, ref2 = 0.0, worst = 0.0;
+    for(i=0;i<small;i++){
+      double ex = ax[i]-dx[i], ey = ay[i]-dy[i];
+      double e = sqrt(ex*ex+ey*ey)/sqrt(dx[i]*dx[i]+dy[i]*dy[i]);
+      err2 += ex*ex+ey*ey;
+      ref2 += dx[i]*dx[i]+dy[i]*dy[i];
+      if(e > worst) worst = e;
+    }
+    printf("  theta %.1f: %f s, rms relative error %.2e, worst body %.2e\n",thetas[k],t1-t0,sqrt(err2/ref2),worst);
+    if(thetas[k] <= 0.5 && sqrt(err2/ref2) > 1e-2) errx(1,"Barnes-Hut error too large!");
+  }
+  //theta = 0 opens every node and must agree with direct summation to rounding.
+  BarnesHutForces(&tree,bodies,small,0.0,ax,ay,threads);
+  for(i=0;i<small;i++){
+    if(fabs(ax[i]-dx[i]) > 1e-9*(fabs(dx[i])+1) || fabs(ay[i]-dy[i]) > 1e-9*(fabs(dy[i])+1))
+      errx(1,"theta = 0 disagrees with direct summation at body %d!",i);
+  }
+  free(bodies); free(ax); free(ay); free(dx); free(dy);
+
+  //Large N.
+  bodies = malloc((size_t)n*sizeof(body));
+  ax = malloc((size_t)n*sizeof(double));
+  ay = malloc((size_t)n*sizeof(double));
+  MakeBodies(bodies,n);
+  t0 = seconds();
+  BuildBarnesHut(&tree,bodies,n);
+  t1 = seconds();
+  BarnesHutForces(&tree,bodies,n,0.5,ax,ay,threads);
+  double t2 = seconds();
+  printf("%d bodies: build %f s (%d nodes), forces at theta 0.5 %f s with %d threads (direct would be ~%.0f s)\n",
+         n,t1-t0,tree.n,t2-t1,threads,direct*((double)n/small)*((double)n/small));
+
+  free(tree.nodes);
+  free(bodies);
+  free(ax);
+  free(ay);
+  return 0;
+}
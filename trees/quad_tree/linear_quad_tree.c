@@ -0,0 +1,509 @@
+/* Pointerless (linear) quadtree over 2D points.
+ *
+ * Points in [0,1)^2 are quantized to a 2^LEVELS grid and given a 32-bit Morton (Z-order)
+ * code, then sorted by code with a threaded LSD radix sort. Every quadtree node is then a
+ * contiguous run of the sorted points, so the tree is just a few flat arrays in pre-order:
+ * a locational key per node (the node's Morton prefix below a sentinel 1 bit), its point
+ * range and the index just past its subtree. Parent, child and neighbour keys are found
+ * with bit arithmetic (PDEP/PEXT when compiled with BMI2) and looked up by binary search,
+ * and range queries are a forward scan that skips whole subtrees. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#define LEVELS 16 //Bits per coordinate; Morton codes use 2*LEVELS bits.
+#define BUCKET_SIZE 16
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
+//Sorted points and pre-order nodes, all structure-of-arrays.
+typedef struct linearTree {
+
+  int n;
+  uint32_t *code;
+  double *x;
+  double *y;
+  int *id;
+
+  int nodes;
+  int capacity;
+  uint64_t *key; //Sentinel bit at 2*level, then the level*2 bit Morton prefix.
+  uint64_t *order; //Aligned prefix << 8 | level: ascending in pre-order, for searching.
+  int *first; //First point in this node.
+  int *count; //Points in this node.
+  int *next; //Index of the first node after this subtree.
+} linearTree;
+
+#ifndef __BMI2__
+//Spreads the low 16 bits of v to the even bits.
+static inline uint32_t Part1By1(uint32_t v){
+
+  v &= 0x0000ffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+
+}
+
+//Inverse of Part1By1.
+static inline uint32_t Compact1By1(uint32_t v){
+
+  v &= 0x55555555;
+  v = (v | (v >> 1)) & 0x33333333;
+  v = (v | (v >> 2)) & 0x0f0f0f0f;
+  v = (v | (v >> 4)) & 0x00ff00ff;
+  v = (v | (v >> 8)) & 0x0000ffff;
+  return v;
+
+}
+#endif
+
+static inline uint32_t MortonEncode(uint32_t x, uint32_t y){
+#ifdef __BMI2__
+  return _pdep_u32(x,0x55555555) | _pdep_u32(y,0xaaaaaaaa);
+#else
+  return Part1By1(x) | (Part1By1(y) << 1);
+#endif
+}
+
+static inline void MortonDecode(uint32_t code, uint32_t *x, uint32_t *y){
+#ifdef __BMI2__
+  *x = _pext_u32(code,0x55555555);
+  *y = _pext_u32(code,0xaaaaaaaa);
+#else
+  *x = Compact1By1(code);
+  *y = Compact1By1(code >> 1);
+#endif
+}
+
+static inline uint32_t Quantize(double v){
+
+  if(v <= 0.0) return 0;
+  if(v >= 1.0) return (1u << LEVELS) - 1;
+  return (uint32_t)(v * (1u << LEVELS));
+
+}
+
+//Navigation on locational keys.
+static inline int KeyLevel(uint64_t key){
+  return (63 - __builtin_clzll(key)) / 2;
+}
+
+static inline uint64_t ParentKey(uint64_t key){
+  return key >> 2;
+}
+
+//Quadrant q: bit 0 is east, bit 1 is north.
+static inline uint64_t ChildKey(uint64_t key, int q){
+  return (key << 2) | q;
+}
+
+//Morton code of the node's lower-left cell at full resolution.
+static inline uint32_t KeyAligned(uint64_t key){
+
+  int level = KeyLevel(key);
+  return (uint32_t)((key ^ (1ull << 2*level)) << 2*(LEVELS-level));
+
+}
+
+static inline uint64_t OrderOf(uint64_t key){
+  return ((uint64_t)KeyAligned(key) << 8) | KeyLevel(key);
+}
+
+//Key of the same-level node offset by (dx,dy) cells, or 0 if that is outside the tree.
+uint64_t NeighbourKey(uint64_t key, int dx, int dy){
+
+  int level = KeyLevel(key);
+  uint32_t x, y;
+  MortonDecode((uint32_t)(key ^ (1ull << 2*level)),&x,&y);
+  int64_t nx = (int64_t)x + dx, ny = (int64_t)y + dy;
+  if(nx < 0 || ny < 0 || nx >= (1 << level) || ny >= (1 << level)) return 0;
+  return (1ull << 2*level) | MortonEncode((uint32_t)nx,(uint32_t)ny);
+
+}
+
+//Index of the node with this key, or -1 if the tree does not go that deep there.
+int FindNode(const linearTree *tree, uint64_t key){
+
+  uint64_t target = OrderOf(key);
+  int lo = 0, hi = tree->nodes;
+  while(lo < hi){
+    int mid = lo + (hi-lo)/2;
+    if(tree->order[mid] < target) lo = mid+1;
+    else hi = mid;
+  }
+  return (lo < tree->nodes && tree->order[lo] == target) ? lo : -1;
+
+}
+
+//Index of the leaf containing (x,y): the last node in pre-order starting at or before its code.
+int LocateLeaf(const linearTree *tree, double x, double y){
+
+  uint64_t target = ((uint64_t)MortonEncode(Quantize(x),Quantize(y)) << 8) | 0xff;
+  int lo = 0, hi = tree->nodes;
+  while(lo < hi){
+    int mid = lo + (hi-lo)/2;
+    if(tree->order[mid] <= target) lo = mid+1;
+    else hi = mid;
+  }
+  return lo-1;
+
+}
+
+//Encapsulates all data for each sorting thread.
+struct thread_data {
+  pthread_t thread_id;
+  int thread_index;
+  int threads;
+  int n;
+  int shift;
+  const uint32_t *keys;
+  uint32_t *keys_out;
+  const int *perm;
+  int *perm_out;
+  size_t *histogram; //This thread's RADIX counts, then its scatter offsets.
+};
+
+//Counts the current digit over this thread's slice.
+void *radix_count_worker(void *threadArg){
+
+  struct thread_data *data = (struct thread_data *) threadArg;
+  int start = (int)((long)data->n*data->thread_index/data->threads);
+  int end = (int)((long)data->n*(data->thread_index+1)/data->threads);
+  int i;
+
+  memset(data->histogram,0,RADIX*sizeof(size_t));
+  for(i=start;i<end;i++){
+    data->histogram[(data->keys[i] >> data->shift) & (RADIX-1)]++;
+  }
+  return NULL;
+
+}
+
+//Scatters this thread's slice to its precomputed offsets; slices go in thread order so the pass is stable.
+void *radix_scatter_worker(void *threadArg){
+
+  struct thread_data *data = (struct thread_data *) threadArg;
+  int start = (int)((long)data->n*data->thread_index/data->threads);
+  int end = (int)((long)data->n*(data->thread_index+1)/data->threads);
+  int i;
+
+  for(i=start;i<end;i++){
+    size_t dst = data->histogram[(data->keys[i] >> data->shift) & (RADIX-1)]++;
+    data->keys_out[dst] = data->keys[i];
+    data->perm_out[dst] = data->perm[i];
+  }
+  return NULL;
+
+}
+
+//Sorts keys ascending with LSD radix sort and returns the permutation applied, perm[i] being
+//the original index of the i-th smallest key. keys is overwritten with the sorted keys.
+int* RadixSortKeys(uint32_t *keys, int n, int threads){
+
+  uint32_t *keys_tmp = malloc((size_t)n*sizeof(uint32_t));
+  int *perm = malloc((size_t)n*sizeof(int));
+  int *perm_tmp = malloc((size_t)n*sizeof(int));
+  size_t *histograms = malloc((size_t)threads*RADIX*sizeof(size_t));
+  struct thread_data *data = malloc(threads*sizeof(struct thread_data));
+  int i, t, d, shift;
+
+  for(i=0;i<n;i++) perm[i] = i;
+  for(shift=0;shift<2*LEVELS;shift+=RADIX_BITS){
+    for(t=0;t<threads;t++){
+      data[t].thread_index = t;
+      data[t].threads = threads;
+      data[t].n = n;
+      data[t].shift = shift;
+      data[t].keys = keys;
+      data[t].keys_out = keys_tmp;
+      data[t].perm = perm;
+      data[t].perm_out = perm_tmp;
+      data[t].histogram = histograms + (size_t)t*RADIX;
+      if(pthread_create(&data[t].thread_id,NULL,radix_count_worker,&data[t])) errx(1,"Thread creation failed.");
+    }
+    for(t=0;t<threads;t++) pthread_join(data[t].thread_id,NULL);
+
+    //Digit-major, thread-minor prefix sum gives every thread its own output window.
+    size_t offset = 0;
+    for(d=0;d<RADIX;d++){
+      for(t=0;t<threads;t++){
+        size_t c = histograms[(size_t)t*RADIX+d];
+        histograms[(size_t)t*RADIX+d] = offset;
+        offset += c;
+      }
+    }
+
+    for(t=0;t<threads;t++){
+      if(pthread_create(&data[t].thread_id,NULL,radix_scatter_worker,&data[t])) errx(1,"Thread creation failed.");
+    }
+    for(t=0;t<threads;t++) pthread_join(data[t].thread_id,NULL);
+
+    uint32_t *kswap = keys_tmp; keys_tmp = keys; keys = kswap;
+    int *pswap = perm_tmp; perm_tmp = perm; perm = pswap;
+  }
+  //An even number of passes leaves the results back in the caller's array.
+  free(keys_tmp);
+  free(perm_tmp);
+  free(histograms);
+  free(data);
+  return perm;
+
+}
+
+static int AddNode(linearTree *tree, uint64_t key, int first, int count){
+
+  if(tree->nodes == tree->capacity){
+    tree->capacity = tree->capacity ? 2*tree->capacity : 1024;
+    tree->key = realloc(tree->key,tree->capacity*sizeof(uint64_t));
+    tree->order = realloc(tree->order,tree->capacity*sizeof(uint64_t));
+    tree->first = realloc(tree->first,tree->capacity*sizeof(int));
+    tree->count = realloc(tree->count,tree->capacity*sizeof(int));
+    tree->next = realloc(tree->next,tree->capacity*sizeof(int));
+    if(!tree->key || !tree->order || !tree->first || !tree->count || !tree->next) errx(1,"Could not grow tree!");
+  }
+  int i = tree->nodes++;
+  tree->key[i] = key;
+  tree->order[i] = OrderOf(key);
+  tree->first[i] = first;
+  tree->count[i] = count;
+  return i;
+
+}
+
+//First index in [lo,hi) whose code is >= target.
+static int LowerBound(const uint32_t *code, int lo, int hi, uint32_t target){
+
+  while(lo < hi){
+    int mid = lo + (hi-lo)/2;
+    if(code[mid] < target) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+
+}
+
+//Emits the node and, if it holds too many points, all four children (even empty ones, so
+//the leaves tile the plane).
+static void BuildNodes(linearTree *tree, uint64_t key, int first, int count){
+
+  int i = AddNode(tree,key,first,count);
+  int level = KeyLevel(key);
+
+  if(count > BUCKET_SIZE && level < LEVELS){
+    int end = first + count;
+    int q;
+    for(q=0;q<4;q++){
+      uint64_t child = ChildKey(key,q);
+      int start = LowerBound(tree->code,first,end,KeyAligned(child));
+      int stop = q == 3 ? end : LowerBound(tree->code,start,end,KeyAligned(ChildKey(key,q+1)));
+      BuildNodes(tree,child,start,stop-start);
+    }
+  }
+  tree->next[i] = tree->nodes;
+
+}
+
+//Builds the tree from n points in [0,1)^2; the point arrays are copied in sorted order.
+void BuildLinearTree(linearTree *tree, const double *x, const double *y, int n, int threads){
+
+  int i;
+
+  memset(tree,0,sizeof(linearTree));
+  tree->n = n;
+  tree->code = malloc((size_t)n*sizeof(uint32_t));
+  tree->x = malloc((size_t)n*sizeof(double));
+  tree->y = malloc((size_t)n*sizeof(double));
+  tree->id = malloc((size_t)n*sizeof(int));
+  for(i=0;i<n;i++) tree->code[i] = MortonEncode(Quantize(x[i]),Quantize(y[i]));
+
+  int *perm = RadixSortKeys(tree->code,n,threads);
+  for(i=0;i<n;i++){
+    tree->x[i] = x[perm[i]];
+    tree->y[i] = y[perm[i]];
+    tree->id[i] = perm[i];
+  }
+  free(perm);
+
+  BuildNodes(tree,1,0,n);
+
+}
+
+void FreeLinearTree(linearTree *tree){
+
+  free(tree->code);
+  free(tree->x);
+  free(tree->y);
+  free(tree->id);
+  free(tree->key);
+  free(tree->order);
+  free(tree->first);
+  free(tree->count);
+  free(tree->next);
+
+}
+
+//Counts the points in [xmin,xmax] x [ymin,ymax], writing their ids to out (at most max).
+//Walks the nodes in order, jumping over subtrees that miss the box and taking subtrees
+//inside it wholesale.
+int RangeQuery(const linearTree *tree, double xmin, double ymin, double xmax, double ymax, int *out, int max){
+
+  const double scale = 1.0 / (1u << LEVELS);
+  int found = 0, i = 0, j;
+
+  while(i < tree->nodes){
+    uint32_t cx, cy;
+    int level = KeyLevel(tree->key[i]);
+    MortonDecode(KeyAligned(tree->key[i]),&cx,&cy);
+    double side = (double)(1u << (LEVELS-level)) * scale;
+    double x0 = cx*scale, y0 = cy*scale;
+    //Points in the node satisfy x0 <= x < x0+side.
+    if(tree->count[i] == 0 || x0+side <= xmin || x0 > xmax || y0+side <= ymin || y0 > ymax){
+      i = tree->next[i];
+    }
+    else if(x0 >= xmin && x0+side <= xmax && y0 >= ymin && y0+side <= ymax){
+      for(j=tree->first[i];j<tree->first[i]+tree->count[i];j++){
+        if(found < max) out[found] = tree->id[j];
+        found++;
+      }
+      i = tree->next[i];
+    }
+    else if(tree->next[i] == i+1){
+      for(j=tree->first[i];j<tree->first[i]+tree->count[i];j++){
+        if(tree->x[j] >= xmin && tree->x[j] <= xmax && tree->y[j] >= ymin && tree->y[j] <= ymax){
+          if(found < max) out[found] = tree->id[j];
+          found++;
+        }
+      }
+      i++;
+    }
+    else{
+      i++;
+    }
+  }
+  return found;
+
+}
+
+static int CompareCodes(const void *a, const void *b){
+
+  uint32_t ca = *(const uint32_t *)a, cb = *(const uint32_t *)b;
+  return (ca > cb) - (ca < cb);
+
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int n = argc > 1 ? strtol(argv[1],NULL,10) : 4000000;
+  int threads = argc > 2 ? strtol(argv[2],NULL,10) : 4;
+  int queries = 1000, brutequeries = 20;
+  int i, q;
+
+  if(n < 1 || threads < 1) errx(1,"Usage: %s [points] [threads]",argv[0]);
+
+  double *x = malloc((size_t)n*sizeof(double));
+  double *y = malloc((size_t)n*sizeof(double));
+  srand(1);
+  for(i=0;i<n;i++){
+    //Squaring skews the points towards the origin so the tree is uneven.
+    double u = (double)rand()/((double)RAND_MAX+1), v = (double)rand()/((double)RAND_MAX+1);
+    x[i] = i % 2 ? u*u : u;
+    y[i] = i % 2 ? v*v : v;
+  }
+
+  //Radix sort against qsort on the same codes.
+  uint32_t *codes = malloc((size_t)n*sizeof(uint32_t));
+  uint32_t *sorted = malloc((size_t)n*sizeof(uint32_t));
+  for(i=0;i<n;i++) codes[i] = sorted[i] = MortonEncode(Quantize(x[i]),Quantize(y[i]));
+  double t0 = seconds();
+  qsort(sorted,n,sizeof(uint32_t),CompareCodes);
+  double t1 = seconds();
+  int *perm = RadixSortKeys(codes,n,threads);
+  double t2 = seconds();
+  for(i=0;i<n;i++){
+    if(codes[i] != sorted[i]) errx(1,"Radix sort mismatch at %d!",i);
+    if(MortonEncode(Quantize(x[perm[i]]),Quantize(y[perm[i]])) != codes[i]) errx(1,"Permutation mismatch at %d!",i);
+  }
+  printf("Sorting %d Morton codes: qsort %f s, radix sort (%d threads) %f s\n",n,t1-t0,threads,t2-t1);
+  free(codes);
+  free(sorted);
+  free(perm);
+
+  linearTree tree;
+  t0 = seconds();
+  BuildLinearTree(&tree,x,y,n,threads);
+  t1 = seconds();
+  printf("Built linear quadtree: %d nodes in %f s (%.1f bytes per node)\n",tree.nodes,t1-t0,
+         (double)(2*sizeof(uint64_t)+3*sizeof(int)));
+
+  //Navigation: every node's parent and children are where their keys say they are.
+  for(i=1;i<tree.nodes;i++){
+    int parent = FindNode(&tree,ParentKey(tree.key[i]));
+    if(parent < 0 || parent >= i || tree.next[parent] < tree.next[i]) errx(1,"Node %d has no parent!",i);
+    if(tree.next[i] != i+1){
+      int c;
+      for(c=0;c<4;c++){
+        if(FindNode(&tree,ChildKey(tree.key[i],c)) < 0) errx(1,"Node %d is missing child %d!",i,c);
+      }
+    }
+  }
+  //Every point lies in the leaf LocateLeaf returns.
+  for(i=0;i<tree.n;i+=97){
+    int leaf = LocateLeaf(&tree,tree.x[i],tree.y[i]);
+    if(tree.next[leaf] != leaf+1 || i < tree.first[leaf] || i >= tree.first[leaf]+tree.count[leaf])
+      errx(1,"Point %d located in the wrong leaf!",i);
+  }
+  //Same-level neighbours of a deep leaf share an edge with it. The root has none.
+  int deep = LocateLeaf(&tree,0.01,0.01);
+  uint64_t east = NeighbourKey(tree.key[deep],1,0);
+  if(KeyLevel(tree.key[deep]) == 0){
+    if(east != 0) errx(1,"Root has a neighbour!");
+  }
+  else if(east == 0 || KeyLevel(east) != KeyLevel(tree.key[deep])) errx(1,"Neighbour key at wrong level!");
+  printf("Navigation checks passed (leaf at (0.01,0.01) is level %d)\n",KeyLevel(tree.key[deep]));
+
+  int *out = malloc((size_t)n*sizeof(int));
+  double box = 0.02;
+  long total = 0;
+  t0 = seconds();
+  for(q=0;q<queries;q++){
+    double qx = (double)(q*7919 % 1000)/1000, qy = (double)(q*104729 % 1000)/1000;
+    total += RangeQuery(&tree,qx,qy,qx+box,qy+box,out,n);
+  }
+  t1 = seconds();
+  for(q=0;q<brutequeries;q++){
+    double qx = (double)(q*7919 % 1000)/1000, qy = (double)(q*104729 % 1000)/1000;
+    int brute = 0;
+    for(i=0;i<n;i++){
+      if(x[i] >= qx && x[i] <= qx+box && y[i] >= qy && y[i] <= qy+box) brute++;
+    }
+    if(brute != RangeQuery(&tree,qx,qy,qx+box,qy+box,out,n)) errx(1,"Range query %d mismatch!",q);
+  }
+  t2 = seconds();
+  printf("Range query: %.2f us per query (%.1f hits), brute force %.2f us\n",
+         (t1-t0)/queries*1e6,(double)total/queries,(t2-t1)/brutequeries*1e6);
+
+  FreeLinearTree(&tree);
+  free(out);
+  free(x);
+  free(y);
+  return 0;
+}
@@ -0,0 +1,532 @@
+/* Point-region quadtree for large sets of 2D points.
+ *
+ * Each node covers a square of the plane. Leaves hold up to BUCKET_SIZE points and split
+ * into four equal quadrants when they overflow; deleting points collapses a subtree back
+ * into a leaf once it fits in one bucket again. Supports rectangular range queries and
+ * k-nearest-neighbour search, which visits nodes best-first from a priority queue ordered
+ * by distance to each node's square. main() benchmarks both against brute force. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+
+#define BUCKET_SIZE 16
+#define MAX_DEPTH 24 //Stops coincident points splitting forever; leaves at this depth grow.
+
+typedef struct point{
+  double x;
+  double y;
+  int id;
+} point;
+
+typedef struct pointNode{
+
+  double xmin, ymin, xmax, ymax; //Bounds of this node's square. A child's inner edges are
+                                 //exactly its parent's centre lines.
+  double cx, cy; //Centre, where points are split between the children.
+  int count; //Points in this subtree.
+  int depth;
+
+  //Bucket, only used at leaves.
+  point *points;
+  int capacity;
+
+  struct pointNode *NorthWest;
+  struct pointNode *NorthEast;
+  struct pointNode *SouthWest;
+  struct pointNode *SouthEast;
+} pointNode;
+
+static pointNode* InitBoundedNode(double xmin, double ymin, double xmax, double ymax, int depth){
+
+  pointNode *temp = malloc(sizeof(pointNode));
+  if(temp == NULL) errx(1,"Could not allocate node!");
+  temp->xmin = xmin;
+  temp->ymin = ymin;
+  temp->xmax = xmax;
+  temp->ymax = ymax;
+  temp->cx = (xmin+xmax)/2;
+  temp->cy = (ymin+ymax)/2;
+  temp->count = 0;
+  temp->depth = depth;
+  temp->capacity = BUCKET_SIZE;
+  temp->points = malloc(BUCKET_SIZE*sizeof(point));
+  temp->NorthWest = temp->NorthEast =
+    temp->SouthWest = temp->SouthEast = NULL;
+  return temp;
+
+}
+
+//Returns an empty leaf covering the square centred on (cx,cy).
+pointNode* InitPointNode(double cx, double cy, double half, int depth){
+  return InitBoundedNode(cx-half,cy-half,cx+half,cy+half,depth);
+}
+
+static inline int IsLeaf(const pointNode *node){
+  return node->NorthWest == NULL;
+}
+
+//North is +y, east is +x. Points on a dividing line go north/east.
+static inline pointNode* ChildFor(pointNode *node, double x, double y){
+
+  if(y >= node->cy) return x >= node->cx ? node->NorthEast : node->NorthWest;
+  return x >= node->cx ? node->SouthEast : node->SouthWest;
+
+}
+
+static void AppendPoint(pointNode *leaf, point p){
+
+  if(leaf->count == leaf->capacity){
+    leaf->capacity *= 2;
+    leaf->points = realloc(leaf->points,leaf->capacity*sizeof(point));
+    if(leaf->points == NULL) errx(1,"Could not grow bucket!");
+  }
+  leaf->points[leaf->count++] = p;
+
+}
+
+static void Split(pointNode *node){
+
+  int i;
+
+  node->NorthWest = InitBoundedNode(node->xmin,node->cy,node->cx,node->ymax,node->depth+1);
+  node->NorthEast = InitBoundedNode(node->cx,node->cy,node->xmax,node->ymax,node->depth+1);
+  node->SouthWest = InitBoundedNode(node->xmin,node->ymin,node->cx,node->cy,node->depth+1);
+  node->SouthEast = InitBoundedNode(node->cx,node->ymin,node->xmax,node->cy,node->depth+1);
+  for(i=0;i<node->count;i++){
+    point p = node->points[i];
+    AppendPoint(ChildFor(node,p.x,p.y),p);
+  }
+  free(node->points);
+  node->points = NULL;
+  node->capacity = 0;
+
+}
+
+//Inserts p. Returns 0 if p lies outside the root square.
+int InsertPoint(pointNode *root, point p){
+
+  pointNode *node = root;
+
+  //Only the root is bounds checked: ChildFor always picks a child whose square holds p.
+  if(p.x < root->xmin || p.x > root->xmax || p.y < root->ymin || p.y > root->ymax) return 0;
+  for(;;){
+    while(!IsLeaf(node)){
+      node->count++;
+      node = ChildFor(node,p.x,p.y);
+    }
+    if(node->count < BUCKET_SIZE || node->depth >= MAX_DEPTH) break;
+    Split(node); //Then keep descending from the new internal node.
+  }
+  AppendPoint(node,p);
+  return 1;
+
+}
+
+//Moves every point below node into leaf.
+static void Gather(pointNode *node, pointNode *leaf){
+
+  if(IsLeaf(node)){
+    int i;
+    for(i=0;i<node->count;i++) AppendPoint(leaf,node->points[i]);
+    return;
+  }
+  Gather(node->NorthWest,leaf);
+  Gather(node->NorthEast,leaf);
+  Gather(node->SouthWest,leaf);
+  Gather(node->SouthEast,leaf);
+
+}
+
+void DeletePointTree(pointNode *node){
+
+  if(!IsLeaf(node)){
+    DeletePointTree(node->NorthWest);
+    DeletePointTree(node->NorthEast);
+    DeletePointTree(node->SouthWest);
+    DeletePointTree(node->SouthEast);
+  }
+  free(node->points);
+  free(node);
+
+}
+
+//Turns an interior node whose subtree fits in one bucket back into a leaf.
+static void Collapse(pointNode *node){
+
+  pointNode *children[4] = {node->NorthWest,node->NorthEast,node->SouthWest,node->SouthEast};
+  int i;
+
+  node->points = malloc(BUCKET_SIZE*sizeof(point));
+  node->capacity = BUCKET_SIZE;
+  node->NorthWest = node->NorthEast = node->SouthWest = node->SouthEast = NULL;
+  node->count = 0;
+  for(i=0;i<4;i++){
+    Gather(children[i],node);
+    DeletePointTree(children[i]);
+  }
+
+}
+
+//Removes the point with this id at (x,y). Returns 0 if it was not found.
+int DeletePoint(pointNode *root, double x, double y, int id){
+
+  pointNode *path[MAX_DEPTH+1];
+  pointNode *node = root;
+  int depth = 0, i;
+
+  if(x < root->xmin || x > root->xmax || y < root->ymin || y > root->ymax) return 0;
+  while(!IsLeaf(node)){
+    path[depth++] = node;
+    node = ChildFor(node,x,y);
+  }
+  for(i=0;i<node->count;i++){
+    if(node->points[i].id == id && node->points[i].x == x && node->points[i].y == y) break;
+  }
+  if(i == node->count) return 0;
+  node->points[i] = node->points[--node->count];
+
+  //Fix counts on the way up, collapsing the highest ancestor that now fits in a bucket.
+  pointNode *collapse = NULL;
+  while(depth > 0){
+    pointNode *parent = path[--depth];
+    parent->count--;
+    if(parent->count <= BUCKET_SIZE) collapse = parent;
+  }
+  if(collapse != NULL) Collapse(collapse);
+  return 1;
+
+}
+
+//Appends points inside [xmin,xmax] x [ymin,ymax] to out (at most max of them).
+//Returns how many points matched, which may exceed max.
+static int RangeRecurse(const pointNode *node, double xmin, double ymin, double xmax, double ymax,
+                        point *out, int max, int found){
+
+  if(node->count == 0) return found;
+  if(node->xmax < xmin || node->xmin > xmax || node->ymax < ymin || node->ymin > ymax) return found;
+
+  if(IsLeaf(node)){
+    int i;
+    for(i=0;i<node->count;i++){
+      point p = node->points[i];
+      if(p.x >= xmin && p.x <= xmax && p.y >= ymin && p.y <= ymax){
+        if(found < max) out[found] = p;
+        found++;
+      }
+    }
+    return found;
+  }
+  found = RangeRecurse(node->NorthWest,xmin,ymin,xmax,ymax,out,max,found);
+  found = RangeRecurse(node->NorthEast,xmin,ymin,xmax,ymax,out,max,found);
+  found = RangeRecurse(node->SouthWest,xmin,ymin,xmax,ymax,out,max,found);
+  return RangeRecurse(node->SouthEast,xmin,ymin,xmax,ymax,out,max,found);
+
+}
+
+int RangeQuery(const pointNode *root, double xmin, double ymin, double xmax, double ymax, point *out, int max){
+  return RangeRecurse(root,xmin,ymin,xmax,ymax,out,max,0);
+}
+
+//Binary heap entry: either a node or a point, keyed by squared distance.
+struct heapentry {
+  double dist;
+  const void *item;
+};
+
+struct heap {
+  struct heapentry *entries;
+  int size;
+  int capacity;
+};
+
+//Min-heap when sign is 1, max-heap when sign is -1.
+static void HeapPush(struct heap *h, double dist, const void *item, int sign){
+
+  int i;
+  if(h->size == h->capacity){
+    h->capacity = h->capacity ? 2*h->capacity : 64;
+    h->entries = realloc(h->entries,h->capacity*sizeof(struct heapentry));
+    if(h->entries == NULL) errx(1,"Could not grow heap!");
+  }
+  i = h->size++;
+  while(i > 0 && sign*h->entries[(i-1)/2].dist > sign*dist){
+    h->entries[i] = h->entries[(i-1)/2];
+    i = (i-1)/2;
+  }
+  h->entries[i].dist = dist;
+  h->entries[i].item = item;
+
+}
+
+static struct heapentry HeapPop(struct heap *h, int sign){
+
+  struct heapentry top = h->entries[0];
+  struct heapentry last = h->entries[--h->size];
+  int i = 0;
+  while(2*i+1 < h->size){
+    int c = 2*i+1;
+    if(c+1 < h->size && sign*h->entries[c+1].dist < sign*h->entries[c].dist) c++;
+    if(sign*h->entries[c].dist >= sign*last.dist) break;
+    h->entries[i] = h->entries[c];
+    i = c;
+  }
+  h->entries[i] = last;
+  return top;
+
+}
+
+//Squared distance from (x,y) to the node's square; zero inside it.
+static inline double BoxDistance(const pointNode *node, double x, double y){
+
+  double dx = fmax(fmax(node->xmin-x,x-node->xmax),0.0);
+  double dy = fmax(fmax(node->ymin-y,y-node->ymax),0.0);
+  return dx*dx + dy*dy;
+
+}
+
+//Finds the k points nearest (x,y), nearest first. Returns how many were found (less
+//than k only if the tree holds fewer points). The heaps are reused between calls.
+int NearestNeighbours(const pointNode *root, double x, double y, int k, point *out,
+                      struct heap *nodes, struct heap *best){
+
+  int i, found;
+
+  nodes->size = best->size = 0;
+  if(k <= 0) return 0;
+  HeapPush(nodes,BoxDistance(root,x,y),root,1);
+  while(nodes->size > 0){
+    struct heapentry e = HeapPop(nodes,1);
+    const pointNode *node = e.item;
+    //Nothing left in the queue can beat the current k-th best.
+    if(best->size == k && e.dist >= best->entries[0].dist) break;
+    if(IsLeaf(node)){
+      for(i=0;i<node->count;i++){
+        const point *p = &node->points[i];
+        double d = (p->x-x)*(p->x-x) + (p->y-y)*(p->y-y);
+        if(best->size < k){
+          HeapPush(best,d,p,-1);
+        }
+        else if(d < best->entries[0].dist){
+          HeapPop(best,-1);
+          HeapPush(best,d,p,-1);
+        }
+      }
+    }
+    else{
+      const pointNode *children[4] = {node->NorthWest,node->NorthEast,node->SouthWest,node->SouthEast};
+      for(i=0;i<4;i++){
+        if(children[i]->count == 0) continue;
+        double d = BoxDistance(children[i],x,y);
+        if(best->size < k || d < best->entries[0].dist) HeapPush(nodes,d,children[i],1);
+      }
+    }
+  }
+  found = best->size;
+  for(i=found-1;i>=0;i--) out[i] = *(const point *)HeapPop(best,-1).item;
+  return found;
+
+}
+
+//Collects the split points of up to max internal nodes, for placing points on split lines.
+static int CollectSplits(const pointNode *node, point *splits, int max, int found){
+
+  if(IsLeaf(node) || found == max) return found;
+  splits[found].x = node->cx;
+  splits[found].y = node->cy;
+  found++;
+  found = CollectSplits(node->NorthWest,splits,max,found);
+  found = CollectSplits(node->NorthEast,splits,max,found);
+  found = CollectSplits(node->SouthWest,splits,max,found);
+  return CollectSplits(node->SouthEast,splits,max,found);
+
+}
+
+//Whether the point with this id is among the first n of out.
+static int Contains(const point *out, int n, int id){
+
+  int i;
+  for(i=0;i<n;i++){
+    if(out[i].id == id) return 1;
+  }
+  return 0;
+
+}
+
+//Brute force k-NN for checking: the k smallest distances, ascending.
+static void BruteNearest(const point *points, int n, double x, double y, int k, double *dists){
+
+  int i,j;
+  for(i=0;i<k;i++) dists[i] = INFINITY;
+  for(i=0;i<n;i++){
+    double d = (points[i].x-x)*(points[i].x-x) + (points[i].y-y)*(points[i].y-y);
+    if(d >= dists[k-1]) continue;
+    for(j=k-1;j>0 && dists[j-1] > d;j--) dists[j] = dists[j-1];
+    dists[j] = d;
+  }
+
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int n = argc > 1 ? strtol(argv[1],NULL,10) : 1000000;
+  int queries = argc > 2 ? strtol(argv[2],NULL,10) : 1000;
+  int brutequeries = 50;
+  int k = 10;
+  int i,j,q;
+
+  if(n < k || queries < brutequeries) errx(1,"Need at least %d points and %d queries.",k,brutequeries);
+
+  //Half uniform, half in tight clusters so the tree is unbalanced.
+  point *points = malloc(n*sizeof(point));
+  srand(1);
+  for(i=0;i<n;i++){
+    points[i].id = i;
+    if(i % 2 == 0){
+      points[i].x = (double)rand()/RAND_MAX;
+      points[i].y = (double)rand()/RAND_MAX;
+    }
+    else{
+      int c = rand() % 32;
+      points[i].x = 0.1 + 0.8*(c*0.618034 - (int)(c*0.618034)) + 0.002*((double)rand()/RAND_MAX - 0.5);
+      points[i].y = 0.1 + 0.8*(c*0.414214 - (int)(c*0.414214)) + 0.002*((double)rand()/RAND_MAX - 0.5);
+    }
+  }
+
+  double t0 = seconds();
+  pointNode *root = InitPointNode(0.5,0.5,0.5,0);
+  for(i=0;i<n;i++){
+    if(!InsertPoint(root,points[i])) errx(1,"Point %d outside the tree!",i);
+  }
+  double t1 = seconds();
+  printf("Built tree of %d points in %f s\n",n,t1-t0);
+
+  //An off-centre root, whose child centres do not round exactly: every point in the root
+  //square must still land, including those on its edges.
+  pointNode *offset = InitPointNode(0.3,0.3,0.7,0);
+  for(i=0;i<n;i++){
+    point p = {offset->xmin + (offset->xmax-offset->xmin)*rand()/RAND_MAX,
+               offset->ymin + (offset->ymax-offset->ymin)*rand()/RAND_MAX, i};
+    if(i % 4 == 0) p.x = (i % 8) ? offset->xmax : offset->xmin;
+    p.x = fmin(p.x,offset->xmax);
+    p.y = fmin(p.y,offset->ymax);
+    if(!InsertPoint(offset,p)) errx(1,"Point %d outside the off-centre tree!",i);
+  }
+  if(offset->count != n || RangeQuery(offset,offset->xmin,offset->ymin,offset->xmax,offset->ymax,NULL,0) != n)
+    errx(1,"Off-centre tree lost points!");
+
+  //Points exactly on split lines must be found by boxes that only touch them.
+  int lines = 2000;
+  point *online = malloc(lines*sizeof(point));
+  point *hits = malloc((n+lines)*sizeof(point));
+  lines = CollectSplits(offset,online,lines,0);
+  for(i=0;i<lines;i++){
+    online[i].id = n+i;
+    if(i % 3 == 0) online[i].y += 0.01*((double)rand()/RAND_MAX - 0.5); //Only on the vertical line.
+    if(i % 3 == 1) online[i].x += 0.01*((double)rand()/RAND_MAX - 0.5); //Only on the horizontal line.
+    online[i].x = fmax(fmin(online[i].x,offset->xmax),offset->xmin);
+    online[i].y = fmax(fmin(online[i].y,offset->ymax),offset->ymin);
+    if(!InsertPoint(offset,online[i])) errx(1,"Split point %d outside the tree!",i);
+  }
+  struct heap nodeheap = {NULL,0,0}, bestheap = {NULL,0,0};
+  for(i=0;i<lines;i++){
+    point p = online[i];
+    int m = RangeQuery(offset,p.x-0.001,p.y-0.001,p.x,p.y+0.001,hits,n+lines);
+    if(!Contains(hits,m,p.id)) errx(1,"Box ending on (%.17g,%.17g) missed it!",p.x,p.y);
+    m = RangeQuery(offset,p.x,p.y,p.x,p.y,hits,n+lines);
+    if(!Contains(hits,m,p.id)) errx(1,"Degenerate box at (%.17g,%.17g) missed it!",p.x,p.y);
+    point nearest;
+    if(NearestNeighbours(offset,p.x,p.y,1,&nearest,&nodeheap,&bestheap) != 1 || nearest.x != p.x || nearest.y != p.y)
+      errx(1,"Nearest neighbour of (%.17g,%.17g) is not itself!",p.x,p.y);
+  }
+  printf("Off-centre tree: %d points on split lines found by touching boxes\n",lines);
+  free(nodeheap.entries);
+  free(bestheap.entries);
+  free(online);
+  free(hits);
+  DeletePointTree(offset);
+
+  //Range queries: small boxes, checked against a linear scan.
+  point *out = malloc(n*sizeof(point));
+  double *qx = malloc(queries*sizeof(double));
+  double *qy = malloc(queries*sizeof(double));
+  for(q=0;q<queries;q++){
+    qx[q] = (double)rand()/RAND_MAX;
+    qy[q] = (double)rand()/RAND_MAX;
+  }
+  double box = 0.01;
+  long total = 0;
+  t0 = seconds();
+  for(q=0;q<queries;q++){
+    total += RangeQuery(root,qx[q],qy[q],qx[q]+box,qy[q]+box,out,n);
+  }
+  t1 = seconds();
+  double t2 = seconds();
+  for(q=0;q<brutequeries;q++){
+    int brute = 0;
+    for(i=0;i<n;i++){
+      if(points[i].x >= qx[q] && points[i].x <= qx[q]+box && points[i].y >= qy[q] && points[i].y <= qy[q]+box) brute++;
+    }
+    if(brute != RangeQuery(root,qx[q],qy[q],qx[q]+box,qy[q]+box,out,n)) errx(1,"Range query %d mismatch!",q);
+  }
+  double t3 = seconds();
+  printf("Range query: %.2f us per query (%.1f hits), brute force %.2f us\n",
+         (t1-t0)/queries*1e6,(double)total/queries,(t3-t2)/brutequeries*1e6);
+
+  //k-NN queries, checked against brute force distances.
+  struct heap nodes = {NULL,0,0}, best = {NULL,0,0};
+  point nn[k];
+  double dists[k];
+  t0 = seconds();
+  for(q=0;q<queries;q++){
+    NearestNeighbours(root,qx[q],qy[q],k,nn,&nodes,&best);
+  }
+  t1 = seconds();
+  t2 = seconds();
+  for(q=0;q<brutequeries;q++){
+    BruteNearest(points,n,qx[q],qy[q],k,dists);
+  }
+  t3 = seconds();
+  for(q=0;q<brutequeries;q++){
+    BruteNearest(points,n,qx[q],qy[q],k,dists);
+    if(NearestNeighbours(root,qx[q],qy[q],k,nn,&nodes,&best) != k) errx(1,"k-NN found too few points!");
+    for(j=0;j<k;j++){
+      double d = (nn[j].x-qx[q])*(nn[j].x-qx[q]) + (nn[j].y-qy[q])*(nn[j].y-qy[q]);
+      if(d != dists[j]) errx(1,"k-NN query %d mismatch at rank %d!",q,j);
+    }
+  }
+  printf("%d-NN query: %.2f us per query, brute force %.2f us\n",
+         k,(t1-t0)/queries*1e6,(t3-t2)/brutequeries*1e6);
+
+  //Delete every other point, then check the survivors are exactly what is left.
+  t0 = seconds();
+  for(i=0;i<n;i+=2){
+    if(!DeletePoint(root,points[i].x,points[i].y,points[i].id)) errx(1,"Point %d not found for delete!",i);
+  }
+  t1 = seconds();
+  if(root->count != n/2 || RangeQuery(root,0,0,1,1,out,n) != n/2) errx(1,"Wrong count after delete!");
+  for(i=0;i<n/2;i++){
+    if(out[i].id % 2 == 0) errx(1,"Deleted point %d still present!",out[i].id);
+  }
+  printf("Deleted %d points in %f s\n",(n+1)/2,t1-t0);
+
+  DeletePointTree(root);
+  free(nodes.entries);
+  free(best.entries);
+  free(points);
+  free(out);
+  free(qx);
+  free(qy);
+  return 0;
+}
@@ -1,13 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <float.h>
+#include <err.h>
 
 #define N 8
 #define MAX_DEPTH 2
 
 typedef struct treeNode{
 
-  double *grid; //Pointer to our part of the grid.
+  double *grid; //Base pointer of the grid we view into.
+  size_t offset; //Index of our top-left element in grid.
+  int stride; //Row stride of grid.
   int size; // Size of this subgrid
+  int owned; //Whether this node allocated grid itself.
 
   //Pointers to the next level of the tree.
   struct treeNode *NorthWest; 
@@ -16,6 +24,9 @@ typedef struct treeNode{
   struct treeNode *SouthEast;
 } treeNode;
 
+//Element (x,y) of a node's subgrid.
+#define NODE_AT(node,x,y) ((node)->grid[(node)->offset + (size_t)(y)*(node)->stride + (x)])
+
 
 // Fills array with some numbers
 void FillGrid(double* grid,int size){
@@ -24,7 +35,7 @@ void FillGrid(double* grid,int size){
 
   for(y=0;y<size;y++){
     for(x=0;x<size;x++){
-      *(grid + y*size + x) = (x+1)*(y+1);
+      *(grid + (size_t)y*size + x) = (x+1)*(y+1);
     }
   }
 
@@ -44,13 +55,29 @@ void PrintGrid(double* grid, int size){
 
 }
 
+// Prints out every number in a node's view of the grid.
+void PrintNode(treeNode *node){
+
+  int x,y;
+
+  for(y=0;y<node->size;y++){
+    for(x=0;x<node->size;x++){
+      printf("%f ",NODE_AT(node,x,y));
+    }
+    printf("\n");
+  }
 
+}
 
 
 //Returns empty treeNode.
 treeNode* InitNode(){
 
   treeNode *temp = (treeNode*)malloc(sizeof(treeNode));
+  temp->grid = NULL;
+  temp->offset = 0;
+  temp->stride = temp->size = 0;
+  temp->owned = 0;
   temp->NorthWest = temp->NorthEast =
     temp->SouthWest = temp->SouthEast = NULL;
   return temp;
@@ -60,6 +87,7 @@ treeNode* InitNode(){
 //Statically divided quad tree. Data allocated at leaves.
 treeNode* StaticTree(treeNode *Root, int size, int depth){
 
+  Root->size = size;
   if(depth>0){
     Root->NorthWest = StaticTree(InitNode(),size/2,depth-1);
     Root->NorthEast = StaticTree(InitNode(),size/2,depth-1);
@@ -68,21 +96,23 @@ treeNode* StaticTree(treeNode *Root, int size, int depth){
   }
   else{
     //Substitute this for whatever allocation you want.
-    Root->grid = (double*)malloc(size*size*sizeof(double));
+    Root->grid = (double*)malloc((size_t)size*size*sizeof(double));
+    Root->stride = size;
+    Root->owned = 1;
   }
 
   return Root;
     
 }
 //TODO: change to callback.
-//Free all data at leaves of static tree.
+//Free all nodes below Root, and any data the leaves allocated themselves.
 void DeleteStaticTree(treeNode *Root){
 
 
   if(Root->NorthWest == NULL && Root->NorthEast == NULL &&
      Root->SouthWest == NULL && Root->SouthEast == NULL){
-    //Assume we are at a leaf
-    free(Root->grid);
+    //Assume we are at a leaf. Views into someone else's grid are left alone.
+    if(Root->owned) free(Root->grid);
   }
   else{
     DeleteStaticTree(Root->NorthWest);
@@ -98,102 +128,105 @@ void DeleteStaticTree(treeNode *Root){
 
 }
 
-//Statically distributes a grid to equal subgrids on the leaf of a quad-tree.
-treeNode* DistributeGridTree(double *grid, treeNode *Root, int size, int depth){
+//Points Root at a size x size window of grid starting at offset, and recurses.
+static treeNode* DistributeView(double *grid, size_t offset, int stride, treeNode *Root, int size, int depth){
 
+  Root->grid = grid;
+  Root->offset = offset;
+  Root->stride = stride;
+  Root->size = size;
 
   if(depth > 0){
-    
     int sizen = size/2;
-    printf("Size: %d\n",sizen);
-    //Allocate our subgrids.
-    double *temp_nw = malloc(sizen * sizen * sizeof(double));
-    double *temp_ne = malloc(sizen * sizen * sizeof(double));
-    double *temp_sw = malloc(sizen * sizen * sizeof(double));
-    double *temp_se = malloc(sizen * sizen * sizeof(double));
+    size_t south = (size_t)sizen*stride;
 
-    //Define new bounds in sub-memory.
-    int nw_min_x, nw_max_x, nw_min_y, nw_max_y;
-    int ne_min_x, ne_max_x, ne_min_y, ne_max_y;
-    int sw_min_x, sw_max_x, sw_min_y, sw_max_y;
-    int se_min_x, se_max_x, se_min_y, se_max_y;
+    //Each quadrant is just a shifted view: no data is touched.
+    Root->NorthWest = DistributeView(grid,offset,stride,InitNode(),sizen,depth-1);
+    Root->NorthEast = DistributeView(grid,offset+sizen,stride,InitNode(),sizen,depth-1);
+    Root->SouthWest = DistributeView(grid,offset+south,stride,InitNode(),sizen,depth-1);
+    Root->SouthEast = DistributeView(grid,offset+south+sizen,stride,InitNode(),sizen,depth-1);
+  }
 
+  return Root;
 
+}
 
-    //Now Copy our Memory. This can be made more efficient with memcpy.
-    //More trying to demonstrate the point.
+//Statically distributes a grid to equal subgrids on the leaf of a quad-tree.
+//Every node stores a strided view into the original grid, so the build costs O(nodes)
+//and the grid must outlive the tree.
+treeNode* DistributeGridTree(double *grid, treeNode *Root, int size, int depth){
 
-   
-    int x,y;
+  if(depth < 0 || size % (1 << depth) != 0) errx(1,"Grid size %d is not divisible into %d levels!",size,depth);
+  return DistributeView(grid,0,size,Root,size,depth);
 
-    //NorthWest
+}
 
-    for (y = 0; y < sizen; y++){
-      for(x = 0; x < sizen; x++){
-	*(temp_nw+y*sizen+x) = *(grid + y*size + x);
-      }
-    }
- 
-    //NorthEast
-    for (y = 0; y < sizen; y++){
-      for(x = 0; x < sizen; x++){
-	*(temp_ne+y*sizen+x) = *(grid + y*size + (x+sizen));
-      }
-    }
-   
-    //SouthWest
-   
-    for (y = 0; y< sizen; y++){
-      for (x = 0; x< sizen; x++){
-	*(temp_sw + y*sizen+x) = *(grid + (y+sizen)*size + x);
-      }
-    }
+//Copies leaf tiles into one buffer in Morton (Z) order: NW, NE, SW, SE at every level.
+static size_t RepackLeaves(treeNode *Root, double *tiles, size_t position){
 
-    //SouthEast
-   
-    for (y = 0; y< sizen; y++){
-      for (x = 0; x< sizen; x++){
-	*(temp_se + y*sizen+x) = *(grid + (y+sizen)*size + (x+sizen));
-      }
+  if(Root->NorthWest == NULL){
+    int y;
+    for(y=0;y<Root->size;y++){
+      memcpy(tiles+position+(size_t)y*Root->size,&NODE_AT(Root,0,y),Root->size*sizeof(double));
     }
+    Root->grid = tiles;
+    Root->offset = position;
+    Root->stride = Root->size;
+    return position + (size_t)Root->size*Root->size;
+  }
+  position = RepackLeaves(Root->NorthWest,tiles,position);
+  position = RepackLeaves(Root->NorthEast,tiles,position);
+  position = RepackLeaves(Root->SouthWest,tiles,position);
+  return RepackLeaves(Root->SouthEast,tiles,position);
 
+}
 
-    //Print Grids..
-    printf("NW Grid: \n");
-    PrintGrid(temp_nw,size/2);
-    printf("NE Grid: \n");
-    PrintGrid(temp_ne,size/2);
-    printf("SW Grid: \n");
-    PrintGrid(temp_sw,size/2);
-    printf("SE Grid: \n");
-    PrintGrid(temp_se,size/2);
-    
-    //Finally, recurse down a level!
-    Root->NorthWest = DistributeGridTree(temp_nw,InitNode(),size/2,depth-1);
-    Root->NorthEast = DistributeGridTree(temp_ne,InitNode(),size/2,depth-1);
-    Root->SouthWest = DistributeGridTree(temp_sw,InitNode(),size/2,depth-1);
-    Root->SouthEast = DistributeGridTree(temp_se,InitNode(),size/2,depth-1);
-    
-    
-  }
-  else{
-    //Thise node is a leaf. Assign grid here.
-    Root->grid = grid;
-  }
+//One-shot repack of a distributed tree so that each leaf is a contiguous tile and
+//neighbouring leaves are neighbours in memory. Leaves are re-pointed into the returned
+//buffer, which the caller frees after DeleteStaticTree; interior nodes keep their views
+//into the original grid.
+double* RepackMorton(treeNode *Root){
 
-  return Root;
+  double *tiles = malloc((size_t)Root->size*Root->size*sizeof(double));
+  if(tiles == NULL) errx(1,"Could not allocate tiles!");
+  RepackLeaves(Root,tiles,0);
+  return tiles;
+
+}
 
+//Sums every leaf, so views can be checked against the original grid.
+double SumLeaves(treeNode *Root){
+
+  if(Root->NorthWest == NULL){
+    double sum = 0.0;
+    int x,y;
+    for(y=0;y<Root->size;y++){
+      for(x=0;x<Root->size;x++){
+        sum += NODE_AT(Root,x,y);
+      }
+    }
+    return sum;
+  }
+  return SumLeaves(Root->NorthWest) + SumLeaves(Root->NorthEast) +
+    SumLeaves(Root->SouthWest) + SumLeaves(Root->SouthEast);
 
 }
 
-    
+static double seconds(void){
 
-int main() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]) {
 
   //Basic Quad-Tree
   treeNode *tree = InitNode();
   StaticTree(tree,N,MAX_DEPTH);
   DeleteStaticTree(tree);
+  free(tree);
 
 
   //Distribute a grid recursively...
@@ -203,7 +236,48 @@ int main() {
   treeNode *disroot = InitNode();
   printf("DistributeGridTree: \n");
   DistributeGridTree(grid, disroot, N, MAX_DEPTH);
+  printf("NW Grid: \n");
+  PrintNode(disroot->NorthWest);
+  printf("SE of SE Grid: \n");
+  PrintNode(disroot->SouthEast->SouthEast);
+  DeleteStaticTree(disroot);
+  free(disroot);
+  free(grid);
+
+
+  //Large grid: building views is independent of the grid size.
+  int size = argc > 1 ? strtol(argv[1],NULL,10) : 8192;
+  int depth = argc > 2 ? strtol(argv[2],NULL,10) : 6;
+  grid = malloc((size_t)size*size*sizeof(double));
+  if(grid == NULL) errx(1,"Could not allocate grid!");
+  FillGrid(grid,size);
+  double expected = 0.0;
+  size_t i;
+  for(i=0;i<(size_t)size*size;i++) expected += grid[i];
+
+  disroot = InitNode();
+  double t0 = seconds();
+  DistributeGridTree(grid, disroot, size, depth);
+  double t1 = seconds();
+  double viewsum = SumLeaves(disroot);
+  double t2 = seconds();
+  double *tiles = RepackMorton(disroot);
+  double t3 = seconds();
+  double tilesum = SumLeaves(disroot);
+  double t4 = seconds();
+
+  //Both tree sums add the leaves in the same order, so they agree exactly. The flat loop
+  //uses another order, and once the total passes 2^53 it is only exact to rounding: allow
+  //the worst case for summing size*size positive terms.
+  if(tilesum != viewsum) errx(1,"Sum via tiles %.17g differs from sum via views %.17g!",tilesum,viewsum);
+  if(fabs(viewsum-expected) > (double)size*size*DBL_EPSILON*expected) errx(1,"Leaf sums do not match grid!");
+  printf("%d x %d grid, depth %d: build %f s, sum via views %f s, Morton repack %f s, sum via tiles %f s\n",
+         size,size,depth,t1-t0,t2-t1,t3-t2,t4-t3);
+
   DeleteStaticTree(disroot);
+  free(disroot);
+  free(tiles);
+  free(grid);
   
   return 0;
 }
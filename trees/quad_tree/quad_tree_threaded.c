@@ -0,0 +1,370 @@
+/* Threaded version of quad_tree.c.
+ *
+ * The four quadrants of a node are independent, so each recursive operation hands three of
+ * them to new threads and does the fourth itself, for the top few levels of the tree. Below
+ * spawn_levels, or once a node holds fewer than GRAIN_SIZE elements, it carries on
+ * sequentially. Results of reductions are combined in a fixed NW, NE, SW, SE order, so they
+ * do not depend on the number of threads. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+
+#define GRAIN_SIZE (64*64) //Elements below which a node is never split across threads.
+
+typedef struct treeNode{
+
+  double *grid; //Base pointer of the grid we view into.
+  size_t offset; //Index of our top-left element in grid.
+  int stride; //Row stride of grid.
+  int size; // Size of this subgrid
+  int owned; //Whether this node allocated grid itself.
+
+  //Pointers to the next level of the tree.
+  struct treeNode *NorthWest; 
+  struct treeNode *NorthEast;
+  struct treeNode *SouthWest;
+  struct treeNode *SouthEast;
+} treeNode;
+
+#define NODE_AT(node,x,y) ((node)->grid[(node)->offset + (size_t)(y)*(node)->stride + (x)])
+
+typedef void (*leaf_map)(treeNode *leaf, void *arg);
+typedef double (*leaf_reduce)(const treeNode *leaf, void *arg);
+typedef double (*reduce_combine)(double a, double b);
+
+enum tree_op { OP_STATIC, OP_DELETE, OP_MAP, OP_REDUCE };
+
+//Encapsulates all data for each thread: one quadrant and what to do with it.
+struct thread_data {
+  pthread_t thread_id;
+  enum tree_op op;
+  treeNode *node;
+  int size;
+  int depth;
+  int spawn_levels;
+  leaf_map map;
+  leaf_reduce reduce;
+  reduce_combine combine;
+  void *arg;
+  double result;
+};
+
+//Returns empty treeNode.
+treeNode* InitNode(){
+
+  treeNode *temp = (treeNode*)malloc(sizeof(treeNode));
+  temp->grid = NULL;
+  temp->offset = 0;
+  temp->stride = temp->size = 0;
+  temp->owned = 0;
+  temp->NorthWest = temp->NorthEast =
+    temp->SouthWest = temp->SouthEast = NULL;
+  return temp;
+
+}
+
+static inline int IsLeaf(const treeNode *node){
+  return node->NorthWest == NULL;
+}
+
+static void RunOp(struct thread_data *task);
+
+void *tree_worker(void *threadArg){
+
+  RunOp((struct thread_data *) threadArg);
+  return NULL;
+
+}
+
+//Runs the same operation on all four children, in parallel while spawn_levels lasts.
+static void RunChildren(struct thread_data *task, treeNode *children[4], int size){
+
+  struct thread_data sub[4];
+  int c;
+  int parallel = task->spawn_levels > 0 && (long)size*size*4 >= GRAIN_SIZE;
+
+  for(c=0;c<4;c++){
+    sub[c] = *task;
+    sub[c].node = children[c];
+    sub[c].size = size;
+    sub[c].depth = task->depth-1;
+    sub[c].spawn_levels = task->spawn_levels-1;
+  }
+  if(parallel){
+    for(c=0;c<3;c++){
+      if(pthread_create(&sub[c].thread_id,NULL,tree_worker,&sub[c])) errx(1,"Thread creation failed.");
+    }
+    RunOp(&sub[3]);
+    for(c=0;c<3;c++) pthread_join(sub[c].thread_id,NULL);
+  }
+  else{
+    for(c=0;c<4;c++) RunOp(&sub[c]);
+  }
+  if(task->op == OP_REDUCE){
+    task->result = task->combine(task->combine(sub[0].result,sub[1].result),
+                                 task->combine(sub[2].result,sub[3].result));
+  }
+
+}
+
+static void RunOp(struct thread_data *task){
+
+  treeNode *Root = task->node;
+
+  switch(task->op){
+  case OP_STATIC:
+    Root->size = task->size;
+    if(task->depth > 0){
+      treeNode *children[4] = {InitNode(),InitNode(),InitNode(),InitNode()};
+      Root->NorthWest = children[0];
+      Root->NorthEast = children[1];
+      Root->SouthWest = children[2];
+      Root->SouthEast = children[3];
+      RunChildren(task,children,task->size/2);
+    }
+    else{
+      //Allocated by the thread that will go on to use it.
+      Root->grid = (double*)malloc((size_t)task->size*task->size*sizeof(double));
+      Root->stride = task->size;
+      Root->owned = 1;
+    }
+    return;
+  case OP_DELETE:
+    if(IsLeaf(Root)){
+      if(Root->owned) free(Root->grid);
+    }
+    else{
+      treeNode *children[4] = {Root->NorthWest,Root->NorthEast,Root->SouthWest,Root->SouthEast};
+      int c;
+      RunChildren(task,children,Root->size/2);
+      for(c=0;c<4;c++) free(children[c]);
+      Root->NorthWest = Root->NorthEast = Root->SouthWest = Root->SouthEast = NULL;
+    }
+    return;
+  case OP_MAP:
+  case OP_REDUCE:
+    if(IsLeaf(Root)){
+      if(task->op == OP_MAP) task->map(Root,task->arg);
+      else task->result = task->reduce(Root,task->arg);
+    }
+    else{
+      treeNode *children[4] = {Root->NorthWest,Root->NorthEast,Root->SouthWest,Root->SouthEast};
+      RunChildren(task,children,Root->size/2);
+    }
+    return;
+  }
+
+}
+
+//Levels of four-way spawning needed to give every thread work.
+static int SpawnLevels(int threads){
+
+  int levels = 0, tasks = 1;
+  while(tasks < threads){
+    tasks *= 4;
+    levels++;
+  }
+  return levels;
+
+}
+
+//Statically divided quad tree, built in parallel. Data allocated at leaves.
+treeNode* StaticTreeThreaded(treeNode *Root, int size, int depth, int threads){
+
+  struct thread_data task = {0};
+  task.op = OP_STATIC;
+  task.node = Root;
+  task.size = size;
+  task.depth = depth;
+  task.spawn_levels = SpawnLevels(threads);
+  RunOp(&task);
+  return Root;
+
+}
+
+//Free all nodes below Root, and any data the leaves allocated themselves.
+void DeleteStaticTreeThreaded(treeNode *Root, int threads){
+
+  struct thread_data task = {0};
+  task.op = OP_DELETE;
+  task.node = Root;
+  task.spawn_levels = SpawnLevels(threads);
+  RunOp(&task);
+
+}
+
+//Calls map on every leaf.
+void MapLeavesThreaded(treeNode *Root, leaf_map map, void *arg, int threads){
+
+  struct thread_data task = {0};
+  task.op = OP_MAP;
+  task.node = Root;
+  task.map = map;
+  task.arg = arg;
+  task.spawn_levels = SpawnLevels(threads);
+  RunOp(&task);
+
+}
+
+//Reduces every leaf with reduce and combines the results up the tree.
+double ReduceTreeThreaded(treeNode *Root, leaf_reduce reduce, reduce_combine combine, void *arg, int threads){
+
+  struct thread_data task = {0};
+  task.op = OP_REDUCE;
+  task.node = Root;
+  task.reduce = reduce;
+  task.combine = combine;
+  task.arg = arg;
+  task.spawn_levels = SpawnLevels(threads);
+  RunOp(&task);
+  return task.result;
+
+}
+
+//Strided views over an existing grid, as in quad_tree.c.
+static treeNode* DistributeView(double *grid, size_t offset, int stride, treeNode *Root, int size, int depth){
+
+  Root->grid = grid;
+  Root->offset = offset;
+  Root->stride = stride;
+  Root->size = size;
+  if(depth > 0){
+    int sizen = size/2;
+    size_t south = (size_t)sizen*stride;
+    Root->NorthWest = DistributeView(grid,offset,stride,InitNode(),sizen,depth-1);
+    Root->NorthEast = DistributeView(grid,offset+sizen,stride,InitNode(),sizen,depth-1);
+    Root->SouthWest = DistributeView(grid,offset+south,stride,InitNode(),sizen,depth-1);
+    Root->SouthEast = DistributeView(grid,offset+south+sizen,stride,InitNode(),sizen,depth-1);
+  }
+  return Root;
+
+}
+
+treeNode* DistributeGridTree(double *grid, treeNode *Root, int size, int depth){
+
+  if(depth < 0 || size % (1 << depth) != 0) errx(1,"Grid size %d is not divisible into %d levels!",size,depth);
+  return DistributeView(grid,0,size,Root,size,depth);
+
+}
+
+//Example callbacks: fill a leaf with a moderately expensive function, then sum or max it.
+static void FillLeaf(treeNode *leaf, void *arg){
+
+  int x,y;
+  double scale = *(double *)arg;
+  for(y=0;y<leaf->size;y++){
+    for(x=0;x<leaf->size;x++){
+      NODE_AT(leaf,x,y) = sin(scale*x)*cos(scale*y) + sin(x*y*scale);
+    }
+  }
+
+}
+
+static double SumLeaf(const treeNode *leaf, void *arg){
+
+  int x,y;
+  double sum = 0.0;
+  (void)arg;
+  for(y=0;y<leaf->size;y++){
+    for(x=0;x<leaf->size;x++){
+      sum += NODE_AT(leaf,x,y);
+    }
+  }
+  return sum;
+
+}
+
+static double MaxLeaf(const treeNode *leaf, void *arg){
+
+  int x,y;
+  double max = -INFINITY;
+  (void)arg;
+  for(y=0;y<leaf->size;y++){
+    for(x=0;x<leaf->size;x++){
+      if(NODE_AT(leaf,x,y) > max) max = NODE_AT(leaf,x,y);
+    }
+  }
+  return max;
+
+}
+
+static double Add(double a, double b){ return a + b; }
+static double Max(double a, double b){ return a > b ? a : b; }
+
+//Fills each view with its own offset so results are reproducible between trees.
+static void FillView(treeNode *leaf, void *arg){
+
+  int x,y;
+  double scale = *(double *)arg;
+  for(y=0;y<leaf->size;y++){
+    for(x=0;x<leaf->size;x++){
+      double i = (double)(leaf->offset + (size_t)y*leaf->stride + x);
+      NODE_AT(leaf,x,y) = sin(scale*i);
+    }
+  }
+
+}
+
+static double seconds(void){
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+}
+
+int main(int argc, char *argv[]){
+
+  int size = argc > 1 ? strtol(argv[1],NULL,10) : 4096;
+  int depth = argc > 2 ? strtol(argv[2],NULL,10) : 5;
+  int threads = argc > 3 ? strtol(argv[3],NULL,10) : 16;
+  double scale = 0.001;
+
+  if(size < 1 || depth < 0 || threads < 1 || size % (1 << depth)) errx(1,"Usage: %s [size] [depth] [threads]",argv[0]);
+
+  //Static tree with leaf-owned data: build, fill, reduce and delete, sequential then threaded.
+  int t, runs[2] = {1,threads};
+  for(t=0;t<2;t++){
+    treeNode *tree = InitNode();
+    double t0 = seconds();
+    StaticTreeThreaded(tree,size,depth,runs[t]);
+    double t1 = seconds();
+    MapLeavesThreaded(tree,FillLeaf,&scale,runs[t]);
+    double t2 = seconds();
+    double max = ReduceTreeThreaded(tree,MaxLeaf,Max,NULL,runs[t]);
+    double t3 = seconds();
+    DeleteStaticTreeThreaded(tree,runs[t]);
+    double t4 = seconds();
+    free(tree);
+    printf("%2d threads: build %f s, map %f s, reduce %f s, delete %f s (max %f)\n",
+           runs[t],t1-t0,t2-t1,t3-t2,t4-t3,max);
+  }
+
+  //Views over one grid: the threaded reduction must match a flat loop in the same order.
+  double *grid = malloc((size_t)size*size*sizeof(double));
+  if(grid == NULL) errx(1,"Could not allocate grid!");
+  treeNode *views = InitNode();
+  DistributeGridTree(grid,views,size,depth);
+  MapLeavesThreaded(views,FillView,&scale,threads);
+  double sequential = ReduceTreeThreaded(views,SumLeaf,Add,NULL,1);
+  double threaded = ReduceTreeThreaded(views,SumLeaf,Add,NULL,threads);
+  if(sequential != threaded) errx(1,"Threaded reduction differs: %.17g vs %.17g",threaded,sequential);
+  size_t i;
+  double flat = 0.0;
+  for(i=0;i<(size_t)size*size;i++){
+    if(grid[i] != sin(scale*(double)i)) errx(1,"Map wrote the wrong value at %zu!",i);
+    flat += grid[i];
+  }
+  if(fabs(flat-threaded) > 1e-9*(double)size*size) errx(1,"Tree sum %f does not match grid sum %f!",threaded,flat);
+  printf("Reduction over views matches across thread counts (sum %f)\n",threaded);
+
+  DeleteStaticTreeThreaded(views,threads);
+  free(views);
+  free(grid);
+  return 0;
+}